@@ -0,0 +1,99 @@
+#include "benchmark.h"
+#include "initializers.h"
+#include <algorithm>
+#include <float.h>
+#include <stdio.h>
+#include <string>
+
+// the population sizes tried, doubling from 1
+static const size_t c_largestPopulation = 32;
+
+// the seeds each population size is tried with
+static const unsigned int c_seeds[] = { 5489, 1, 2 };
+static const size_t c_seedCount = sizeof(c_seeds) / sizeof(c_seeds[0]);
+
+// how close to the best training RMSE counts as finding it
+static const double c_tolerance = 0.001f;
+
+void BenchmarkInitializers(const Dataset& dataset, const std::vector<ModelRun>& baseRuns, std::vector<ModelRun>& runs, std::vector<ModelReport>& reports)
+{
+    size_t initializerCount = size_t(PopulationInitializer::Count);
+    std::vector<size_t> populations;
+    for (size_t population = 1; population <= c_largestPopulation; population *= 2)
+        populations.push_back(population);
+
+    // every combination of run, initializer, seed and population size, in that order
+    runs.clear();
+    for (const ModelRun& baseRun : baseRuns)
+    {
+        for (size_t initializer = 0; initializer < initializerCount; ++initializer)
+        {
+            for (unsigned int seed : c_seeds)
+            {
+                for (size_t population : populations)
+                {
+                    ModelRun run = baseRun;
+                    run.settings.values["init"] = double(initializer);
+                    run.settings.values["seed"] = double(seed);
+                    run.settings.values["population"] = double(population);
+                    run.spec += (run.spec.find(':') == std::string::npos) ? ":" : ",";
+                    run.spec += "init=" + std::to_string(initializer) + ",seed=" + std::to_string(seed) + ",population=" + std::to_string(population);
+                    runs.push_back(run);
+                }
+            }
+        }
+    }
+
+    printf("Benchmarking %zu initializers over %zu runs\n\n", initializerCount, runs.size());
+    ExecuteRuns(dataset, runs, reports, false);
+
+    auto trainRMSE = [&](size_t runIndex)
+    {
+        for (const auto& value : reports[runIndex].values)
+        {
+            if (value.first == "train_rmse")
+                return value.second;
+        }
+        return DBL_MAX;
+    };
+
+    printf("Population members needed to get within %0.1f%% of the best training RMSE, per seed (- if %zu weren't enough)\n", c_tolerance * 100.0f, c_largestPopulation);
+    printf("  %-24s", "run");
+    for (size_t initializer = 0; initializer < initializerCount; ++initializer)
+        printf("%-18s", InitializerName(PopulationInitializer(initializer)));
+    printf("\n");
+
+    size_t runsPerBaseRun = initializerCount * c_seedCount * populations.size();
+    for (size_t baseIndex = 0; baseIndex < baseRuns.size(); ++baseIndex)
+    {
+        size_t firstRun = baseIndex * runsPerBaseRun;
+
+        double bestRMSE = DBL_MAX;
+        for (size_t runIndex = firstRun; runIndex < firstRun + runsPerBaseRun; ++runIndex)
+            bestRMSE = std::min(bestRMSE, trainRMSE(runIndex));
+        double target = bestRMSE * (1.0f + c_tolerance);
+
+        printf("  %-24s", baseRuns[baseIndex].spec.c_str());
+        for (size_t initializer = 0; initializer < initializerCount; ++initializer)
+        {
+            std::string cell;
+            for (size_t seedIndex = 0; seedIndex < c_seedCount; ++seedIndex)
+            {
+                size_t seriesRun = firstRun + (initializer * c_seedCount + seedIndex) * populations.size();
+                std::string needed = "-";
+                for (size_t populationIndex = 0; populationIndex < populations.size(); ++populationIndex)
+                {
+                    if (trainRMSE(seriesRun + populationIndex) <= target)
+                    {
+                        needed = std::to_string(populations[populationIndex]);
+                        break;
+                    }
+                }
+                cell += (seedIndex > 0) ? " " + needed : needed;
+            }
+            printf("%-18s", cell.c_str());
+        }
+        printf("   (best %0.2f)\n", bestRMSE);
+    }
+    printf("\n");
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+#include "utils.h"
+#include "runner.h"
+
+/*
+
+Benchmark of the population initializers.
+
+Each run is repeated with every initializer, several seeds, and populations of 1, 2, 4, ... members. For every initializer and
+seed, it finds the smallest population whose training RMSE gets within a small tolerance of the best training RMSE any of the
+runs found. Initializers that cover the coefficient space more evenly need fewer members to find a start that descends to the
+best fit.
+
+*/
+
+// Does the benchmark for each of the runs, prints a table of the results, and gives back every run it did with its report
+void BenchmarkInitializers(const Dataset& dataset, const std::vector<ModelRun>& baseRuns, std::vector<ModelRun>& runs, std::vector<ModelReport>& reports);
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+#include "utils.h"
+#include "population.h"
+#include "scheduler.h"
+
+/*
+
+Bootstrap confidence intervals.
+
+The models report a single best set of coefficients, with no idea how much they would change with different training data.
+The bootstrap estimates that by refitting on resamples of the training rows (the same number of rows, drawn with replacement)
+and looking at the spread of the results. The interval of a value is the range between the percentiles of it over all the
+resamples, like the 2.5th and 97.5th percentiles for a 95% interval.
+
+* Resamples are index views of the training data, so they don't copy any rows.
+* Each refit is warm started from the fit on all of the data, which is already close, so it converges in a few steps.
+* Resamples are refit in parallel. Each has its own random number generator seeded from the resample index, so the results
+  don't depend on the order they run in, or how many workers there are.
+
+*/
+
+struct ConfidenceInterval
+{
+    double low = 0.0f;
+    double median = 0.0f;
+    double high = 0.0f;
+};
+
+// The percentile interval of the samples, holding the given fraction of them, like 0.95
+inline ConfidenceInterval PercentileInterval(std::vector<double> samples, double confidence)
+{
+    ConfidenceInterval ret;
+    if (samples.empty())
+        return ret;
+
+    std::sort(samples.begin(), samples.end());
+
+    // linearly interpolate between the closest ranks
+    auto percentile = [&](double fraction)
+    {
+        double position = fraction * double(samples.size() - 1);
+        size_t index = size_t(position);
+        if (index + 1 >= samples.size())
+            return samples.back();
+        return Lerp(samples[index], samples[index + 1], position - double(index));
+    };
+
+    double tail = (1.0f - confidence) * 0.5f;
+    ret.low = percentile(tail);
+    ret.median = percentile(0.5f);
+    ret.high = percentile(1.0f - tail);
+    return ret;
+}
+
+// Refits on resampleCount resamples of the rows, in parallel. optimize(member, rows) is the model's optimizer. It's called
+// with member.start set to the warm start coefficients, and should leave the fit in member.bestCoefficients.
+template <size_t N, typename T, typename OPTIMIZE>
+std::vector<PopulationMember<N>> BootstrapFits(const DataView<T>& rows, size_t resampleCount, unsigned int seed, const std::array<double, N>& warmStart, const OPTIMIZE& optimize)
+{
+    std::vector<PopulationMember<N>> fits(resampleCount);
+    ParallelFor(0, resampleCount, 1,
+        [&](size_t resampleIndex)
+        {
+            // draw the rows of this resample
+            std::seed_seq seedSequence{ seed, (unsigned int)resampleIndex };
+            std::mt19937 rng(seedSequence);
+            std::uniform_int_distribution<size_t> dist(0, rows.Size() - 1);
+            std::vector<size_t> indices(rows.Size());
+            for (size_t& index : indices)
+                index = dist(rng);
+            DataView<T> resample = SelectRows(rows, indices);
+
+            PopulationMember<N>& fit = fits[resampleIndex];
+            fit.start = warmStart;
+            optimize(fit, resample);
+        }
+    );
+    return fits;
+}
+
+template <size_t N>
+struct BootstrapIntervals
+{
+    size_t resampleCount = 0;
+    double confidence = 0.0f;
+    std::array<ConfidenceInterval, N> coefficients;
+    ConfidenceInterval testRMSE;
+    PopulationStats stats;
+};
+
+// Calculates the intervals of the fits. score(coefficients) is called in parallel on each fit's coefficients. It should map them
+// to the units they are reported in, in place, and return the test RMSE.
+template <size_t N, typename SCORE>
+BootstrapIntervals<N> CalculateBootstrapIntervals(std::vector<PopulationMember<N>>& fits, double confidence, const SCORE& score)
+{
+    std::vector<double> testRMSEs(fits.size());
+    ParallelFor(0, fits.size(), 1,
+        [&](size_t fitIndex)
+        {
+            testRMSEs[fitIndex] = score(fits[fitIndex].bestCoefficients);
+        }
+    );
+
+    BootstrapIntervals<N> ret;
+    ret.resampleCount = fits.size();
+    ret.confidence = confidence;
+    ret.testRMSE = PercentileInterval(testRMSEs, confidence);
+    ret.stats = TotalStats(fits);
+
+    std::vector<double> samples(fits.size());
+    for (size_t index = 0; index < N; ++index)
+    {
+        for (size_t fitIndex = 0; fitIndex < fits.size(); ++fitIndex)
+            samples[fitIndex] = fits[fitIndex].bestCoefficients[index];
+        ret.coefficients[index] = PercentileInterval(samples, confidence);
+    }
+    return ret;
+}
+
+template <size_t N>
+void ReportBootstrapIntervals(ModelReport& report, const BootstrapIntervals<N>& intervals)
+{
+    report.Printf("  Bootstrap %0.0f%% intervals over %zu resamples (%0.2f steps per resample):\n", intervals.confidence * 100.0f, intervals.resampleCount, double(intervals.stats.steps) / double(intervals.resampleCount));
+    for (size_t index = 0; index < N; ++index)
+    {
+        const ConfidenceInterval& interval = intervals.coefficients[index];
+        report.Printf("    [%zu]: %0.4f to %0.4f\n", index, interval.low, interval.high);
+
+        std::string name = "coefficient_" + std::to_string(index);
+        report.Value((name + "_low").c_str(), interval.low);
+        report.Value((name + "_high").c_str(), interval.high);
+    }
+    report.Printf("    RMSE on test set: %0.2f to %0.2f\n", intervals.testRMSE.low, intervals.testRMSE.high);
+    report.Value("bootstrap_test_rmse_low", intervals.testRMSE.low);
+    report.Value("bootstrap_test_rmse_median", intervals.testRMSE.median);
+    report.Value("bootstrap_test_rmse_high", intervals.testRMSE.high);
+}
@@ -0,0 +1,114 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+CheckpointWriter::~CheckpointWriter()
+{
+    Stop();
+}
+
+void CheckpointWriter::Start(const std::string& checkpointFileName, std::function<std::vector<char>()> snapshotFunction, double intervalSeconds)
+{
+    Stop();
+    fileName = checkpointFileName;
+    snapshot = std::move(snapshotFunction);
+    interval = intervalSeconds;
+    stop = false;
+    thread = std::thread([this]() { ThreadFunction(); });
+}
+
+void CheckpointWriter::Stop()
+{
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_one();
+    thread.join();
+}
+
+void CheckpointWriter::ThreadFunction()
+{
+    size_t writtenGeneration = 0;
+    bool stopping = false;
+    while (!stopping)
+    {
+        // wait out the interval, or until told to stop. Anything dirty is written before stopping.
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait_for(lock, std::chrono::duration<double>(interval), [this]() { return stop; });
+            stopping = stop;
+        }
+
+        size_t currentGeneration = generation;
+        if (currentGeneration == writtenGeneration)
+            continue;
+        writtenGeneration = currentGeneration;
+        std::vector<char> bytes = snapshot();
+
+        // write a temporary file, then replace the checkpoint with it
+        std::string tempFileName = fileName + ".tmp";
+        FILE* file = nullptr;
+        fopen_s(&file, tempFileName.c_str(), "wb");
+        if (!file)
+        {
+            printf("could not write checkpoint %s\n", tempFileName.c_str());
+            continue;
+        }
+        bool ok = bytes.empty() || fwrite(bytes.data(), bytes.size(), 1, file) == 1;
+        ok = (fclose(file) == 0) && ok;
+        if (ok)
+        {
+            remove(fileName.c_str());
+            ok = rename(tempFileName.c_str(), fileName.c_str()) == 0;
+        }
+        if (!ok)
+        {
+            printf("could not write checkpoint %s\n", fileName.c_str());
+            continue;
+        }
+
+        writeCount++;
+    }
+}
+
+std::string CheckpointKey(const ModelSettings& settings)
+{
+    // sorted, since the settings are in a hash map
+    std::vector<std::pair<std::string, double>> values(settings.values.begin(), settings.values.end());
+    std::sort(values.begin(), values.end());
+
+    std::string key;
+    char buffer[64];
+    for (const auto& value : values)
+    {
+        // how often checkpoints are made doesn't change the results
+        if (value.first == "checkpointSteps")
+            continue;
+
+        if (!key.empty())
+            key += ",";
+        snprintf(buffer, sizeof(buffer), "%.17g", value.second);
+        key += value.first + "=" + buffer;
+    }
+    return key;
+}
+
+bool ReadCheckpointFile(const std::string& fileName, std::vector<char>& bytes)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    bytes.resize(size_t(ftell(file)));
+    fseek(file, 0, SEEK_SET);
+    bool ok = bytes.empty() || fread(bytes.data(), bytes.size(), 1, file) == 1;
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "utils.h"
+#include "population.h"
+#include "convergence.h"
+
+/*
+
+Checkpoint and resume for population based fitting.
+
+Every member of the population keeps its progress in a MemberProgress: the current coefficients and loss, the step counter,
+the best seen so far, and the whole optimizer (step size, damping, history and so on). Every few steps a member copies its
+progress into the population's checkpoint, and a writer thread snapshots all the members and writes them out every so often.
+
+* The training loop never waits on the disk, or on the other members. Handing off progress is a copy of the one member
+  under a lock. Snapshotting the whole population is done by the writer, at most once per interval, and only if something
+  changed since the last write, so the cost doesn't grow with how many members there are times how often they check in.
+* The file is written to a temporary file and then renamed over the old one, so a crash while writing leaves the last
+  checkpoint intact.
+* Resuming restores each member exactly as it was, so it takes exactly the same steps it would have, and the results are
+  identical to a run that wasn't interrupted. Members that hadn't started yet start from scratch like normal.
+* The state of the model's random number generator is saved too, for anything that draws from it after the population is
+  made.
+* A checkpoint is only used if it was made with the same settings and data, otherwise the run starts over. The data is
+  identified by a hash of every value of the training rows, so a CSV that was edited in place doesn't match, even if it
+  still has the same number of rows.
+
+The optimizers and members are plain structs, so progress is saved as raw bytes. A checkpoint is only meant to be read by
+the same build of the program that wrote it.
+
+*/
+
+// Writes a file on its own thread, from what snapshot returns. It's written at most every intervalSeconds, and only if
+// MarkDirty was called since the last write.
+struct CheckpointWriter
+{
+    ~CheckpointWriter();
+
+    void Start(const std::string& fileName, std::function<std::vector<char>()> snapshot, double intervalSeconds);
+
+    // Writes the file if it's dirty, and stops the thread
+    void Stop();
+
+    // Lock free, so it can be called after every step
+    void MarkDirty()
+    {
+        generation++;
+    }
+
+    void ThreadFunction();
+
+    std::string fileName;
+    std::function<std::vector<char>()> snapshot;
+    double interval = 1.0;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stop = false;
+
+    // bumped by every MarkDirty, so the writer can tell if anything changed since it last wrote
+    std::atomic<size_t> generation{ 0 };
+
+    // how many times the file has been written
+    size_t writeCount = 0;
+};
+
+// Identifies the settings a checkpoint was made with, like "L2=0.1,population=20"
+std::string CheckpointKey(const ModelSettings& settings);
+
+// Identifies the training rows a checkpoint was made from, like "rows=8523 data=0123456789abcdef", from a hash of every value
+template <typename T>
+std::string CheckpointDataKey(const DataView<T>& rows)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t rowIndex = 0; rowIndex < rows.Size(); ++rowIndex)
+    {
+        for (T value : rows.Row(rowIndex))
+        {
+            uint64_t bits = 0;
+            memcpy(&bits, &value, sizeof(value));
+            hash = (hash ^ bits) * 0x100000001b3ull;
+            hash ^= hash >> 29;
+        }
+    }
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "rows=%zu data=%016llx", rows.Size(), (unsigned long long)hash);
+    return buffer;
+}
+
+// Reads a whole file, returning false if it doesn't exist
+bool ReadCheckpointFile(const std::string& fileName, std::vector<char>& bytes);
+
+// Where one member of a population is in its optimization
+template <size_t N, typename OPTIMIZER>
+struct MemberProgress
+{
+    bool started = false;
+    bool finished = false;
+    size_t stepIndex = 0;
+    std::array<double, N> coefficients;
+    double loss = 0.0f;
+
+    // why the member stopped, once it's finished
+    ConvergenceReason reason = ConvergenceReason::StepLimit;
+
+    PopulationMember<N> member;
+    OPTIMIZER optimizer;
+};
+
+template <size_t N, typename OPTIMIZER>
+struct PopulationCheckpoint
+{
+    typedef MemberProgress<N, OPTIMIZER> Progress;
+    static_assert(std::is_trivially_copyable<Progress>::value, "checkpoints save member progress as raw bytes");
+
+    ~PopulationCheckpoint()
+    {
+        writer.Stop();
+    }
+
+    // Loads the checkpoint file if there is one that matches the settings key, and starts the writer. interval is how many
+    // steps a member takes between updating its progress, and writeSeconds is the least time between writing the file.
+    // Returns true if a checkpoint was loaded.
+    bool Open(const std::string& fileName, const std::string& settingsKey, size_t memberCount, size_t interval, double writeSeconds)
+    {
+        key = settingsKey;
+        stepInterval = (interval > 0) ? interval : 1;
+        members.assign(memberCount, Progress());
+        rngState.clear();
+
+        bool loaded = false;
+        std::vector<char> bytes;
+        if (ReadCheckpointFile(fileName, bytes))
+        {
+            loaded = Deserialize(bytes);
+            if (!loaded)
+            {
+                members.assign(memberCount, Progress());
+                rngState.clear();
+            }
+        }
+
+        writer.Start(fileName, [this]() { return Snapshot(); }, writeSeconds);
+        return loaded;
+    }
+
+    // Writes the last checkpoint and waits for it to finish
+    void Close()
+    {
+        writer.MarkDirty();
+        writer.Stop();
+    }
+
+    // Gets a member's progress from the checkpoint. Returns false if it hadn't started.
+    bool Resume(size_t memberIndex, Progress& progress)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!members[memberIndex].started)
+            return false;
+        progress = members[memberIndex];
+        resumedCount++;
+        return true;
+    }
+
+    // Call after every step. Every stepInterval steps, and when the member finishes, its progress is copied into the
+    // checkpoint, for the writer to pick up.
+    void Update(size_t memberIndex, Progress& progress)
+    {
+        progress.started = true;
+        if (!progress.finished && (progress.stepIndex % stepInterval) != 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            members[memberIndex] = progress;
+        }
+        writer.MarkDirty();
+    }
+
+    void SaveRandomState(const std::mt19937& rng)
+    {
+        std::ostringstream stream;
+        stream << rng;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            rngState = stream.str();
+        }
+        writer.MarkDirty();
+    }
+
+    // Restores the random number generator, if the checkpoint had its state
+    void RestoreRandomState(std::mt19937& rng) const
+    {
+        if (rngState.empty())
+            return;
+        std::istringstream stream(rngState);
+        stream >> rng;
+    }
+
+    static const uint32_t c_magic = 0x4B504347; // "GCPK"
+    static const uint32_t c_version = 2;
+
+    struct Header
+    {
+        uint32_t magic = c_magic;
+        uint32_t version = c_version;
+        uint32_t coefficientCount = uint32_t(N);
+        uint32_t progressSize = uint32_t(sizeof(Progress));
+        uint64_t memberCount = 0;
+        uint64_t keySize = 0;
+        uint64_t rngStateSize = 0;
+    };
+
+    // Serializes all the members, for the writer thread
+    std::vector<char> Snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return Serialize();
+    }
+
+    std::vector<char> Serialize() const
+    {
+        Header header;
+        header.memberCount = members.size();
+        header.keySize = key.size();
+        header.rngStateSize = rngState.size();
+
+        std::vector<char> bytes(sizeof(header) + key.size() + rngState.size() + members.size() * sizeof(Progress));
+        char* cursor = bytes.data();
+        memcpy(cursor, &header, sizeof(header));
+        cursor += sizeof(header);
+        memcpy(cursor, key.data(), key.size());
+        cursor += key.size();
+        memcpy(cursor, rngState.data(), rngState.size());
+        cursor += rngState.size();
+        if (!members.empty())
+            memcpy(cursor, members.data(), members.size() * sizeof(Progress));
+        return bytes;
+    }
+
+    bool Deserialize(const std::vector<char>& bytes)
+    {
+        Header header;
+        if (bytes.size() < sizeof(header))
+            return false;
+        memcpy(&header, bytes.data(), sizeof(header));
+
+        Header expected;
+        if (header.magic != expected.magic || header.version != expected.version || header.coefficientCount != expected.coefficientCount ||
+            header.progressSize != expected.progressSize || header.memberCount != members.size() || header.keySize != key.size())
+            return false;
+
+        if (bytes.size() != sizeof(header) + header.keySize + header.rngStateSize + header.memberCount * sizeof(Progress))
+            return false;
+
+        const char* cursor = bytes.data() + sizeof(header);
+        if (std::string(cursor, size_t(header.keySize)) != key)
+            return false;
+        cursor += header.keySize;
+        rngState.assign(cursor, size_t(header.rngStateSize));
+        cursor += header.rngStateSize;
+        if (!members.empty())
+            memcpy(members.data(), cursor, members.size() * sizeof(Progress));
+        return true;
+    }
+
+    std::string key;
+    size_t stepInterval = 1;
+    std::vector<Progress> members;
+    std::string rngState;
+    std::mutex mutex;
+    CheckpointWriter writer;
+
+    // how many members were resumed from the checkpoint
+    size_t resumedCount = 0;
+};
@@ -0,0 +1,119 @@
+#include "codegen.h"
+#include <math.h>
+#include <stdio.h>
+
+namespace
+{
+    // A double as C++ source, with enough digits to come back as exactly the same double
+    std::string Literal(double value)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.17g", value);
+        std::string ret = buffer;
+
+        // keep it a double, not an int
+        if (ret.find_first_of(".e") == std::string::npos)
+            ret += ".0";
+        return ret;
+    }
+
+    void WriteArray(FILE* file, const char* name, const char* count, const std::vector<double>& values)
+    {
+        fprintf(file, "    constexpr double %s[%s] = {", name, count);
+        for (size_t index = 0; index < values.size(); ++index)
+            fprintf(file, "%s %s", index > 0 ? "," : "", Literal(values[index]).c_str());
+        fprintf(file, " };\n");
+    }
+}
+
+bool WriteScoringHeader(const std::string& fileName, const std::string& namespaceName, const std::string& description, const PolynomialForm& polynomial)
+{
+    size_t columnCount = polynomial.columns.size();
+    size_t degree = size_t(polynomial.degree);
+    size_t expandedCount = columnCount * degree + (polynomial.interactions ? columnCount * (columnCount - 1) / 2 : 0);
+    if (columnCount == 0 || degree < 1 || polynomial.coefficients.size() != expandedCount + 1)
+        return false;
+
+    // constants that aren't finite can't be written as C++
+    for (double value : polynomial.coefficients)
+    {
+        if (!isfinite(value))
+            return false;
+    }
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        if (!isfinite(polynomial.mean[column]) || !isfinite(polynomial.scale[column]) || polynomial.scale[column] == 0.0f)
+            return false;
+    }
+
+    FILE* file = nullptr;
+    fopen_s(&file, fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    fprintf(file, "// Generated by Regression from %s. Do not edit.\n", description.c_str());
+    fprintf(file, "#pragma once\n\n#include <stddef.h>\n\nnamespace %s\n{\n", namespaceName.c_str());
+
+    fprintf(file, "    // the data columns Predict reads, in order\n");
+    fprintf(file, "    constexpr size_t c_columnCount = %zu;\n", columnCount);
+    fprintf(file, "    constexpr const char* c_columns[c_columnCount] =\n    {\n");
+    for (size_t column = 0; column < columnCount; ++column)
+        fprintf(file, "        \"%s\",\n", polynomial.columns[column].c_str());
+    fprintf(file, "    };\n\n");
+
+    fprintf(file, "    // each column is standardized as (x - mean) / scale, with the mean and scale of the training data\n");
+    WriteArray(file, "c_mean", "c_columnCount", polynomial.mean);
+    WriteArray(file, "c_scale", "c_columnCount", polynomial.scale);
+    fprintf(file, "\n");
+
+    fprintf(file, "    // for each standardized column x, the coefficients of x^%zu down to x", degree);
+    if (polynomial.interactions)
+        fprintf(file, ", then of the product of each pair of columns");
+    fprintf(file, ", then the constant\n");
+    fprintf(file, "    constexpr size_t c_coefficientCount = %zu;\n", expandedCount + 1);
+    WriteArray(file, "c_coefficients", "c_coefficientCount", polynomial.coefficients);
+    fprintf(file, "\n");
+
+    // one row, unrolled, with the constants in the code
+    fprintf(file, "    // Scores one row, with the columns in the order of c_columns\n");
+    fprintf(file, "    constexpr double Predict(const double* row)\n    {\n");
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        fprintf(file, "        const double x%zu = (row[%zu] - %s) * %s;\n", column, column,
+            Literal(polynomial.mean[column]).c_str(), Literal(1.0 / polynomial.scale[column]).c_str());
+    }
+    fprintf(file, "        return %s", Literal(polynomial.coefficients[expandedCount]).c_str());
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        // x * (x * (a * x + b) + c) for a cubic, and so on
+        const double* powers = &polynomial.coefficients[column * degree];
+        std::string term = Literal(powers[0]);
+        for (size_t power = 1; power < degree; ++power)
+            term = (power > 1 ? "x" + std::to_string(column) + " * (" + term + ")" : term + " * x" + std::to_string(column)) + " + " + Literal(powers[power]);
+        if (degree > 1)
+            fprintf(file, "\n            + x%zu * (%s)", column, term.c_str());
+        else
+            fprintf(file, "\n            + %s * x%zu", term.c_str(), column);
+    }
+    if (polynomial.interactions)
+    {
+        size_t index = columnCount * degree;
+        for (size_t i = 0; i < columnCount; ++i)
+        {
+            for (size_t j = i + 1; j < columnCount; ++j)
+                fprintf(file, "\n            + %s * x%zu * x%zu", Literal(polynomial.coefficients[index++]).c_str(), i, j);
+        }
+    }
+    fprintf(file, ";\n    }\n\n");
+
+    fprintf(file, "    // Scores rowCount rows, each rowStride values after the one before\n");
+    fprintf(file, "    inline void PredictBatch(const double* rows, size_t rowCount, double* predictions, size_t rowStride = c_columnCount)\n    {\n");
+    fprintf(file, "        for (size_t index = 0; index < rowCount; ++index)\n");
+    fprintf(file, "            predictions[index] = Predict(rows + index * rowStride);\n    }\n\n");
+
+    fprintf(file, "    // every standardized column of the mean row is 0, so it scores as the constant, at compile time\n");
+    fprintf(file, "    static_assert(Predict(c_mean) == c_coefficients[c_coefficientCount - 1], \"Predict should be constexpr\");\n");
+    fprintf(file, "}\n");
+
+    return fclose(file) == 0;
+}
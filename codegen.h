@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "utils.h"
+
+/*
+
+Code generation: writes a fitted polynomial model (Models 3 to 9) as a self contained C++ header, to compile into other
+programs with nothing to load or look up at runtime.
+
+The header has a namespace of its own, with:
+
+* c_columns - the data columns Predict reads, in the order it reads them
+* c_mean, c_scale and c_coefficients - constexpr arrays of the standardization and the coefficients, for reference
+* Predict() - a constexpr function that scores one row. It's fully unrolled with the constants written into it: each column
+  is standardized like the training data was, each column's powers are evaluated with Horner's rule, and the products of
+  pairs of columns are added after. There are no loops or array lookups left for the compiler to get through.
+* PredictBatch() - scores rows one after another with Predict, inlined
+
+A static_assert at the end scores the mean row at compile time, which has to give the constant, so a header that compiles
+is known to be usable in constant expressions.
+
+*/
+
+// Writes the header, with everything in the given namespace. description goes in the comment at the top.
+bool WriteScoringHeader(const std::string& fileName, const std::string& namespaceName, const std::string& description, const PolynomialForm& polynomial);
@@ -0,0 +1,124 @@
+#include "convergence.h"
+#include <stdint.h>
+#include <stdio.h>
+
+const char* ConvergenceReasonName(ConvergenceReason reason)
+{
+    switch (reason)
+    {
+        case ConvergenceReason::StepLimit: return "step limit";
+        case ConvergenceReason::Optimizer: return "optimizer";
+        case ConvergenceReason::RelativeLoss: return "relative loss";
+        case ConvergenceReason::GradientNorm: return "gradient norm";
+        case ConvergenceReason::Validation: return "validation";
+        case ConvergenceReason::Halving: return "dropped by halving";
+        case ConvergenceReason::Budget: return "budget";
+        default: return "unknown";
+    }
+}
+
+ConvergenceSettings ConvergenceFromSettings(const ModelSettings& settings, double defaultTolerance, size_t defaultPatience)
+{
+    ConvergenceSettings ret;
+    ret.tolerance = settings.Get("tolerance", defaultTolerance);
+    ret.patience = (size_t)settings.Get("patience", double(defaultPatience));
+    ret.gradientTolerance = settings.Get("gradientTolerance", ret.gradientTolerance);
+    ret.validationSteps = (size_t)settings.Get("validationSteps", double(ret.validationSteps));
+    ret.validationFraction = settings.Get("validationFraction", ret.validationFraction);
+    ret.trace = !settings.traceFileName.empty();
+
+    // a tolerance on its own stops at the first step that doesn't make enough progress. patience=0 turns it off.
+    if (ret.tolerance > 0.0f && ret.patience == 0 && settings.values.count("patience") == 0)
+        ret.patience = 1;
+    return ret;
+}
+
+std::vector<ConvergenceMonitor> PopulationMonitors(size_t count, AsyncEvaluator& evaluator)
+{
+    std::vector<ConvergenceMonitor> monitors(count);
+    for (size_t memberIndex = 0; memberIndex < count; ++memberIndex)
+    {
+        monitors[memberIndex].evaluator = &evaluator;
+        monitors[memberIndex].memberIndex = memberIndex;
+    }
+    return monitors;
+}
+
+void HalvingStopped(std::vector<ConvergenceMonitor>& monitors, const HalvingStats& stats)
+{
+    for (size_t memberIndex : stats.dropped)
+        monitors[memberIndex].reason = ConvergenceReason::Halving;
+    for (size_t memberIndex : stats.cutShort)
+        monitors[memberIndex].reason = ConvergenceReason::Budget;
+}
+
+double EvaluateIntervalFromSettings(const ModelSettings& settings)
+{
+    return settings.Get("evaluateSeconds", 0.0f);
+}
+
+void ReportConvergence(ModelReport& report, const std::vector<ConvergenceMonitor>& monitors)
+{
+    size_t counts[size_t(ConvergenceReason::Count)] = {};
+    for (const ConvergenceMonitor& monitor : monitors)
+        counts[size_t(monitor.reason)]++;
+
+    report.Printf("  Population members stopped by:");
+    bool first = true;
+    for (size_t reason = 0; reason < size_t(ConvergenceReason::Count); ++reason)
+    {
+        if (counts[reason] == 0)
+            continue;
+        report.Printf("%s %s %zu", first ? "" : ",", ConvergenceReasonName(ConvergenceReason(reason)), counts[reason]);
+        first = false;
+    }
+    report.Printf("\n");
+}
+
+bool WriteConvergenceTrace(const std::string& fileName, const std::vector<ConvergenceMonitor>& monitors, const std::vector<Evaluation>& evaluations)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    auto writeUInt32 = [&](size_t value)
+    {
+        uint32_t value32 = uint32_t(value);
+        return fwrite(&value32, sizeof(value32), 1, file) == 1;
+    };
+    auto writeFloat = [&](double value)
+    {
+        float value32 = float(value);
+        return fwrite(&value32, sizeof(value32), 1, file) == 1;
+    };
+    auto writeFloats = [&](const std::vector<float>& values)
+    {
+        return values.empty() || fwrite(values.data(), sizeof(float), values.size(), file) == values.size();
+    };
+
+    bool ok = fwrite("RGCT", 4, 1, file) == 1;
+    ok = ok && writeUInt32(2);
+    ok = ok && writeUInt32(monitors.size());
+    for (const ConvergenceMonitor& monitor : monitors)
+    {
+        ok = ok && writeUInt32(size_t(monitor.reason));
+        ok = ok && writeUInt32(monitor.settings.validationSteps);
+        ok = ok && writeUInt32(monitor.trace.size());
+        ok = ok && writeUInt32(monitor.validationTrace.size());
+        ok = ok && writeFloats(monitor.trace);
+        ok = ok && writeFloats(monitor.validationTrace);
+    }
+    ok = ok && writeUInt32(evaluations.size());
+    for (const Evaluation& evaluation : evaluations)
+    {
+        ok = ok && writeFloat(evaluation.seconds);
+        ok = ok && writeUInt32(evaluation.memberIndex);
+        ok = ok && writeUInt32(evaluation.stepIndex);
+        ok = ok && writeFloat(evaluation.trainLoss);
+        ok = ok && writeFloat(evaluation.testRMSE);
+        ok = ok && writeFloat(evaluation.validationRMSE);
+    }
+    ok = (fclose(file) == 0) && ok;
+    return ok;
+}
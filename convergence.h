@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <float.h>
+#include <math.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "evaluator.h"
+#include "population.h"
+
+/*
+
+Convergence monitoring, to stop an optimization once it stops making progress instead of always taking every step.
+
+A member stops when any of these that are turned on says so:
+
+* Relative loss - a step only counts as progress if it lowers the best loss so far by more than the tolerance, as a fraction
+  of it. The member stops after patience steps in a row without progress.
+* Gradient norm - the member stops when the length of the gradient gets below the gradient tolerance.
+* Validation - some of the training rows are held out, and the loss on them is checked every validationSteps steps. The
+  member stops after patience checks in a row that didn't lower the best validation loss by more than the tolerance.
+
+They are off unless a model turns them on. Models 3 to 5 stop on relative loss by default, with a small tolerance
+(1e-7) and a patience of 5 steps. The members of Models 3 and 4 get to their best loss in a handful of steps and would spend
+the rest of their 500 steps barely moving it, so this finds the same fit with a small fraction of the steps. patience=0
+turns it off, and every member takes all of its steps.
+With successive halving, members that were still going when a round dropped them, or when the budget ran out, say so
+instead.
+
+Monitors can also offer the coefficients of each step to an AsyncEvaluator, which scores the best ones on the test set on
+another thread while the training goes on.
+
+With a trace file, the loss of every step of every member is written out in a compact binary format:
+
+  char[4] "RGCT", uint32 version (2), uint32 member count, then per member:
+  uint32 stop reason (ConvergenceReason), uint32 validation steps, uint32 step count, uint32 validation count,
+  float[step count] training loss, step 0 being the start,
+  float[validation count] validation loss, at steps validation steps, 2 * validation steps, ...
+  then uint32 evaluation count, and per evaluation of the test set during training:
+  float seconds, uint32 member index, uint32 step index, float training loss, float test RMSE, float validation RMSE
+
+*/
+
+enum class ConvergenceReason
+{
+    StepLimit,
+    Optimizer,
+    RelativeLoss,
+    GradientNorm,
+    Validation,
+    Halving,
+    Budget,
+    Count
+};
+
+const char* ConvergenceReasonName(ConvergenceReason reason);
+
+struct ConvergenceSettings
+{
+    // the smallest relative improvement that counts as progress, for the loss and the validation loss
+    double tolerance = 0.0f;
+
+    // how many steps (or validation checks) without progress before stopping. 0 means not to stop for lack of progress.
+    size_t patience = 0;
+
+    // stop when the gradient is shorter than this
+    double gradientTolerance = 0.0f;
+
+    // check the loss on held out rows every this many steps, 0 for never, and how many of the training rows to hold out
+    size_t validationSteps = 0;
+    double validationFraction = 0.1f;
+
+    // whether to keep the loss of every step, for the trace file
+    bool trace = false;
+};
+
+// From the "tolerance", "patience", "gradientTolerance", "validationSteps" and "validationFraction" settings, with the
+// model's default tolerance and patience. Tracing is on if the run has a trace file.
+ConvergenceSettings ConvergenceFromSettings(const ModelSettings& settings, double defaultTolerance = 0.0f, size_t defaultPatience = 0);
+
+struct ConvergenceMonitor
+{
+    ConvergenceSettings settings;
+    ConvergenceReason reason = ConvergenceReason::StepLimit;
+
+    double bestLoss = DBL_MAX;
+    size_t stepsWithoutProgress = 0;
+    double bestValidationLoss = DBL_MAX;
+    size_t checksWithoutProgress = 0;
+
+    std::vector<float> trace;
+    std::vector<float> validationTrace;
+
+    // where to offer the coefficients of each step, and which member this is
+    AsyncEvaluator* evaluator = nullptr;
+    size_t memberIndex = 0;
+
+    // Call this with the loss at the starting point, before the first step
+    void Start(const ConvergenceSettings& convergenceSettings, double loss)
+    {
+        settings = convergenceSettings;
+        reason = ConvergenceReason::StepLimit;
+        bestLoss = loss;
+        stepsWithoutProgress = 0;
+        bestValidationLoss = DBL_MAX;
+        checksWithoutProgress = 0;
+        trace.clear();
+        validationTrace.clear();
+        if (settings.trace)
+            trace.push_back(float(loss));
+    }
+
+    // Call this when the loss function changes, like when moving up to a larger coreset, so progress is measured from the
+    // loss on the new rows. The trace keeps going.
+    void Continue(double loss)
+    {
+        reason = ConvergenceReason::StepLimit;
+        bestLoss = loss;
+        stepsWithoutProgress = 0;
+        bestValidationLoss = DBL_MAX;
+        checksWithoutProgress = 0;
+    }
+
+    // Returns true if the gradient is short enough to stop
+    template <size_t N>
+    bool SmallGradient(const std::array<double, N>& gradient)
+    {
+        if (settings.gradientTolerance <= 0.0f)
+            return false;
+
+        double lengthSquared = 0.0f;
+        for (double f : gradient)
+            lengthSquared += f * f;
+        if (sqrt(lengthSquared) >= settings.gradientTolerance)
+            return false;
+
+        reason = ConvergenceReason::GradientNorm;
+        return true;
+    }
+
+    // Call this after every step with the new loss. validationLoss() is only called on the steps that check it.
+    // Returns true if the optimization should stop.
+    template <typename VALIDATION_LOSS>
+    bool Converged(size_t stepIndex, double loss, const VALIDATION_LOSS& validationLoss)
+    {
+        if (settings.trace)
+            trace.push_back(float(loss));
+
+        if (settings.patience > 0)
+        {
+            if (bestLoss - loss > settings.tolerance * fabs(bestLoss))
+                stepsWithoutProgress = 0;
+            else
+                stepsWithoutProgress++;
+            bestLoss = std::min(bestLoss, loss);
+
+            if (stepsWithoutProgress >= settings.patience)
+            {
+                reason = ConvergenceReason::RelativeLoss;
+                return true;
+            }
+        }
+
+        if (settings.validationSteps > 0 && stepIndex % settings.validationSteps == 0)
+        {
+            double newValidationLoss = validationLoss();
+            if (settings.trace)
+                validationTrace.push_back(float(newValidationLoss));
+
+            if (bestValidationLoss == DBL_MAX || bestValidationLoss - newValidationLoss > settings.tolerance * fabs(bestValidationLoss))
+                checksWithoutProgress = 0;
+            else
+                checksWithoutProgress++;
+            bestValidationLoss = std::min(bestValidationLoss, newValidationLoss);
+
+            if (checksWithoutProgress >= std::max(settings.patience, size_t(1)))
+            {
+                reason = ConvergenceReason::Validation;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Offers the coefficients after a step to the evaluator, if there is one
+    template <size_t N>
+    void Offer(size_t stepIndex, double loss, const std::array<double, N>& coefficients)
+    {
+        if (evaluator)
+            evaluator->Offer(memberIndex, stepIndex, loss, coefficients.data());
+    }
+
+    // Call this if the optimizer stopped on its own, like when a line search can't go downhill
+    void OptimizerStopped()
+    {
+        reason = ConvergenceReason::Optimizer;
+    }
+};
+
+// Gives the members that successive halving stopped before they were done their reason for stopping
+void HalvingStopped(std::vector<ConvergenceMonitor>& monitors, const HalvingStats& stats);
+
+// A monitor for each member of a population, offering their coefficients to the evaluator
+std::vector<ConvergenceMonitor> PopulationMonitors(size_t count, AsyncEvaluator& evaluator);
+
+// The "evaluateSeconds" setting: how often to score the best coefficients so far on the test set during training, 0 for never
+double EvaluateIntervalFromSettings(const ModelSettings& settings);
+
+// Splits the rows into rows to train on and rows held out for validation, if validation is on. Otherwise they are all
+// training rows. The split is a random shuffle from the seed, so it is the same every run with the same seed.
+template <typename T>
+void SplitValidationRows(const DataView<T>& rows, const ConvergenceSettings& settings, unsigned int seed, DataView<T>& trainingRows, DataView<T>& validationRows)
+{
+    size_t validationCount = size_t(double(rows.Size()) * settings.validationFraction);
+    if (settings.validationSteps == 0 || validationCount == 0 || validationCount >= rows.Size())
+    {
+        trainingRows = rows;
+        validationRows = SelectRows(rows, std::vector<size_t>());
+        return;
+    }
+
+    std::vector<size_t> indices(rows.Size());
+    for (size_t index = 0; index < indices.size(); ++index)
+        indices[index] = index;
+    std::mt19937 rng(seed);
+    std::shuffle(indices.begin(), indices.end(), rng);
+
+    // sorted again, so each part is read in order
+    std::vector<size_t> validationIndices(indices.begin(), indices.begin() + validationCount);
+    std::vector<size_t> trainingIndices(indices.begin() + validationCount, indices.end());
+    std::sort(validationIndices.begin(), validationIndices.end());
+    std::sort(trainingIndices.begin(), trainingIndices.end());
+    validationRows = SelectRows(rows, validationIndices);
+    trainingRows = SelectRows(rows, trainingIndices);
+}
+
+// Reports how many members stopped for each reason
+void ReportConvergence(ModelReport& report, const std::vector<ConvergenceMonitor>& monitors);
+
+// Writes the traces of the monitors, and the evaluations of the test set, to a file. Returns false if it couldn't.
+bool WriteConvergenceTrace(const std::string& fileName, const std::vector<ConvergenceMonitor>& monitors, const std::vector<Evaluation>& evaluations);
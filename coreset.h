@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Coresets: small samples of the training rows that the early steps of an optimization run on.
+
+Far from the optimum, a step only needs to know roughly which way is downhill, and a loss over a few hundred rows says that
+about as well as one over every row. So a member starts on the smallest sample, and moves up to the next larger one once its
+progress on the current one stalls for a few steps in a row, until it is on all of the rows. The last steps are always on
+the full data, so the final coefficients are those of a full data fit: a member moves straight to all of the rows once it
+has used up the share of its steps that can be on coresets, or of its share of the step budget with successive halving.
+
+Members are only ever compared on their loss over all of the rows. A member only keeps coefficients as its best once it is
+on all of the rows, and a member that stops on a coreset, at the step limit or at the end of a successive halving round, has
+its coefficients scored on all of the rows before anything compares it to the others. So with successive halving, the early
+screening rounds run on the coresets, and the members that get dropped never pay for steps on all of the rows.
+
+A step on a coreset counts as a whole step against the step limit, so coresets never give a member more steps than it would
+have had. Whether they scan fewer rows depends on how many steps the full data fit needs. On the data here, with
+coreset=0.05, Model5 scans 20% fewer rows, and with halving, Models 3 to 5 all scan about a third fewer. Models 3 and 4
+without halving scan 8-13% more, since their full data fits already stop after a handful of steps, and the steps on
+the coresets come on top of those. Compare the rows_scanned of runs with and without coresets before using them.
+
+The samples are stratified on the value being predicted: the rows are sorted by it and cut into strata of equal size, and
+each sample takes the same fraction of every stratum. That keeps the mean squared error of a sample close to that of all of
+the rows, without needing weights in the loss functions. Each sample contains all of the smaller ones, so moving up a level
+only adds rows.
+
+*/
+
+// strata to cut the rows into, by value
+static const size_t c_coresetStrata = 16;
+
+// the fewest rows per coefficient a coreset can have
+static const size_t c_coresetRowsPerCoefficient = 10;
+
+// the largest coreset, as a fraction of the rows. Steps on bigger ones cost nearly as much as steps on all of the rows.
+static const double c_coresetMaxFraction = 0.5f;
+
+struct CoresetSettings
+{
+    // the fraction of the rows in the smallest coreset. 0 turns coresets off.
+    double fraction = 0.0f;
+
+    // how much bigger each coreset is than the one before
+    double growth = 4.0f;
+
+    // a member moves up to the next coreset after patience steps in a row that improve its loss by less than this fraction
+    double tolerance = 1e-3f;
+    size_t patience = 3;
+
+    // the most of a member's steps that can be on coresets. The rest are on all of the rows.
+    double stepFraction = 0.5f;
+};
+
+// From the "coreset", "coresetGrowth", "coresetTolerance", "coresetPatience" and "coresetSteps" settings
+inline CoresetSettings CoresetFromSettings(const ModelSettings& settings)
+{
+    CoresetSettings ret;
+    ret.fraction = settings.Get("coreset", ret.fraction);
+    ret.growth = std::max(settings.Get("coresetGrowth", ret.growth), 1.5);
+    ret.tolerance = settings.Get("coresetTolerance", ret.tolerance);
+    ret.patience = (size_t)settings.Get("coresetPatience", double(ret.patience));
+    ret.stepFraction = settings.Get("coresetSteps", ret.stepFraction);
+    return ret;
+}
+
+// Makes the coresets of the rows, smallest first. The last one is always all of the rows, and it's the only one if coresets
+// are off. The smallest coreset has enough rows to pin down every coefficient, and there are none bigger than
+// c_coresetMaxFraction of the rows. The samples are random from the seed, so they are the same every run with the same seed.
+template <typename T>
+std::vector<DataView<T>> StratifiedCoresets(const DataView<T>& rows, int valueIndex, const CoresetSettings& settings, size_t coefficientCount, unsigned int seed)
+{
+    std::vector<DataView<T>> ret;
+    if (settings.fraction > 0.0f && settings.fraction < 1.0f && rows.Size() > c_coresetStrata)
+    {
+        // sort the rows by value, and shuffle within each stratum, so a sample is a prefix of every stratum
+        std::vector<size_t> order(rows.Size());
+        for (size_t index = 0; index < order.size(); ++index)
+            order[index] = index;
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t A, size_t B)
+            {
+                return rows.Row(A)[valueIndex] < rows.Row(B)[valueIndex];
+            }
+        );
+
+        std::mt19937 rng(seed);
+        std::vector<size_t> strataBegin(c_coresetStrata + 1);
+        for (size_t stratum = 0; stratum <= c_coresetStrata; ++stratum)
+            strataBegin[stratum] = order.size() * stratum / c_coresetStrata;
+        for (size_t stratum = 0; stratum < c_coresetStrata; ++stratum)
+            std::shuffle(order.begin() + strataBegin[stratum], order.begin() + strataBegin[stratum + 1], rng);
+
+        double minFraction = double(coefficientCount * c_coresetRowsPerCoefficient) / double(rows.Size());
+        for (double fraction = std::max(settings.fraction, minFraction); fraction <= c_coresetMaxFraction; fraction *= settings.growth)
+        {
+            std::vector<size_t> indices;
+            for (size_t stratum = 0; stratum < c_coresetStrata; ++stratum)
+            {
+                size_t stratumSize = strataBegin[stratum + 1] - strataBegin[stratum];
+                size_t count = std::max(size_t(ceil(double(stratumSize) * fraction)), size_t(1));
+                indices.insert(indices.end(), order.begin() + strataBegin[stratum], order.begin() + strataBegin[stratum] + std::min(count, stratumSize));
+            }
+
+            if (indices.size() < coefficientCount * c_coresetRowsPerCoefficient)
+                continue;
+
+            // in row order, to read the rows in the order they are stored
+            std::sort(indices.begin(), indices.end());
+            ret.push_back(SelectRows(rows, indices));
+        }
+    }
+    ret.push_back(rows);
+    return ret;
+}
+
+// Call after every step on a coreset. stalls counts the steps in a row that made too little progress, and this returns true
+// once there are enough of them to move up to the next coreset.
+inline bool CoresetStalled(const CoresetSettings& settings, double oldLoss, double newLoss, size_t& stalls)
+{
+    if (oldLoss - newLoss < settings.tolerance * fabs(oldLoss))
+        stalls++;
+    else
+        stalls = 0;
+    return stalls >= std::max(settings.patience, size_t(1));
+}
+
+// Whether a member that has taken stepIndex of its steps has used up the ones it can take on coresets
+inline bool CoresetOutOfSteps(const CoresetSettings& settings, size_t stepIndex, size_t steps)
+{
+    return double(stepIndex) >= settings.stepFraction * double(steps);
+}
+
+// Reports the sizes of the coresets, and how many rows the passes over the rows went through in all. That is only a saving if
+// it's less than the rows_scanned of the same run with coresets off.
+template <typename T>
+void ReportCoresets(ModelReport& report, const std::vector<DataView<T>>& coresets, size_t rowsScanned)
+{
+    report.Value("rows_scanned", double(rowsScanned));
+    if (coresets.size() < 2)
+        return;
+
+    report.Printf("  Coresets of");
+    for (size_t level = 0; level < coresets.size(); ++level)
+        report.Printf("%s %zu", level > 0 ? "," : "", coresets[level].Size());
+    report.Printf(" rows, %zu rows scanned\n", rowsScanned);
+}
@@ -0,0 +1,170 @@
+#include "datacache.h"
+#include "scoring.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+    void StatsToValues(const ColumnStats& stats, double* values)
+    {
+        values[0] = stats.min;
+        values[1] = stats.max;
+        values[2] = stats.mean;
+        values[3] = stats.variance;
+        values[4] = stats.distinctCount;
+        values[5] = stats.binary ? 1.0f : 0.0f;
+    }
+
+    void StatsFromValues(const double* values, ColumnStats& stats)
+    {
+        stats.min = values[0];
+        stats.max = values[1];
+        stats.mean = values[2];
+        stats.variance = values[3];
+        stats.distinctCount = values[4];
+        stats.binary = values[5] != 0.0f;
+    }
+
+    // the cache file of a CSV file, named after its path, like data_train.csv.cache
+    std::string CacheFileName(const char* fileName, const char* cacheDirectory)
+    {
+        std::string name = fileName;
+        for (char& c : name)
+        {
+            if (c == '/' || c == '\\' || c == ':')
+                c = '_';
+        }
+        return std::string(cacheDirectory) + "/" + name + ".cache";
+    }
+}
+
+bool WriteDataCache(const std::string& fileName, uint64_t sourceStamp, const CSV& csv, const std::vector<ColumnStats>& stats)
+{
+    size_t columnCount = csv.headers.size();
+    if (stats.size() != columnCount)
+        return false;
+
+    DataCacheHeader header;
+    header.sourceStamp = sourceStamp;
+    header.rowCount = csv.data.size();
+    header.columnCount = uint32_t(columnCount);
+    size_t namesSize = 0;
+    for (const std::string& column : csv.headers)
+        namesSize += column.size() + 1;
+    header.statsOffset = uint32_t((sizeof(header) + namesSize + 7) & ~size_t(7));
+
+    size_t valuesOffset = header.statsOffset + columnCount * c_dataCacheStatsValues * sizeof(double);
+    std::vector<char> bytes(valuesOffset + csv.data.size() * columnCount * sizeof(double), 0);
+    memcpy(bytes.data(), &header, sizeof(header));
+    char* cursor = bytes.data() + sizeof(header);
+    for (const std::string& column : csv.headers)
+    {
+        memcpy(cursor, column.c_str(), column.size() + 1);
+        cursor += column.size() + 1;
+    }
+
+    double* values = (double*)(bytes.data() + header.statsOffset);
+    for (const ColumnStats& columnStats : stats)
+    {
+        StatsToValues(columnStats, values);
+        values += c_dataCacheStatsValues;
+    }
+    for (const auto& row : csv.data)
+    {
+        memcpy(values, row.data(), columnCount * sizeof(double));
+        values += columnCount;
+    }
+
+    // write a temporary file, then replace the cache with it
+    std::string tempFileName = fileName + ".tmp";
+    FILE* file = nullptr;
+    fopen_s(&file, tempFileName.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(bytes.data(), bytes.size(), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        return false;
+    remove(fileName.c_str());
+    return rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
+
+bool ReadDataCache(const std::string& fileName, uint64_t sourceStamp, CSV& csv, std::vector<ColumnStats>& stats)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName.c_str(), "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    std::vector<char> bytes(size_t(ftell(file)));
+    fseek(file, 0, SEEK_SET);
+    bool ok = !bytes.empty() && fread(bytes.data(), bytes.size(), 1, file) == 1;
+    fclose(file);
+
+    // check the header, and that the file is as big as it says
+    DataCacheHeader header;
+    if (!ok || bytes.size() < sizeof(header))
+        return false;
+    memcpy(&header, bytes.data(), sizeof(header));
+    size_t columnCount = header.columnCount;
+    size_t valuesOffset = size_t(header.statsOffset) + columnCount * c_dataCacheStatsValues * sizeof(double);
+    if (header.magic != c_dataCacheMagic || header.version != c_dataCacheVersion || header.sourceStamp != sourceStamp ||
+        header.statsOffset < sizeof(header) || header.statsOffset % 8 != 0 ||
+        bytes.size() != valuesOffset + size_t(header.rowCount) * columnCount * sizeof(double))
+        return false;
+
+    csv.headers.clear();
+    const char* cursor = bytes.data() + sizeof(header);
+    const char* namesEnd = bytes.data() + header.statsOffset;
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        const char* end = (const char*)memchr(cursor, 0, namesEnd - cursor);
+        if (!end)
+            return false;
+        csv.headers.push_back(std::string(cursor, end));
+        cursor = end + 1;
+    }
+
+    const double* values = (const double*)(bytes.data() + header.statsOffset);
+    stats.resize(columnCount);
+    for (ColumnStats& columnStats : stats)
+    {
+        StatsFromValues(values, columnStats);
+        values += c_dataCacheStatsValues;
+    }
+    csv.data.resize(size_t(header.rowCount));
+    for (auto& row : csv.data)
+    {
+        row.assign(values, values + columnCount);
+        values += columnCount;
+    }
+    return true;
+}
+
+bool LoadCSVCached(const char* fileName, const char* cacheDirectory, CSV& csv, std::vector<ColumnStats>& stats, bool& fromCache)
+{
+    fromCache = false;
+    if (!cacheDirectory)
+        return LoadCSV(fileName, csv, stats);
+
+    uint64_t stamp = FileStamp(fileName);
+    if (stamp == 0)
+        return false;
+
+    std::string cacheFileName = CacheFileName(fileName, cacheDirectory);
+    if (ReadDataCache(cacheFileName, stamp, csv, stats))
+    {
+        fromCache = true;
+        return true;
+    }
+
+    csv = CSV();
+    if (!LoadCSV(fileName, csv, stats))
+        return false;
+
+    // a cache that can't be written only costs the next run the parsing
+    if (!WriteDataCache(cacheFileName, stamp, csv, stats))
+        printf("could not write data cache %s\n", cacheFileName.c_str());
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Data cache: the CSV files, parsed, with the statistics of their columns, saved in a binary file per CSV file.
+
+Parsing the text is most of the time of loading the data, so a run with a cache directory reads the cache instead, when there
+is one that is up to date. A cache file has a header, then the column names, then the statistics of each column, then the
+values as doubles, row by row. The header has the FileStamp of the CSV file the cache was made from, and a cache with a
+different stamp is made again from the CSV file.
+
+The values are the doubles the parser made, and the statistics are the ones calculated while parsing, so loading from the
+cache gives the same data and results bit for bit.
+
+*/
+
+static const uint32_t c_dataCacheMagic = 0x43444752; // "RGDC"
+static const uint32_t c_dataCacheVersion = 1;
+
+// how many doubles the statistics of a column are saved as: min, max, mean, variance, distinct count and binary
+static const size_t c_dataCacheStatsValues = 6;
+
+struct DataCacheHeader
+{
+    uint32_t magic = c_dataCacheMagic;
+    uint32_t version = c_dataCacheVersion;
+
+    // the FileStamp of the CSV file the cache was made from
+    uint64_t sourceStamp = 0;
+
+    uint64_t rowCount = 0;
+    uint32_t columnCount = 0;
+
+    // where the statistics start, in bytes from the start of the file. The column names are between the header and the
+    // statistics, each one ending with a 0. The values follow the statistics.
+    uint32_t statsOffset = 0;
+};
+
+bool WriteDataCache(const std::string& fileName, uint64_t sourceStamp, const CSV& csv, const std::vector<ColumnStats>& stats);
+
+// Reads a cache file. Returns false if there isn't one, it's damaged, or it wasn't made from a CSV file with this stamp.
+bool ReadDataCache(const std::string& fileName, uint64_t sourceStamp, CSV& csv, std::vector<ColumnStats>& stats);
+
+// Loads a CSV file and its column statistics from its cache in the directory if that's up to date, or else from the CSV
+// file, saving the cache for next time. With no directory, it loads the CSV file like LoadCSV.
+bool LoadCSVCached(const char* fileName, const char* cacheDirectory, CSV& csv, std::vector<ColumnStats>& stats, bool& fromCache);
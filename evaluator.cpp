@@ -0,0 +1,211 @@
+#include "evaluator.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <float.h>
+#include <stdio.h>
+
+AsyncEvaluator::~AsyncEvaluator()
+{
+    Stop();
+}
+
+void AsyncEvaluator::Start(size_t coefficientCount, double intervalSeconds, const std::string& progressLabel, const EvaluateFunction& evaluateFunction)
+{
+    Stop();
+
+    // the buffers are sized up front, so offers don't allocate
+    for (Snapshot& snapshot : buffers)
+        snapshot.coefficients.assign(coefficientCount, 0.0f);
+    back = 0;
+    middle.store(1);
+    front = 2;
+    bestTrainLoss.store(DBL_MAX);
+    publishedTrainLoss = DBL_MAX;
+
+    // a slot for every thread that can offer, so one is always free
+    std::vector<PendingSlot> slots(TaskWorkerCount());
+    for (PendingSlot& slot : slots)
+        slot.snapshot.coefficients.assign(coefficientCount, 0.0f);
+    pendingSlots.swap(slots);
+    hasPending = false;
+
+    evaluations.clear();
+    offerCount = 0;
+    pendingCount = 0;
+    stop = false;
+    interval = intervalSeconds;
+    label = progressLabel;
+    evaluate = evaluateFunction;
+    start = std::chrono::high_resolution_clock::now();
+    thread = std::thread([this]() { ThreadFunction(); });
+}
+
+void AsyncEvaluator::Stop()
+{
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_one();
+    thread.join();
+}
+
+void AsyncEvaluator::Offer(size_t memberIndex, size_t stepIndex, double trainLoss, const double* coefficients)
+{
+    if (!thread.joinable())
+        return;
+
+    // only snapshots better than every one before are worth scoring. Most offers aren't, and return here.
+    double best = bestTrainLoss.load(std::memory_order_relaxed);
+    do
+    {
+        if (!(trainLoss < best))
+            return;
+    } while (!bestTrainLoss.compare_exchange_weak(best, trainLoss, std::memory_order_relaxed));
+
+    // publish it, if nobody else is writing right now
+    if (!writing.test_and_set(std::memory_order_acquire))
+    {
+        Publish(memberIndex, stepIndex, trainLoss, coefficients);
+        PublishPending();
+        writing.clear(std::memory_order_release);
+        FlushPending();
+        return;
+    }
+
+    // otherwise leave it in a pending slot for the writer, unless a pending snapshot is already better
+    pendingCount++;
+    for (PendingSlot& slot : pendingSlots)
+    {
+        int state = slot.state.load();
+        if ((state != PendingSlot::Empty && state != PendingSlot::Full) || !slot.state.compare_exchange_strong(state, PendingSlot::Filling))
+            continue;
+
+        if (state == PendingSlot::Full && slot.snapshot.trainLoss <= trainLoss)
+        {
+            slot.state = PendingSlot::Full;
+            return;
+        }
+
+        slot.snapshot.memberIndex = memberIndex;
+        slot.snapshot.stepIndex = stepIndex;
+        slot.snapshot.trainLoss = trainLoss;
+        std::copy(coefficients, coefficients + slot.snapshot.coefficients.size(), slot.snapshot.coefficients.begin());
+        slot.state = PendingSlot::Full;
+        hasPending = true;
+        FlushPending();
+        return;
+    }
+}
+
+void AsyncEvaluator::Publish(size_t memberIndex, size_t stepIndex, double trainLoss, const double* coefficients)
+{
+    // a better snapshot may have been published from a pending slot since this one claimed the best loss
+    if (!(trainLoss < publishedTrainLoss))
+        return;
+    publishedTrainLoss = trainLoss;
+
+    Snapshot& snapshot = buffers[back];
+    snapshot.memberIndex = memberIndex;
+    snapshot.stepIndex = stepIndex;
+    snapshot.trainLoss = trainLoss;
+    std::copy(coefficients, coefficients + snapshot.coefficients.size(), snapshot.coefficients.begin());
+
+    // publish it as the middle buffer, and take the old middle buffer to write the next one into
+    back = middle.exchange(back | c_fresh, std::memory_order_acq_rel) & ~c_fresh;
+    offerCount++;
+}
+
+void AsyncEvaluator::PublishPending()
+{
+    hasPending = false;
+    for (PendingSlot& slot : pendingSlots)
+    {
+        int state = PendingSlot::Full;
+        if (!slot.state.compare_exchange_strong(state, PendingSlot::Draining))
+            continue;
+        Publish(slot.snapshot.memberIndex, slot.snapshot.stepIndex, slot.snapshot.trainLoss, slot.snapshot.coefficients.data());
+        slot.state = PendingSlot::Empty;
+    }
+}
+
+void AsyncEvaluator::FlushPending()
+{
+    // if the flag is taken, whoever has it checks for pending slots after letting go of it
+    while (hasPending && !writing.test_and_set(std::memory_order_acquire))
+    {
+        PublishPending();
+        writing.clear(std::memory_order_release);
+    }
+}
+
+bool AsyncEvaluator::Evaluate()
+{
+    // nothing new since last time
+    if (!(middle.load(std::memory_order_acquire) & c_fresh))
+        return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & ~c_fresh;
+
+    const Snapshot& snapshot = buffers[front];
+    Evaluation evaluation;
+    evaluation.memberIndex = snapshot.memberIndex;
+    evaluation.stepIndex = snapshot.stepIndex;
+    evaluation.trainLoss = snapshot.trainLoss;
+    evaluate(snapshot.coefficients, evaluation);
+    evaluation.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - start).count();
+    evaluations.push_back(evaluation);
+
+    if (!label.empty())
+    {
+        if (evaluation.validationRMSE >= 0.0f)
+            printf("%s %0.3fs: %zu:%zu train loss %0.2f, test RMSE %0.2f, validation RMSE %0.2f\n", label.c_str(), evaluation.seconds, evaluation.memberIndex, evaluation.stepIndex, evaluation.trainLoss, evaluation.testRMSE, evaluation.validationRMSE);
+        else
+            printf("%s %0.3fs: %zu:%zu train loss %0.2f, test RMSE %0.2f\n", label.c_str(), evaluation.seconds, evaluation.memberIndex, evaluation.stepIndex, evaluation.trainLoss, evaluation.testRMSE);
+    }
+    return true;
+}
+
+void ReportEvaluations(ModelReport& report, const AsyncEvaluator& evaluator)
+{
+    if (evaluator.evaluations.empty())
+        return;
+
+    size_t bestIndex = 0;
+    for (size_t index = 1; index < evaluator.evaluations.size(); ++index)
+    {
+        if (evaluator.evaluations[index].testRMSE < evaluator.evaluations[bestIndex].testRMSE)
+            bestIndex = index;
+    }
+    const Evaluation& best = evaluator.evaluations[bestIndex];
+    const Evaluation& last = evaluator.evaluations.back();
+    report.Printf("  Test set during training: %zu evaluations of %zu snapshots (%zu left pending), best test RMSE %0.2f at %0.3fs (%zu:%zu), last %0.2f\n",
+        evaluator.evaluations.size(), size_t(evaluator.offerCount), size_t(evaluator.pendingCount), best.testRMSE, best.seconds, best.memberIndex, best.stepIndex, last.testRMSE);
+    report.Value("evaluations", double(evaluator.evaluations.size()));
+}
+
+void AsyncEvaluator::ThreadFunction()
+{
+    // the loss functions run on this thread, instead of taking the workers away from the training
+    RunTasksInline();
+
+    // score the newest snapshot every interval, until told to stop
+    std::chrono::duration<double> waitTime(interval);
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (condition.wait_for(lock, waitTime, [this]() { return stop; }))
+                break;
+        }
+        Evaluate();
+    }
+
+    // the training is done, so publish anything still pending, and score the last snapshot, which is the best one the
+    // training found
+    hasPending = true;
+    FlushPending();
+    Evaluate();
+}
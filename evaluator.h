@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Evaluation of the test set while training is still going, on a thread of its own.
+
+Training offers the evaluator snapshots of its coefficients whenever they beat the best training loss offered so far. The
+evaluator wakes up at an interval, takes the newest snapshot, and scores it on the test set (and the held out validation rows,
+if there are any). That shows overfitting as it happens, without the training loop doing any of the work.
+
+The handoff is a triple buffer: the training side writes into its own buffer and atomically swaps it with the middle one,
+and the evaluator atomically swaps the middle one with its own when there's something new. The evaluator never waits on the
+training, and the training never waits on anything either:
+
+* An offer first claims the best loss with a compare and swap. Offers that aren't better return right there.
+* Members offer from many threads at once, so a flag lets one of them write the middle buffer at a time. The writer only
+  publishes a snapshot that beats the last one it published, so the snapshots are published in order of their loss.
+* A better offer that finds the flag taken doesn't wait for it. It copies its snapshot into a free pending slot, and whoever
+  has the flag publishes the pending slots before letting go of it, checking again after, so nothing is left behind. There
+  is a slot for every worker thread, so there is always a free one.
+* When the evaluator stops, it publishes anything still pending, so the last snapshot scored is always the best one offered.
+
+*/
+
+// The scores of one snapshot
+struct Evaluation
+{
+    // seconds since the evaluator started, when the snapshot was scored
+    double seconds = 0.0f;
+
+    size_t memberIndex = 0;
+    size_t stepIndex = 0;
+    double trainLoss = 0.0f;
+    double testRMSE = 0.0f;
+
+    // negative if there are no validation rows
+    double validationRMSE = -1.0f;
+};
+
+struct AsyncEvaluator
+{
+    // scores the coefficients, filling out the test and validation RMSE of the evaluation. Called on the evaluator thread.
+    typedef std::function<void(const std::vector<double>& coefficients, Evaluation& evaluation)> EvaluateFunction;
+
+    ~AsyncEvaluator();
+
+    // Starts the thread, which scores the newest snapshot every intervalSeconds. With a label, it prints each evaluation as a
+    // progress line, starting with the label.
+    void Start(size_t coefficientCount, double intervalSeconds, const std::string& progressLabel, const EvaluateFunction& evaluateFunction);
+
+    // Scores the last snapshot, if it hasn't been yet, and stops the thread. The evaluations are complete after this.
+    void Stop();
+
+    bool Running() const
+    {
+        return thread.joinable();
+    }
+
+    // Offers a snapshot from the training. Never waits on another thread. Does nothing if the evaluator isn't running.
+    void Offer(size_t memberIndex, size_t stepIndex, double trainLoss, const double* coefficients);
+
+    // the evaluations done, in order. Only read this after Stop().
+    std::vector<Evaluation> evaluations;
+
+    // how many snapshots were handed off, and how many offers found another thread handing one off and left theirs pending
+    std::atomic<size_t> offerCount{ 0 };
+    std::atomic<size_t> pendingCount{ 0 };
+
+private:
+    struct Snapshot
+    {
+        size_t memberIndex = 0;
+        size_t stepIndex = 0;
+        double trainLoss = 0.0f;
+        std::vector<double> coefficients;
+    };
+
+    // a snapshot waiting for whoever has the writing flag to publish it
+    struct PendingSlot
+    {
+        enum State { Empty, Filling, Full, Draining };
+        std::atomic<int> state{ Empty };
+        Snapshot snapshot;
+    };
+
+    // set on the middle buffer index when it holds a snapshot the evaluator hasn't taken yet
+    static const int c_fresh = 4;
+
+    void ThreadFunction();
+    bool Evaluate();
+
+    // Call these with the writing flag. Publish hands the snapshot to the evaluator if it beats the last one published.
+    void Publish(size_t memberIndex, size_t stepIndex, double trainLoss, const double* coefficients);
+    void PublishPending();
+
+    // Publishes the pending slots, and keeps taking the flag back as long as something new is pending, so a slot that was
+    // filled while letting go of the flag isn't left behind. Call this without the flag.
+    void FlushPending();
+
+    std::array<Snapshot, 3> buffers;
+    int back = 0;
+    std::atomic<int> middle{ 1 };
+    int front = 2;
+    std::atomic_flag writing = ATOMIC_FLAG_INIT;
+    std::atomic<double> bestTrainLoss{ 0.0f };
+
+    // only touched with the writing flag
+    double publishedTrainLoss = 0.0f;
+
+    std::vector<PendingSlot> pendingSlots;
+    std::atomic<bool> hasPending{ false };
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stop = false;
+    double interval = 0.0f;
+    std::string label;
+    EvaluateFunction evaluate;
+    std::chrono::high_resolution_clock::time_point start;
+    std::thread thread;
+};
+
+// Reports how many snapshots were scored, and the best test RMSE seen, to show if the training went on to overfit
+void ReportEvaluations(ModelReport& report, const AsyncEvaluator& evaluator);
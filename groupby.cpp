@@ -0,0 +1,262 @@
+#include "groupby.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <stdio.h>
+
+// how many rows each task of a parallel group by pass does. Each task has its own copy of the per group arrays, so
+// this is bigger than for the loss functions. A multiple of c_packedTileRows, so packed tasks start on a whole word.
+static const size_t c_groupRowGrainSize = 16384;
+
+namespace
+{
+    GroupStats EmptyGroupStats(size_t groupCount)
+    {
+        GroupStats ret;
+        ret.count.assign(groupCount, 0);
+        ret.mean.assign(groupCount, 0.0f);
+        ret.squaredError.assign(groupCount, 0.0f);
+        return ret;
+    }
+
+    GroupErrors EmptyGroupErrors(size_t groupCount)
+    {
+        GroupErrors ret;
+        ret.count.assign(groupCount, 0);
+        ret.squaredError.assign(groupCount, 0.0f);
+        return ret;
+    }
+
+    // Welford's algorithm, per group
+    void AddGroupSample(GroupStats& stats, size_t group, double value)
+    {
+        stats.count[group]++;
+        double delta = value - stats.mean[group];
+        stats.mean[group] += delta / double(stats.count[group]);
+        stats.squaredError[group] += delta * (value - stats.mean[group]);
+    }
+
+    // combine the means and squared errors of two sets of rows (Chan et al.)
+    void CombineGroupStats(GroupStats& result, const GroupStats& partial)
+    {
+        for (size_t group = 0; group < result.count.size(); ++group)
+        {
+            if (partial.count[group] == 0)
+                continue;
+
+            double countA = double(result.count[group]);
+            double countB = double(partial.count[group]);
+            double count = countA + countB;
+            double delta = partial.mean[group] - result.mean[group];
+            result.mean[group] += delta * countB / count;
+            result.squaredError[group] += partial.squaredError[group] + delta * delta * countA * countB / count;
+            result.count[group] += partial.count[group];
+        }
+        result.ungroupedCount += partial.ungroupedCount;
+    }
+
+    // rows without a valid key are predicted with the overall mean, and only count towards the total
+    void AddGroupError(GroupErrors& errors, const GroupStats& stats, double overallMean, bool grouped, size_t group, double value)
+    {
+        double error = value - (grouped ? GroupPrediction(stats, group, overallMean) : overallMean);
+        if (grouped)
+        {
+            errors.count[group]++;
+            errors.squaredError[group] += error * error;
+        }
+        errors.totalCount++;
+        errors.totalSquaredError += error * error;
+    }
+
+    void CombineGroupErrors(GroupErrors& result, const GroupErrors& partial)
+    {
+        for (size_t group = 0; group < result.count.size(); ++group)
+        {
+            result.count[group] += partial.count[group];
+            result.squaredError[group] += partial.squaredError[group];
+        }
+        result.totalCount += partial.totalCount;
+        result.totalSquaredError += partial.totalSquaredError;
+    }
+
+    // the digit a value of a key column is, if it's one of the integers that were seen when making the key
+    bool KeyDigit(double value, size_t valueCount, size_t& digit)
+    {
+        if (!(value >= 0.0f) || value != double(size_t(value)) || size_t(value) >= valueCount)
+            return false;
+        digit = size_t(value);
+        return true;
+    }
+
+    // Gets the keys of the packed rows in [rowBegin, rowEnd), like GroupKey::Key does for a row. rowBegin is a multiple of 64.
+    // A bit column has two digits, and picks one per row from its bit, with no branches.
+    void PackedGroupKeys(const PackedColumns& data, const GroupKey& key, size_t rowBegin, size_t rowEnd, size_t* keys, bool* valid)
+    {
+        size_t rowCount = rowEnd - rowBegin;
+        std::fill(keys, keys + rowCount, size_t(0));
+        std::fill(valid, valid + rowCount, true);
+        for (size_t index = 0; index < key.columns.size(); ++index)
+        {
+            size_t column = key.columns[index];
+            size_t valueCount = key.valueCounts[index];
+            if (data.isBits[column])
+            {
+                size_t unsetDigit = 0;
+                size_t setDigit = 0;
+                bool unsetValid = KeyDigit(data.unset[column], valueCount, unsetDigit);
+                bool setValid = KeyDigit(data.set[column], valueCount, setDigit);
+                const uint64_t* bits = &data.bits[column][rowBegin / 64];
+                for (size_t row = 0; row < rowCount; ++row)
+                {
+                    bool bit = ((bits[row / 64] >> (row % 64)) & 1) != 0;
+                    keys[row] = keys[row] * valueCount + (bit ? setDigit : unsetDigit);
+                    valid[row] = valid[row] && (bit ? setValid : unsetValid);
+                }
+            }
+            else
+            {
+                const double* values = &data.values[column][rowBegin];
+                for (size_t row = 0; row < rowCount; ++row)
+                {
+                    size_t digit = 0;
+                    valid[row] = KeyDigit(values[row], valueCount, digit) && valid[row];
+                    keys[row] = keys[row] * valueCount + digit;
+                }
+            }
+        }
+    }
+
+    // calls f(rowIndex, grouped, group) for every row of the packed rows in [rowBegin, rowEnd), a tile of keys at a time
+    template <typename F>
+    void ForEachPackedKey(const PackedColumns& data, const GroupKey& key, size_t rowBegin, size_t rowEnd, const F& f)
+    {
+        size_t keys[c_packedTileRows];
+        bool valid[c_packedTileRows];
+        for (size_t tileBegin = rowBegin; tileBegin < rowEnd; tileBegin += c_packedTileRows)
+        {
+            size_t tileEnd = std::min(tileBegin + c_packedTileRows, rowEnd);
+            PackedGroupKeys(data, key, tileBegin, tileEnd, keys, valid);
+            for (size_t rowIndex = tileBegin; rowIndex < tileEnd; ++rowIndex)
+                f(rowIndex, valid[rowIndex - tileBegin], keys[rowIndex - tileBegin]);
+        }
+    }
+}
+
+bool MakeGroupKey(const CSV& data, const std::vector<int>& columns, GroupKey& key)
+{
+    key.columns = columns;
+    key.valueCounts.assign(columns.size(), 1);
+    for (const auto& row : data.data)
+    {
+        for (size_t index = 0; index < columns.size(); ++index)
+        {
+            double value = row[columns[index]];
+            if (!(value >= 0.0f) || value != double(size_t(value)))
+            {
+                printf("Column %s has a value of %f, which isn't a category.\n", data.headers[columns[index]].c_str(), value);
+                return false;
+            }
+
+            if (size_t(value) >= key.valueCounts[index])
+                key.valueCounts[index] = size_t(value) + 1;
+        }
+    }
+    return true;
+}
+
+std::string GroupName(const CSV& data, const GroupKey& key, size_t group)
+{
+    // peel the digits off of the key, least significant (last column) first
+    std::vector<size_t> values(key.columns.size());
+    for (size_t index = key.columns.size(); index-- > 0;)
+    {
+        values[index] = group % key.valueCounts[index];
+        group /= key.valueCounts[index];
+    }
+
+    std::string name;
+    for (size_t index = 0; index < key.columns.size(); ++index)
+    {
+        if (index > 0)
+            name += " ";
+        name += data.headers[key.columns[index]] + "=" + std::to_string(values[index]);
+    }
+    return name;
+}
+
+void AggregateGroups(const DataView<double>& data, const GroupKey& key, int valueIndex, GroupStats& stats)
+{
+    stats = ParallelReduce(size_t(0), data.Size(), c_groupRowGrainSize, EmptyGroupStats(key.GroupCount()),
+        [&](size_t rowBegin, size_t rowEnd, GroupStats& partial)
+        {
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
+            {
+                const auto& row = data.Row(rowIndex);
+                size_t group;
+                if (!key.Key(row, group))
+                {
+                    partial.ungroupedCount++;
+                    continue;
+                }
+                AddGroupSample(partial, group, row[valueIndex]);
+            }
+        },
+        CombineGroupStats
+    );
+}
+
+void AggregateGroups(const PackedColumns& data, const GroupKey& key, int valueIndex, GroupStats& stats)
+{
+    stats = ParallelReduce(size_t(0), data.rowCount, c_groupRowGrainSize, EmptyGroupStats(key.GroupCount()),
+        [&](size_t rowBegin, size_t rowEnd, GroupStats& partial)
+        {
+            ForEachPackedKey(data, key, rowBegin, rowEnd,
+                [&](size_t rowIndex, bool grouped, size_t group)
+                {
+                    if (grouped)
+                        AddGroupSample(partial, group, data.Value(valueIndex, rowIndex));
+                    else
+                        partial.ungroupedCount++;
+                }
+            );
+        },
+        CombineGroupStats
+    );
+}
+
+double GroupPrediction(const GroupStats& stats, size_t group, double overallMean)
+{
+    return (group < stats.count.size() && stats.count[group] > 0) ? stats.mean[group] : overallMean;
+}
+
+void CalculateGroupErrors(const DataView<double>& data, const GroupKey& key, int valueIndex, const GroupStats& stats, double overallMean, GroupErrors& errors)
+{
+    errors = ParallelReduce(size_t(0), data.Size(), c_groupRowGrainSize, EmptyGroupErrors(key.GroupCount()),
+        [&](size_t rowBegin, size_t rowEnd, GroupErrors& partial)
+        {
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
+            {
+                const auto& row = data.Row(rowIndex);
+                size_t group;
+                bool grouped = key.Key(row, group);
+                AddGroupError(partial, stats, overallMean, grouped, group, row[valueIndex]);
+            }
+        },
+        CombineGroupErrors
+    );
+}
+
+void CalculateGroupErrors(const PackedColumns& data, const GroupKey& key, int valueIndex, const GroupStats& stats, double overallMean, GroupErrors& errors)
+{
+    errors = ParallelReduce(size_t(0), data.rowCount, c_groupRowGrainSize, EmptyGroupErrors(key.GroupCount()),
+        [&](size_t rowBegin, size_t rowEnd, GroupErrors& partial)
+        {
+            ForEachPackedKey(data, key, rowBegin, rowEnd,
+                [&](size_t rowIndex, bool grouped, size_t group)
+                {
+                    AddGroupError(partial, stats, overallMean, grouped, group, data.Value(valueIndex, rowIndex));
+                }
+            );
+        },
+        CombineGroupErrors
+    );
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "packed.h"
+
+/*
+
+Group by: piecewise constant models, where the prediction for a row is the mean value of the training rows in its group.
+
+Rows are grouped by the values of a set of one hot or categorical columns. The values of the columns are combined into an
+integer group key, like digits of a number with a different base per column, so every group has a slot in flat arrays.
+No hashing, and aggregating is a single parallel pass over the rows.
+
+The passes can also run on packed rows (packed.h), where the keys of one hot columns are built from their bits a tile of rows
+at a time.
+
+*/
+
+// Makes an integer group key out of the values of some columns.
+// The columns need to hold integers from 0 to valueCount-1. A one hot column has a value count of 2.
+struct GroupKey
+{
+    std::vector<int> columns;
+    std::vector<size_t> valueCounts;
+
+    // how many possible keys there are. Most may not have any rows.
+    size_t GroupCount() const
+    {
+        size_t count = 1;
+        for (size_t valueCount : valueCounts)
+            count *= valueCount;
+        return count;
+    }
+
+    // Gets the key of a row. The first column is the most significant digit.
+    // Returns false if a value isn't one of the integers that were seen when making the key.
+    bool Key(const std::vector<double>& row, size_t& key) const
+    {
+        key = 0;
+        for (size_t index = 0; index < columns.size(); ++index)
+        {
+            double value = row[columns[index]];
+            if (!(value >= 0.0f) || value != double(size_t(value)) || size_t(value) >= valueCounts[index])
+                return false;
+            key = key * valueCounts[index] + size_t(value);
+        }
+        return true;
+    }
+};
+
+// Per group statistics of a value column, in flat arrays indexed by group key
+struct GroupStats
+{
+    std::vector<size_t> count;
+    std::vector<double> mean;
+
+    // sum of squared differences from the mean
+    std::vector<double> squaredError;
+
+    // rows that didn't have a valid key
+    size_t ungroupedCount = 0;
+};
+
+// Per group errors of predicting a value column with the training means
+struct GroupErrors
+{
+    std::vector<size_t> count;
+    std::vector<double> squaredError;
+    double totalSquaredError = 0.0f;
+    size_t totalCount = 0;
+};
+
+// Makes a key for the columns, finding how many values each has in the data. Returns false if a column has values
+// that aren't non negative integers.
+bool MakeGroupKey(const CSV& data, const std::vector<int>& columns, GroupKey& key);
+
+// A name for a group like "Outlet_Size_High=1 Outlet_Size_Medium=0"
+std::string GroupName(const CSV& data, const GroupKey& key, size_t group);
+
+// Calculates the count, mean and squared error of the value column for every group, in one parallel pass
+void AggregateGroups(const DataView<double>& data, const GroupKey& key, int valueIndex, GroupStats& stats);
+void AggregateGroups(const PackedColumns& data, const GroupKey& key, int valueIndex, GroupStats& stats);
+
+// What a group predicts: the mean of its training rows, or the overall mean for groups that had no training rows
+double GroupPrediction(const GroupStats& stats, size_t group, double overallMean);
+
+// Calculates the errors of predicting the value column with the group means, in one parallel pass
+void CalculateGroupErrors(const DataView<double>& data, const GroupKey& key, int valueIndex, const GroupStats& stats, double overallMean, GroupErrors& errors);
+void CalculateGroupErrors(const PackedColumns& data, const GroupKey& key, int valueIndex, const GroupStats& stats, double overallMean, GroupErrors& errors);
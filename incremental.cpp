@@ -0,0 +1,572 @@
+#include "incremental.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// how many rows each task does when calculating the statistics of new rows
+static const size_t c_momentRowGrainSize = 4096;
+
+// pivots smaller than this, while solving for the coefficients on standardized columns, mean a column is a linear combination
+// of the ones before it (like the last of a set of one hot columns). Its coefficient is left at 0.
+static const double c_pivotEpsilon = 1e-9;
+
+// identifies the state file, and its version
+static const uint32_t c_stateMagic = 0x53494752; // "RGIS"
+static const uint32_t c_stateVersion = 1;
+
+// the models that have incremental versions
+static const int c_incrementalModels[] = { 1, 3, 4, 5 };
+
+namespace
+{
+    // The data columns of a model, with the sales last
+    bool ModelColumns(int model, const std::vector<std::string>& headers, std::vector<int>& columns)
+    {
+        auto findColumn = [&](const char* name)
+        {
+            for (size_t index = 0; index < headers.size(); ++index)
+            {
+                if (headers[index] == name)
+                    return int(index);
+            }
+            printf("Couldn't find %s column.\n", name);
+            return -1;
+        };
+
+        int salesIndex = findColumn("Item_Outlet_Sales");
+        if (salesIndex == -1)
+            return false;
+
+        columns.clear();
+        switch (model)
+        {
+            // the average sales
+            case 1: break;
+
+            // Outlet_Establishment_Year and Item_MRP, then Item_Weight too
+            case 3:
+            case 4:
+            {
+                columns.push_back(findColumn("Outlet_Establishment_Year"));
+                columns.push_back(findColumn("Item_MRP"));
+                if (model == 4)
+                    columns.push_back(findColumn("Item_Weight"));
+                break;
+            }
+
+            // all data items
+            case 5:
+            {
+                for (int index = 0; index < int(headers.size()); ++index)
+                {
+                    if (index != salesIndex)
+                        columns.push_back(index);
+                }
+                break;
+            }
+
+            default: return false;
+        }
+
+        for (int column : columns)
+        {
+            if (column == -1)
+                return false;
+        }
+
+        columns.push_back(salesIndex);
+        return true;
+    }
+
+    void ResetMoments(MomentStats& stats)
+    {
+        size_t size = stats.columns.size();
+        stats.count = 0;
+        stats.mean.assign(size, 0.0f);
+        stats.comoment.assign(size * size, 0.0f);
+    }
+
+    // adds the rows in B to A (Chan et al.)
+    void AddMoments(MomentStats& A, const MomentStats& B)
+    {
+        if (B.count == 0)
+            return;
+
+        size_t size = A.columns.size();
+        double countA = double(A.count);
+        double countB = double(B.count);
+        double count = countA + countB;
+        std::vector<double> delta(size);
+        for (size_t i = 0; i < size; ++i)
+            delta[i] = B.mean[i] - A.mean[i];
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            for (size_t j = 0; j < size; ++j)
+                A.comoment[i * size + j] += B.comoment[i * size + j] + delta[i] * delta[j] * countA * countB / count;
+            A.mean[i] += delta[i] * countB / count;
+        }
+        A.count += B.count;
+    }
+
+    // removes the rows in B from A, which must contain them, by running AddMoments backwards
+    void RemoveMoments(MomentStats& A, const MomentStats& B)
+    {
+        if (B.count == 0)
+            return;
+
+        if (B.count >= A.count)
+        {
+            ResetMoments(A);
+            return;
+        }
+
+        // the mean of what's left, then the difference of the means that AddMoments would have seen
+        size_t size = A.columns.size();
+        double count = double(A.count);
+        double countB = double(B.count);
+        double countA = count - countB;
+        std::vector<double> delta(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            double meanA = (A.mean[i] * count - B.mean[i] * countB) / countA;
+            delta[i] = B.mean[i] - meanA;
+            A.mean[i] = meanA;
+        }
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            for (size_t j = 0; j < size; ++j)
+                A.comoment[i * size + j] -= B.comoment[i * size + j] + delta[i] * delta[j] * countA * countB / count;
+        }
+        A.count -= B.count;
+    }
+}
+
+void CalculateMoments(const DataView<double>& data, MomentStats& stats)
+{
+    size_t size = stats.columns.size();
+    MomentStats identity;
+    identity.columns = stats.columns;
+    ResetMoments(identity);
+
+    stats = ParallelReduce(size_t(0), data.Size(), c_momentRowGrainSize, identity,
+        [&](size_t rowBegin, size_t rowEnd, MomentStats& partial)
+        {
+            // Welford's algorithm, for every pair of columns
+            std::vector<double> delta(size);
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
+            {
+                const auto& row = data.Row(rowIndex);
+                partial.count++;
+                for (size_t i = 0; i < size; ++i)
+                {
+                    delta[i] = row[partial.columns[i]] - partial.mean[i];
+                    partial.mean[i] += delta[i] / double(partial.count);
+                }
+                for (size_t i = 0; i < size; ++i)
+                {
+                    for (size_t j = 0; j < size; ++j)
+                        partial.comoment[i * size + j] += delta[i] * (row[partial.columns[j]] - partial.mean[j]);
+                }
+            }
+        },
+        [](MomentStats& result, const MomentStats& partial)
+        {
+            AddMoments(result, partial);
+        }
+    );
+}
+
+void FitLinear(const MomentStats& stats, size_t targetCount, double L2, std::vector<std::vector<double>>& coefficients, std::vector<double>& MSE)
+{
+    size_t size = stats.columns.size();
+    size_t featureCount = size - targetCount;
+    double count = double(stats.count);
+    auto comoment = [&](size_t i, size_t j) { return stats.comoment[i * size + j]; };
+
+    // the normal equations on standardized columns: the correlations of the features with each other, and their
+    // covariance with each target. Columns that don't vary get a coefficient of 0.
+    std::vector<double> scale(featureCount);
+    for (size_t i = 0; i < featureCount; ++i)
+        scale[i] = (count > 0.0f) ? sqrt(std::max(comoment(i, i), 0.0) / count) : 0.0f;
+
+    // b[target * featureCount + i] is the right hand side for feature i of that target
+    std::vector<double> A(featureCount * featureCount, 0.0f);
+    std::vector<double> b(featureCount * targetCount, 0.0f);
+    for (size_t i = 0; i < featureCount; ++i)
+    {
+        if (scale[i] <= 0.0f)
+            continue;
+        for (size_t j = 0; j < featureCount; ++j)
+        {
+            if (scale[j] > 0.0f)
+                A[i * featureCount + j] = comoment(i, j) / (count * scale[i] * scale[j]);
+        }
+        A[i * featureCount + i] += L2;
+        for (size_t target = 0; target < targetCount; ++target)
+            b[target * featureCount + i] = comoment(i, featureCount + target) / (count * scale[i]);
+    }
+
+    // Cholesky decomposition into L L^T, storing L in the lower triangle of A. Columns with a tiny pivot depend on the
+    // ones before them, so they are dropped, by zeroing their column of L. The features are the same for every target, so
+    // this is only done once.
+    std::vector<bool> dropped(featureCount, false);
+    for (size_t j = 0; j < featureCount; ++j)
+    {
+        double diagonal = A[j * featureCount + j];
+        for (size_t k = 0; k < j; ++k)
+            diagonal -= A[j * featureCount + k] * A[j * featureCount + k];
+        if (scale[j] <= 0.0f || diagonal < c_pivotEpsilon)
+        {
+            dropped[j] = true;
+            for (size_t i = j; i < featureCount; ++i)
+                A[i * featureCount + j] = 0.0f;
+            continue;
+        }
+        A[j * featureCount + j] = sqrt(diagonal);
+
+        for (size_t i = j + 1; i < featureCount; ++i)
+        {
+            double value = A[i * featureCount + j];
+            for (size_t k = 0; k < j; ++k)
+                value -= A[i * featureCount + k] * A[j * featureCount + k];
+            A[i * featureCount + j] = value / A[j * featureCount + j];
+        }
+    }
+
+    coefficients.resize(targetCount);
+    MSE.resize(targetCount);
+    for (size_t target = 0; target < targetCount; ++target)
+    {
+        size_t valueIndex = featureCount + target;
+
+        // solve L y = b, then L^T x = y
+        std::vector<double> x(featureCount, 0.0f);
+        for (size_t i = 0; i < featureCount; ++i)
+        {
+            if (dropped[i])
+                continue;
+            double value = b[target * featureCount + i];
+            for (size_t k = 0; k < i; ++k)
+                value -= A[i * featureCount + k] * x[k];
+            x[i] = value / A[i * featureCount + i];
+        }
+        for (size_t i = featureCount; i-- > 0;)
+        {
+            if (dropped[i])
+                continue;
+            double value = x[i];
+            for (size_t k = i + 1; k < featureCount; ++k)
+                value -= A[k * featureCount + i] * x[k];
+            x[i] = value / A[i * featureCount + i];
+        }
+
+        // back to the original units. The constant makes the fit go through the means.
+        std::vector<double>& targetCoefficients = coefficients[target];
+        targetCoefficients.assign(featureCount + 1, 0.0f);
+        double constant = stats.mean[valueIndex];
+        for (size_t i = 0; i < featureCount; ++i)
+        {
+            if (!dropped[i])
+                targetCoefficients[i] = x[i] / scale[i];
+            constant -= targetCoefficients[i] * stats.mean[i];
+        }
+        targetCoefficients[featureCount] = constant;
+
+        // sum of (y - f(x))^2 = C_yy - 2 B^T C_xy + B^T C_xx B, since the fit goes through the means
+        double squaredError = comoment(valueIndex, valueIndex);
+        for (size_t i = 0; i < featureCount; ++i)
+        {
+            squaredError -= 2.0f * targetCoefficients[i] * comoment(i, valueIndex);
+            for (size_t j = 0; j < featureCount; ++j)
+                squaredError += targetCoefficients[i] * targetCoefficients[j] * comoment(i, j);
+        }
+        MSE[target] = (count > 0.0f) ? std::max(squaredError, 0.0) / count : 0.0f;
+    }
+}
+
+namespace
+{
+    // applies the rows to every model's statistics, adding or removing them
+    void ApplyRows(const CSV& rows, bool add, IncrementalState& state)
+    {
+        for (IncrementalModel& model : state.models)
+        {
+            MomentStats rowStats;
+            rowStats.columns = model.stats.columns;
+            CalculateMoments(AllRows(rows), rowStats);
+            if (add)
+                AddMoments(model.stats, rowStats);
+            else
+                RemoveMoments(model.stats, rowStats);
+        }
+    }
+
+    template <typename T>
+    bool WriteValue(FILE* file, const T& value)
+    {
+        return fwrite(&value, sizeof(value), 1, file) == 1;
+    }
+
+    template <typename T>
+    bool ReadValue(FILE* file, T& value)
+    {
+        return fread(&value, sizeof(value), 1, file) == 1;
+    }
+
+    bool WriteDoubles(FILE* file, const std::vector<double>& values)
+    {
+        return values.empty() || fwrite(values.data(), sizeof(double), values.size(), file) == values.size();
+    }
+
+    bool ReadDoubles(FILE* file, std::vector<double>& values, size_t count)
+    {
+        values.resize(count);
+        return count == 0 || fread(values.data(), sizeof(double), count, file) == count;
+    }
+}
+
+bool IsIncrementalModel(int model)
+{
+    for (int incrementalModel : c_incrementalModels)
+    {
+        if (incrementalModel == model)
+            return true;
+    }
+    return false;
+}
+
+bool LoadIncrementalState(const char* fileName, IncrementalState& state)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, "rb");
+    if (!file)
+        return false;
+
+    bool ok = true;
+    uint32_t magic = 0, version = 0, headerCount = 0, modelCount = 0;
+    uint64_t rowCount = 0, endOffset = 0, windowRow = 0, windowOffset = 0;
+    ok = ok && ReadValue(file, magic) && magic == c_stateMagic;
+    ok = ok && ReadValue(file, version) && version == c_stateVersion;
+
+    ok = ok && ReadValue(file, headerCount);
+    state.headers.clear();
+    for (uint32_t headerIndex = 0; ok && headerIndex < headerCount; ++headerIndex)
+    {
+        uint32_t length = 0;
+        ok = ReadValue(file, length);
+        std::string header(ok ? length : 0, ' ');
+        ok = ok && (length == 0 || fread(&header[0], length, 1, file) == 1);
+        state.headers.push_back(header);
+    }
+
+    ok = ok && ReadValue(file, rowCount) && ReadValue(file, endOffset) && ReadValue(file, windowRow) && ReadValue(file, windowOffset);
+    state.rowCount = size_t(rowCount);
+    state.endOffset = size_t(endOffset);
+    state.windowRow = size_t(windowRow);
+    state.windowOffset = size_t(windowOffset);
+
+    ok = ok && ReadValue(file, modelCount);
+    state.models.clear();
+    for (uint32_t modelIndex = 0; ok && modelIndex < modelCount; ++modelIndex)
+    {
+        IncrementalModel model;
+        int32_t modelNumber = 0;
+        uint32_t columnCount = 0;
+        uint64_t count = 0;
+        ok = ReadValue(file, modelNumber) && ReadValue(file, columnCount) && ReadValue(file, count);
+        model.model = int(modelNumber);
+        model.stats.count = size_t(count);
+        for (uint32_t columnIndex = 0; ok && columnIndex < columnCount; ++columnIndex)
+        {
+            int32_t column = 0;
+            ok = ReadValue(file, column) && column >= 0 && size_t(column) < state.headers.size();
+            model.stats.columns.push_back(int(column));
+        }
+        ok = ok && ReadDoubles(file, model.stats.mean, columnCount);
+        ok = ok && ReadDoubles(file, model.stats.comoment, size_t(columnCount) * size_t(columnCount));
+        state.models.push_back(model);
+    }
+
+    fclose(file);
+    if (!ok)
+        printf("%s is not a valid incremental state file.\n", fileName);
+    return ok;
+}
+
+bool SaveIncrementalState(const char* fileName, const IncrementalState& state)
+{
+    // write to a temporary file and then replace the old state, so an interrupted save doesn't lose it
+    std::string tempFileName = std::string(fileName) + ".tmp";
+    FILE* file = nullptr;
+    fopen_s(&file, tempFileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = WriteValue(file, c_stateMagic) && WriteValue(file, c_stateVersion);
+
+    ok = ok && WriteValue(file, uint32_t(state.headers.size()));
+    for (const std::string& header : state.headers)
+        ok = ok && WriteValue(file, uint32_t(header.size())) && (header.empty() || fwrite(header.data(), header.size(), 1, file) == 1);
+
+    ok = ok && WriteValue(file, uint64_t(state.rowCount)) && WriteValue(file, uint64_t(state.endOffset));
+    ok = ok && WriteValue(file, uint64_t(state.windowRow)) && WriteValue(file, uint64_t(state.windowOffset));
+
+    ok = ok && WriteValue(file, uint32_t(state.models.size()));
+    for (const IncrementalModel& model : state.models)
+    {
+        ok = ok && WriteValue(file, int32_t(model.model)) && WriteValue(file, uint32_t(model.stats.columns.size())) && WriteValue(file, uint64_t(model.stats.count));
+        for (int column : model.stats.columns)
+            ok = ok && WriteValue(file, int32_t(column));
+        ok = ok && WriteDoubles(file, model.stats.mean) && WriteDoubles(file, model.stats.comoment);
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        return false;
+
+    remove(fileName);
+    return rename(tempFileName.c_str(), fileName) == 0;
+}
+
+bool UpdateIncrementalState(const char* fileName, size_t windowSize, IncrementalState& state, IncrementalUpdateStats& updateStats)
+{
+    updateStats = IncrementalUpdateStats();
+
+    CSV rows;
+    size_t dataOffset = 0;
+    if (!ReadCSVHeaders(fileName, rows, dataOffset))
+    {
+        printf("could not read the headers of %s\n", fileName);
+        return false;
+    }
+
+    // a new state starts at the first row, with statistics for every incremental model
+    if (state.headers.empty())
+    {
+        state.headers = rows.headers;
+        state.rowCount = 0;
+        state.endOffset = dataOffset;
+        state.windowRow = 0;
+        state.windowOffset = dataOffset;
+        state.models.clear();
+        for (int modelNumber : c_incrementalModels)
+        {
+            IncrementalModel model;
+            model.model = modelNumber;
+            if (!ModelColumns(modelNumber, state.headers, model.stats.columns))
+                return false;
+            ResetMoments(model.stats);
+            state.models.push_back(model);
+        }
+    }
+    else if (state.headers != rows.headers)
+    {
+        printf("The columns of %s don't match the incremental state. Start a new state to refit from scratch.\n", fileName);
+        return false;
+    }
+
+    // add the rows appended since last time
+    size_t endOffset = 0;
+    if (!ReadCSVRows(fileName, state.endOffset, size_t(-1), rows, endOffset))
+    {
+        printf("could not read the new rows of %s. If it was rewritten rather than appended to, start a new state.\n", fileName);
+        return false;
+    }
+    ApplyRows(rows, true, state);
+    state.rowCount += rows.data.size();
+    state.endOffset = endOffset;
+    updateStats.rowsAdded = rows.data.size();
+
+    // read back the oldest rows that fell out of the window, and remove them
+    size_t windowRowCount = state.rowCount - state.windowRow;
+    if (windowSize > 0 && windowRowCount > windowSize)
+    {
+        rows.data.clear();
+        if (!ReadCSVRows(fileName, state.windowOffset, windowRowCount - windowSize, rows, endOffset))
+        {
+            printf("could not read the old rows of %s\n", fileName);
+            return false;
+        }
+        ApplyRows(rows, false, state);
+        state.windowRow += rows.data.size();
+        state.windowOffset = endOffset;
+        updateStats.rowsRemoved = rows.data.size();
+    }
+
+    return true;
+}
+
+void ExecuteIncrementalRuns(const IncrementalState& state, const CSV& test, const std::vector<ModelRun>& runs, std::vector<ModelReport>& reports)
+{
+    reports.clear();
+    reports.resize(runs.size());
+    for (size_t runIndex = 0; runIndex < runs.size(); ++runIndex)
+    {
+        const ModelRun& run = runs[runIndex];
+        ModelReport& report = reports[runIndex];
+        report.Printf("Model%i() - Incremental least squares fit of Item_Outlet_Sales\n", run.model);
+
+        const IncrementalModel* model = nullptr;
+        for (const IncrementalModel& incrementalModel : state.models)
+        {
+            if (incrementalModel.model == run.model)
+                model = &incrementalModel;
+        }
+        if (!model)
+        {
+            report.Fail("Model %i doesn't have an incremental version.\n", run.model);
+        }
+        else if (model->stats.count == 0)
+        {
+            report.Fail("There are no training rows.\n");
+        }
+        else if (test.headers != state.headers)
+        {
+            report.Fail("The columns of the test data don't match the training data.\n");
+        }
+        else
+        {
+            std::vector<std::vector<double>> fits;
+            std::vector<double> fitMSE;
+            FitLinear(model->stats, 1, run.settings.Get("L2", 0.0f), fits, fitMSE);
+            const std::vector<double>& coefficients = fits[0];
+            double Train_MSE = fitMSE[0];
+
+            // score the test set
+            const std::vector<int>& columns = model->stats.columns;
+            int salesIndex = columns.back();
+            Average MSE;
+            for (const auto& row : test.data)
+            {
+                double prediction = coefficients.back();
+                for (size_t index = 0; index + 1 < columns.size(); ++index)
+                    prediction += coefficients[index] * row[columns[index]];
+                MSE.AddSample(sqr(prediction - row[salesIndex]));
+            }
+            double Test_MSE = MSE.average;
+
+            // Report results
+            report.Printf("  %zu training rows (rows %zu to %zu of the file)\n", model->stats.count, state.windowRow, state.rowCount);
+            for (size_t index = 0; index + 1 < columns.size(); ++index)
+                report.Printf("    %s: %f\n", state.headers[columns[index]].c_str(), coefficients[index]);
+            report.Printf("    constant: %f\n", coefficients.back());
+            report.Printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
+            report.Printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+
+            // structured results, for the runner
+            report.coefficients = coefficients;
+            for (size_t index = 0; index + 1 < columns.size(); ++index)
+                report.coefficientColumns.push_back(state.headers[columns[index]]);
+            report.Value("train_rmse", sqrt(Train_MSE));
+            report.Value("test_rmse", sqrt(Test_MSE));
+            report.Value("training_rows", double(model->stats.count));
+        }
+
+        SaveScoringModel(run, report);
+        printf("[%zu/%zu] %s\n%s", runIndex + 1, runs.size(), run.spec.c_str(), report.text.c_str());
+    }
+}
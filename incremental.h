@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "runner.h"
+
+/*
+
+Incremental fits, for training data that grows by having rows appended to it.
+
+A least squares linear fit only depends on a few sums over the rows: the count, the mean of each column, and the co-moments
+(sums of products of differences from the means) of each pair of columns. Those are kept in a state file along with where in
+the training file the last row read ended, so an update only reads the rows appended since then:
+
+* Adding rows - the statistics of the new rows are calculated in parallel and merged in (Chan et al.), so the cost is in
+  proportion to the new rows, not all of them.
+* Removing rows - for a rolling window, the oldest rows are read back and their statistics are un-merged, by running the
+  merge backwards.
+* Fitting - the coefficients are solved for directly from the statistics (the normal equations), on standardized columns,
+  with optional ridge (L2) regularization. That is what gradient descent on the same model converges to. The training error
+  comes from the statistics too, so there's no pass over the rows.
+
+The incremental versions of models 1, 3, 4 and 5 are supported, since they are linear in the data columns.
+
+*/
+
+// The count, means and co-moments of some data columns over a set of rows. The last column (or columns, for a fit of several
+// targets) is the value being predicted.
+struct MomentStats
+{
+    std::vector<int> columns;
+    size_t count = 0;
+    std::vector<double> mean;
+
+    // comoment[i * columns.size() + j] is the sum over the rows of (x_i - mean_i) * (x_j - mean_j)
+    std::vector<double> comoment;
+};
+
+struct IncrementalModel
+{
+    int model = 0;
+    MomentStats stats;
+};
+
+struct IncrementalState
+{
+    // the headers of the training file, to make sure the state goes with it
+    std::vector<std::string> headers;
+
+    // how many rows have been read from the training file, and the byte offset after the last one
+    size_t rowCount = 0;
+    size_t endOffset = 0;
+
+    // the first row that's still in the statistics, and its byte offset. Rows before it were removed by the rolling window.
+    size_t windowRow = 0;
+    size_t windowOffset = 0;
+
+    std::vector<IncrementalModel> models;
+};
+
+// How much work an update did
+struct IncrementalUpdateStats
+{
+    size_t rowsAdded = 0;
+    size_t rowsRemoved = 0;
+};
+
+// The statistics of stats.columns over the given rows, calculated in parallel. Each row is read once, for every column.
+void CalculateMoments(const DataView<double>& data, MomentStats& stats);
+
+// Solves for the least squares coefficients of each of the last targetCount columns from the statistics: one per feature
+// column, then the constant. The normal equations only depend on the features, so they are factored once and solved for every
+// target. Also gives the mean squared error of each fit over the rows in the statistics.
+void FitLinear(const MomentStats& stats, size_t targetCount, double L2, std::vector<std::vector<double>>& coefficients, std::vector<double>& MSE);
+
+// True if a model has an incremental version
+bool IsIncrementalModel(int model);
+
+bool LoadIncrementalState(const char* fileName, IncrementalState& state);
+bool SaveIncrementalState(const char* fileName, const IncrementalState& state);
+
+// Reads the rows appended to the training file since the state was last updated, and adds them to the statistics of every
+// model. Then, if windowSize isn't 0, removes the oldest rows until at most windowSize are left. An empty state reads the
+// whole file.
+bool UpdateIncrementalState(const char* fileName, size_t windowSize, IncrementalState& state, IncrementalUpdateStats& updateStats);
+
+// Fits each run's model from the statistics in the state, and scores it on the test data. reports[i] is the report of runs[i].
+void ExecuteIncrementalRuns(const IncrementalState& state, const CSV& test, const std::vector<ModelRun>& runs, std::vector<ModelReport>& reports);
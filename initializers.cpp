@@ -0,0 +1,265 @@
+#include "initializers.h"
+#include <algorithm>
+#include <array>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+// how many random candidates blue noise considers per point already placed
+static const size_t c_blueNoiseCandidateMultiplier = 10;
+
+// seeds the generator of the initial Sobol direction numbers, so the sequence is the same every run
+static const unsigned int c_sobolDirectionSeed = 1337;
+
+namespace
+{
+    // The degree of a polynomial over GF(2), stored as bits
+    int Degree(uint32_t polynomial)
+    {
+        int degree = -1;
+        while (polynomial)
+        {
+            degree++;
+            polynomial >>= 1;
+        }
+        return degree;
+    }
+
+    // A polynomial of degree s is primitive if x has order 2^s - 1 modulo it
+    bool IsPrimitive(uint32_t polynomial)
+    {
+        int degree = Degree(polynomial);
+        uint32_t period = (uint32_t(1) << degree) - 1;
+        uint32_t value = 1;
+        for (uint32_t power = 1; power <= period; ++power)
+        {
+            // multiply by x, mod the polynomial
+            value <<= 1;
+            if (value & (uint32_t(1) << degree))
+                value ^= polynomial;
+            if (value == 1)
+                return power == period;
+        }
+        return false;
+    }
+
+    // 32 direction numbers per dimension. Dimension 0 is the van der Corput sequence, the rest use primitive polynomials.
+    void SobolDirections(size_t dimensions, std::vector<std::array<uint32_t, 32>>& directions)
+    {
+        directions.resize(dimensions);
+        if (dimensions == 0)
+            return;
+
+        for (int bit = 0; bit < 32; ++bit)
+            directions[0][bit] = uint32_t(1) << (31 - bit);
+
+        std::mt19937 rng(c_sobolDirectionSeed);
+        uint32_t polynomial = 2;
+        for (size_t dimension = 1; dimension < dimensions; ++dimension)
+        {
+            // the next primitive polynomial. They all have a constant term.
+            do
+            {
+                polynomial++;
+            } while (!(polynomial & 1) || !IsPrimitive(polynomial));
+
+            int degree = Degree(polynomial);
+            std::array<uint32_t, 32>& v = directions[dimension];
+
+            // the first direction numbers are m_k / 2^k for odd m_k < 2^k
+            for (int bit = 0; bit < degree && bit < 32; ++bit)
+            {
+                uint32_t m = (uint32_t(rng()) & ((uint32_t(1) << (bit + 1)) - 1)) | 1;
+                v[bit] = m << (31 - bit);
+            }
+
+            // the rest come from the recurrence of the polynomial
+            for (int bit = degree; bit < 32; ++bit)
+            {
+                uint32_t value = v[bit - degree] ^ (v[bit - degree] >> degree);
+                for (int term = 1; term < degree; ++term)
+                {
+                    if ((polynomial >> (degree - term)) & 1)
+                        value ^= v[bit - term];
+                }
+                v[bit] = value;
+            }
+        }
+    }
+
+    // the first count primes
+    std::vector<uint32_t> Primes(size_t count)
+    {
+        std::vector<uint32_t> primes;
+        for (uint32_t candidate = 2; primes.size() < count; ++candidate)
+        {
+            bool isPrime = true;
+            for (uint32_t prime : primes)
+            {
+                if (prime * prime > candidate)
+                    break;
+                if (candidate % prime == 0)
+                {
+                    isPrime = false;
+                    break;
+                }
+            }
+            if (isPrime)
+                primes.push_back(candidate);
+        }
+        return primes;
+    }
+
+    double RadicalInverse(size_t index, uint32_t base)
+    {
+        double ret = 0.0f;
+        double digitScale = 1.0f / double(base);
+        while (index > 0)
+        {
+            ret += double(index % base) * digitScale;
+            index /= base;
+            digitScale /= double(base);
+        }
+        return ret;
+    }
+
+    // a random shift of every dimension, wrapping around, keeping the points in [0, 1)
+    void RandomShift(size_t count, size_t dimensions, std::mt19937& rng, std::vector<double>& points)
+    {
+        std::uniform_real_distribution<double> dist(0.0f, 1.0f);
+        for (size_t dimension = 0; dimension < dimensions; ++dimension)
+        {
+            double shift = dist(rng);
+            for (size_t pointIndex = 0; pointIndex < count; ++pointIndex)
+            {
+                double& value = points[pointIndex * dimensions + dimension];
+                value += shift;
+                if (value >= 1.0f)
+                    value -= 1.0f;
+            }
+        }
+    }
+
+    // squared distance between two points in the unit cube, wrapping around at the edges, so the edges aren't favored
+    double ToroidalDistanceSquared(const double* A, const double* B, size_t dimensions)
+    {
+        double ret = 0.0f;
+        for (size_t dimension = 0; dimension < dimensions; ++dimension)
+        {
+            double difference = fabs(A[dimension] - B[dimension]);
+            difference = std::min(difference, 1.0 - difference);
+            ret += difference * difference;
+        }
+        return ret;
+    }
+}
+
+const char* InitializerName(PopulationInitializer initializer)
+{
+    switch (initializer)
+    {
+        case PopulationInitializer::Random: return "random";
+        case PopulationInitializer::Sobol: return "Sobol";
+        case PopulationInitializer::Halton: return "Halton";
+        case PopulationInitializer::LatinHypercube: return "Latin hypercube";
+        case PopulationInitializer::BlueNoise: return "blue noise";
+        default: return "unknown";
+    }
+}
+
+PopulationInitializer InitializerFromSettings(const ModelSettings& settings)
+{
+    int initializer = (int)settings.Get("init", 0.0f);
+    if (initializer < 0 || initializer >= int(PopulationInitializer::Count))
+        return PopulationInitializer::Random;
+    return PopulationInitializer(initializer);
+}
+
+void InitializerPoints(PopulationInitializer initializer, size_t count, size_t dimensions, std::mt19937& rng, std::vector<double>& points)
+{
+    points.assign(count * dimensions, 0.0f);
+    std::uniform_real_distribution<double> dist(0.0f, 1.0f);
+    switch (initializer)
+    {
+        case PopulationInitializer::Sobol:
+        {
+            std::vector<std::array<uint32_t, 32>> directions;
+            SobolDirections(dimensions, directions);
+
+            // skip point 0, which is the origin in every dimension
+            for (size_t pointIndex = 0; pointIndex < count; ++pointIndex)
+            {
+                uint32_t sequenceIndex = uint32_t(pointIndex + 1);
+                for (size_t dimension = 0; dimension < dimensions; ++dimension)
+                {
+                    uint32_t value = 0;
+                    for (int bit = 0; bit < 32; ++bit)
+                    {
+                        if ((sequenceIndex >> bit) & 1)
+                            value ^= directions[dimension][bit];
+                    }
+                    points[pointIndex * dimensions + dimension] = double(value) / 4294967296.0;
+                }
+            }
+            RandomShift(count, dimensions, rng, points);
+            break;
+        }
+        case PopulationInitializer::Halton:
+        {
+            std::vector<uint32_t> primes = Primes(dimensions);
+            for (size_t pointIndex = 0; pointIndex < count; ++pointIndex)
+            {
+                for (size_t dimension = 0; dimension < dimensions; ++dimension)
+                    points[pointIndex * dimensions + dimension] = RadicalInverse(pointIndex + 1, primes[dimension]);
+            }
+            RandomShift(count, dimensions, rng, points);
+            break;
+        }
+        case PopulationInitializer::LatinHypercube:
+        {
+            std::vector<size_t> strata(count);
+            for (size_t dimension = 0; dimension < dimensions; ++dimension)
+            {
+                for (size_t index = 0; index < count; ++index)
+                    strata[index] = index;
+                std::shuffle(strata.begin(), strata.end(), rng);
+                for (size_t pointIndex = 0; pointIndex < count; ++pointIndex)
+                    points[pointIndex * dimensions + dimension] = (double(strata[pointIndex]) + dist(rng)) / double(count);
+            }
+            break;
+        }
+        case PopulationInitializer::BlueNoise:
+        {
+            std::vector<double> candidate(dimensions), bestCandidate(dimensions);
+            for (size_t pointIndex = 0; pointIndex < count; ++pointIndex)
+            {
+                // the first point is just random. After that, the candidate farthest from its closest point wins.
+                size_t candidateCount = pointIndex * c_blueNoiseCandidateMultiplier + 1;
+                double bestDistance = -1.0f;
+                for (size_t candidateIndex = 0; candidateIndex < candidateCount; ++candidateIndex)
+                {
+                    for (double& value : candidate)
+                        value = dist(rng);
+
+                    double closestDistance = DBL_MAX;
+                    for (size_t otherIndex = 0; otherIndex < pointIndex; ++otherIndex)
+                        closestDistance = std::min(closestDistance, ToroidalDistanceSquared(candidate.data(), &points[otherIndex * dimensions], dimensions));
+
+                    if (closestDistance > bestDistance)
+                    {
+                        bestDistance = closestDistance;
+                        bestCandidate = candidate;
+                    }
+                }
+                std::copy(bestCandidate.begin(), bestCandidate.end(), points.begin() + pointIndex * dimensions);
+            }
+            break;
+        }
+        default:
+        {
+            for (double& value : points)
+                value = dist(rng);
+            break;
+        }
+    }
+}
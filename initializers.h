@@ -0,0 +1,44 @@
+#pragma once
+
+#include <random>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Starting points for population based fitting.
+
+White noise (independent uniform random numbers) clumps up and leaves holes, so a population of random starting points covers
+the coefficient space unevenly. These cover it more evenly, so fewer members are needed to get a start near the best fit:
+
+* Sobol - a low discrepancy sequence. Each dimension uses a primitive polynomial over GF(2), in order of degree, with
+  odd initial direction numbers from a fixed generator. It is randomized with a random shift (Cranley-Patterson), so
+  different seeds give different point sets with the same evenness.
+* Halton - the radical inverse of the point index in a different prime base per dimension, also randomly shifted. It gets
+  less even in high dimensions, where the bases get large.
+* Latin hypercube - every dimension is cut into as many strata as there are points, and each stratum gets exactly one point,
+  in a random order per dimension.
+* Blue noise - Mitchell's best candidate: each new point is the one out of several random candidates that is farthest from
+  the points so far.
+
+Points are made in the unit cube, then scaled to each coefficient's range.
+
+*/
+
+enum class PopulationInitializer
+{
+    Random,
+    Sobol,
+    Halton,
+    LatinHypercube,
+    BlueNoise,
+    Count
+};
+
+const char* InitializerName(PopulationInitializer initializer);
+
+// The initializer from the "init" setting: 0 = random, 1 = Sobol, 2 = Halton, 3 = Latin hypercube, 4 = blue noise
+PopulationInitializer InitializerFromSettings(const ModelSettings& settings);
+
+// Makes count points in [0, 1)^dimensions, stored as points[pointIndex * dimensions + dimension]
+void InitializerPoints(PopulationInitializer initializer, size_t count, size_t dimensions, std::mt19937& rng, std::vector<double>& points);
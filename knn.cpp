@@ -0,0 +1,242 @@
+#include "knn.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <float.h>
+
+// below this many points, the two halves of a split are built on the same task
+static const size_t c_parallelBuildSize = 4096;
+
+// how many queries each task does
+static const size_t c_queryGrainSize = 64;
+
+// the most points a leaf can have
+static const size_t c_maxLeafSize = 256;
+
+namespace
+{
+    // how many nodes a tree of pointCount points has. It only depends on the count, since splits are at the median.
+    size_t NodeCount(size_t pointCount, size_t leafSize)
+    {
+        if (pointCount <= leafSize)
+            return 1;
+        size_t half = pointCount / 2;
+        return 1 + NodeCount(half, leafSize) + NodeCount(pointCount - half, leafSize);
+    }
+
+    struct Builder
+    {
+        KDTree* tree = nullptr;
+
+        // the coordinates of the points in data order, a point at a time: points[point * dimensions + dimension]
+        std::vector<float> points;
+
+        // which point is at each position in tree order
+        std::vector<size_t> order;
+
+        float Coordinate(size_t point, size_t dimension) const
+        {
+            return points[point * tree->dimensions + dimension];
+        }
+
+        void Build(size_t nodeIndex, size_t begin, size_t end)
+        {
+            KDTreeNode& node = tree->nodes[nodeIndex];
+            node.begin = begin;
+            node.end = end;
+            if (end - begin <= tree->leafSize)
+                return;
+
+            // split the dimension with the largest spread
+            size_t bestDimension = 0;
+            float bestSpread = -1.0f;
+            for (size_t dimension = 0; dimension < tree->dimensions; ++dimension)
+            {
+                float low = FLT_MAX;
+                float high = -FLT_MAX;
+                for (size_t index = begin; index < end; ++index)
+                {
+                    float value = Coordinate(order[index], dimension);
+                    low = std::min(low, value);
+                    high = std::max(high, value);
+                }
+                if (high - low > bestSpread)
+                {
+                    bestSpread = high - low;
+                    bestDimension = dimension;
+                }
+            }
+
+            // at the median
+            size_t middle = begin + (end - begin) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                [&](size_t A, size_t B)
+                {
+                    return Coordinate(A, bestDimension) < Coordinate(B, bestDimension);
+                }
+            );
+
+            // the split value is the largest coordinate on the left, so ties at the median go left like the query expects
+            float split = -FLT_MAX;
+            for (size_t index = begin; index < middle; ++index)
+                split = std::max(split, Coordinate(order[index], bestDimension));
+
+            node.dimension = int(bestDimension);
+            node.split = split;
+            node.left = int(nodeIndex + 1);
+            node.right = int(nodeIndex + 1 + NodeCount(middle - begin, tree->leafSize));
+
+            size_t left = size_t(node.left);
+            size_t right = size_t(node.right);
+            if (end - begin < c_parallelBuildSize)
+            {
+                Build(left, begin, middle);
+                Build(right, middle, end);
+                return;
+            }
+
+            TaskGroup group;
+            group.Run([=]() { Build(right, middle, end); });
+            Build(left, begin, middle);
+            group.Wait();
+        }
+    };
+
+    // the k best neighbors found so far, as a max heap on distance
+    struct Neighbors
+    {
+        size_t k = 0;
+        std::vector<std::pair<float, size_t>> heap;
+
+        float WorstDistance() const
+        {
+            return (heap.size() < k) ? FLT_MAX : heap.front().first;
+        }
+
+        void Add(float distance, size_t point)
+        {
+            if (heap.size() < k)
+            {
+                heap.push_back(std::make_pair(distance, point));
+                std::push_heap(heap.begin(), heap.end());
+            }
+            else if (distance < heap.front().first)
+            {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = std::make_pair(distance, point);
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    };
+
+    void Search(const KDTree& tree, int nodeIndex, const float* query, size_t excludeRow, Neighbors& neighbors, size_t& distanceEvaluations)
+    {
+        const KDTreeNode& node = tree.nodes[nodeIndex];
+        if (node.dimension < 0)
+        {
+            // the distances to every point of the leaf, a dimension at a time
+            size_t count = node.end - node.begin;
+            float distances[c_maxLeafSize];
+            for (size_t index = 0; index < count; ++index)
+                distances[index] = 0.0f;
+            for (size_t dimension = 0; dimension < tree.dimensions; ++dimension)
+            {
+                const float* coordinates = &tree.coordinates[dimension * tree.pointCount + node.begin];
+                float q = query[dimension];
+                for (size_t index = 0; index < count; ++index)
+                {
+                    float difference = coordinates[index] - q;
+                    distances[index] += difference * difference;
+                }
+            }
+            distanceEvaluations += count;
+
+            for (size_t index = 0; index < count; ++index)
+            {
+                size_t point = node.begin + index;
+                if (tree.rows[point] != excludeRow)
+                    neighbors.Add(distances[index], point);
+            }
+            return;
+        }
+
+        // the side of the split the query is on first, then the other side only if it could have anything closer
+        float difference = query[node.dimension] - node.split;
+        int nearNode = (difference <= 0.0f) ? node.left : node.right;
+        int farNode = (difference <= 0.0f) ? node.right : node.left;
+        Search(tree, nearNode, query, excludeRow, neighbors, distanceEvaluations);
+        if (difference * difference < neighbors.WorstDistance())
+            Search(tree, farNode, query, excludeRow, neighbors, distanceEvaluations);
+    }
+}
+
+void BuildKDTree(const DataView<double>& data, const std::vector<int>& columns, int valueIndex, size_t leafSize, KDTree& tree)
+{
+    tree.dimensions = columns.size();
+    tree.pointCount = data.Size();
+    tree.leafSize = std::max<size_t>(1, std::min(leafSize, c_maxLeafSize));
+    tree.nodes.assign(NodeCount(tree.pointCount, tree.leafSize), KDTreeNode());
+
+    Builder builder;
+    builder.tree = &tree;
+    builder.points.resize(tree.pointCount * tree.dimensions);
+    builder.order.resize(tree.pointCount);
+    ParallelFor(0, tree.pointCount, 1024,
+        [&](size_t point)
+        {
+            const std::vector<double>& row = data.Row(point);
+            for (size_t dimension = 0; dimension < tree.dimensions; ++dimension)
+                builder.points[point * tree.dimensions + dimension] = float(row[columns[dimension]]);
+            builder.order[point] = point;
+        }
+    );
+
+    if (tree.pointCount > 0)
+        builder.Build(0, 0, tree.pointCount);
+
+    // store the points in tree order, a dimension at a time
+    tree.coordinates.resize(tree.pointCount * tree.dimensions);
+    tree.values.resize(tree.pointCount);
+    tree.rows.resize(tree.pointCount);
+    ParallelFor(0, tree.pointCount, 1024,
+        [&](size_t index)
+        {
+            size_t point = builder.order[index];
+            for (size_t dimension = 0; dimension < tree.dimensions; ++dimension)
+                tree.coordinates[dimension * tree.pointCount + index] = builder.Coordinate(point, dimension);
+            tree.values[index] = data.Row(point)[valueIndex];
+            tree.rows[index] = data.RowIndex(point);
+        }
+    );
+}
+
+void KNNPredict(const KDTree& tree, const DataView<double>& queries, const std::vector<int>& columns, size_t k, bool leaveOneOut, std::vector<double>& predictions, KNNQueryStats& stats)
+{
+    predictions.resize(queries.Size());
+    stats.queries = queries.Size();
+    stats.distanceEvaluations = ParallelReduce(size_t(0), queries.Size(), c_queryGrainSize, size_t(0),
+        [&](size_t queryBegin, size_t queryEnd, size_t& distanceEvaluations)
+        {
+            Neighbors neighbors;
+            neighbors.k = k;
+            neighbors.heap.reserve(k);
+            std::vector<float> query(tree.dimensions);
+            for (size_t queryIndex = queryBegin; queryIndex < queryEnd; ++queryIndex)
+            {
+                const std::vector<double>& row = queries.Row(queryIndex);
+                for (size_t dimension = 0; dimension < tree.dimensions; ++dimension)
+                    query[dimension] = float(row[columns[dimension]]);
+
+                neighbors.heap.clear();
+                size_t excludeRow = leaveOneOut ? queries.RowIndex(queryIndex) : size_t(-1);
+                if (tree.pointCount > 0)
+                    Search(tree, 0, query.data(), excludeRow, neighbors, distanceEvaluations);
+
+                double sum = 0.0f;
+                for (const auto& neighbor : neighbors.heap)
+                    sum += tree.values[neighbor.second];
+                predictions[queryIndex] = neighbors.heap.empty() ? 0.0f : sum / double(neighbors.heap.size());
+            }
+        },
+        [](size_t& result, size_t partial) { result += partial; }
+    );
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include "utils.h"
+
+/*
+
+K nearest neighbor regression: predict the mean value of the k training rows closest to a row.
+
+Brute force is a distance calculation against every training row for every query. A KD-tree makes it sub-linear:
+
+* Building - the points are split at the median of the dimension with the largest spread, recursively, until there are at
+  most leafSize points in a node. The shape of the tree only depends on the point count, so every node's index is known before
+  it's built, and the two halves of every split are built in parallel on the task scheduler.
+* Layout - the points are stored in tree order, a dimension at a time, so the points of a leaf are contiguous per dimension.
+  The distance kernel runs over a whole leaf at once, as a loop over the dimensions of simple loops over the points, which
+  the compiler vectorizes.
+* Queries - descend to the leaf the query is in, then back out, only visiting the far side of a split if it could be closer
+  than the k'th best so far. Batches of queries run in parallel.
+
+*/
+
+struct KDTreeNode
+{
+    // the dimension and value the node splits on, or -1 for leaves. Points with coordinate <= split are on the left.
+    int dimension = -1;
+    float split = 0.0f;
+    int left = -1;
+    int right = -1;
+
+    // the points under this node
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+struct KDTree
+{
+    size_t dimensions = 0;
+    size_t pointCount = 0;
+    size_t leafSize = 0;
+
+    // coordinates[dimension * pointCount + point], with the points in tree order
+    std::vector<float> coordinates;
+
+    // the value and data row of each point, in tree order
+    std::vector<double> values;
+    std::vector<size_t> rows;
+
+    std::vector<KDTreeNode> nodes;
+};
+
+struct KNNQueryStats
+{
+    size_t queries = 0;
+    size_t distanceEvaluations = 0;
+};
+
+// Builds a tree of the rows of the data, using the given columns as coordinates
+void BuildKDTree(const DataView<double>& data, const std::vector<int>& columns, int valueIndex, size_t leafSize, KDTree& tree);
+
+// Predicts each query row as the mean value of its k nearest neighbors. With leaveOneOut, a query doesn't count the point that
+// came from the same data row as itself, for scoring the data the tree was built from.
+void KNNPredict(const KDTree& tree, const DataView<double>& queries, const std::vector<int>& columns, size_t k, bool leaveOneOut, std::vector<double>& predictions, KNNQueryStats& stats);
@@ -2,10 +2,14 @@
 
 #include <array>
 #include "utils.h"
+#include "scheduler.h"
 
+// how many rows each task of a parallel loss calculation does
+static const size_t c_lossRowGrainSize = 2048;
 
-template <size_t N>
-double Evaluate(const std::array<double, N + 1>& coefficients, const std::vector<double>& row, const std::array<int, N>& columnIndices)
+
+template <size_t N, typename T>
+double Evaluate(const std::array<double, N + 1>& coefficients, const std::vector<T>& row, const std::array<int, N>& columnIndices)
 {
     double ret = coefficients[N];
     for (size_t i = 0; i < N; ++i)
@@ -13,63 +17,91 @@ double Evaluate(const std::array<double, N + 1>& coefficients, const std::vector
     return ret;
 }
 
-template <size_t N>
-double RSquared(const std::array<double, N + 1>& coefficients, const CSV& data, const std::array<int, N>& columnIndices, int valueIndex)
+// valueMean is the mean of the value column over the rows, like from the column statistics of the dataset
+template <size_t N, typename T>
+double RSquared(const std::array<double, N + 1>& coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex, double valueMean)
 {
-    Average averageSales;
-    for (const auto& row : data.data)
-        averageSales.AddSample(row[valueIndex]);
-
     double numerator = 0.0f;
     double denominator = 0.0f;
-    for (const auto& row : data.data)
+    for (size_t rowIndex = 0; rowIndex < data.Size(); ++rowIndex)
     {
+        const auto& row = data.Row(rowIndex);
         double actual = row[valueIndex];
 
         double estimate = Evaluate(coefficients, row, columnIndices);
 
         numerator += sqr(actual - estimate);
-        denominator += sqr(actual - averageSales.average);
+        denominator += sqr(actual - valueMean);
     }
 
     return 1.0f - numerator / denominator;
 }
 
-template <size_t N>
-double AdjustedRSquared(const std::array<double, N + 1>& coefficients, const CSV& data, const std::array<int, N>& columnIndices, int valueIndex)
+template <size_t N, typename T>
+double RSquared(const std::array<double, N + 1>& coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex)
+{
+    Average averageSales;
+    for (size_t rowIndex = 0; rowIndex < data.Size(); ++rowIndex)
+        averageSales.AddSample(data.Row(rowIndex)[valueIndex]);
+
+    return RSquared(coefficients, data, columnIndices, valueIndex, averageSales.average);
+}
+
+// R^2 adjusted for the number of predictors, from an R^2 that was already calculated
+inline double AdjustedRSquared(double rsquared, size_t sampleCount, size_t predictorCount)
 {
-    int predictorCount = int(N);
-    int numSamples = (int)data.data.size();
+    int numSamples = (int)sampleCount;
 
-    double rsquared = RSquared(coefficients, data, columnIndices, valueIndex);
-    
     double numerator = (1.0f - rsquared) * double(numSamples - 1);
-    double denominator = double(numSamples - predictorCount - 1);
+    double denominator = double(numSamples - int(predictorCount) - 1);
 
     return 1.0f - numerator / denominator;
 }
 
-template <size_t N>
-double LossFunction(const std::array<double, N + 1>& coefficients, const CSV& data, const std::array<int, N>& columnIndices, int valueIndex)
+template <size_t N, typename T>
+double AdjustedRSquared(const std::array<double, N + 1>& coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex)
 {
-    Average MSE;
+    return AdjustedRSquared(RSquared(coefficients, data, columnIndices, valueIndex), data.Size(), N);
+}
 
-    for (const auto& row : data.data)
-    {
-        double estimate = Evaluate(coefficients, row, columnIndices);
+template <size_t N, typename T>
+double LossFunction(const std::array<double, N + 1>& coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex, float L1RegAlpha = 0.0f, float L2RegAlpha = 0.0f)
+{
+    // sum the squared errors of row ranges in parallel
+    double squaredErrorSum = ParallelReduce(size_t(0), data.Size(), c_lossRowGrainSize, 0.0,
+        [&](size_t rowBegin, size_t rowEnd, double& sum)
+        {
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
+            {
+                const auto& row = data.Row(rowIndex);
 
-        double actual = row[valueIndex];
+                double estimate = Evaluate(coefficients, row, columnIndices);
+
+                double actual = row[valueIndex];
 
-        double error = estimate - actual;
+                double error = estimate - actual;
 
-        MSE.AddSample(error * error);
+                sum += error * error;
+            }
+        },
+        [](double& result, double partial) { result += partial; }
+    );
+    double MSE = squaredErrorSum / double(data.Size());
+
+    // add the regularization terms
+    double L1RegSum = 0.0f;
+    double L2RegSum = 0.0f;
+    for (double f : coefficients)
+    {
+        L1RegSum += abs(f);
+        L2RegSum += f * f;
     }
 
-    return MSE.average;
+    return MSE + L1RegSum * L1RegAlpha + L2RegSum * L2RegAlpha;
 }
 
-template <size_t N>
-void CalculateGradient(std::array<double, N + 1>& gradient, const std::array<double, N + 1>& _coefficients, const CSV& data, const std::array<int, N>& columnIndices, int valueIndex)
+template <size_t N, typename T>
+void CalculateGradient(std::array<double, N + 1>& gradient, const std::array<double, N + 1>& _coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex, float L1RegAlpha = 0.0f, float L2RegAlpha = 0.0f)
 {
     // Calculates a gradient via central differences
     for (size_t index = 0; index <= N; ++index)
@@ -77,11 +109,158 @@ void CalculateGradient(std::array<double, N + 1>& gradient, const std::array<dou
         std::array<double, N + 1> coefficients = _coefficients;
 
         coefficients[index] = _coefficients[index] - c_epsilon;
-        double A = LossFunction(coefficients, data, columnIndices, valueIndex);
+        double A = LossFunction(coefficients, data, columnIndices, valueIndex, L1RegAlpha, L2RegAlpha);
 
         coefficients[index] = _coefficients[index] + c_epsilon;
-        double B = LossFunction(coefficients, data, columnIndices, valueIndex);
+        double B = LossFunction(coefficients, data, columnIndices, valueIndex, L1RegAlpha, L2RegAlpha);
 
         gradient[index] = (B - A) / (2.0f * c_epsilon);
     }
+}
+
+template <size_t N, typename T>
+void CalculateBasis(std::array<double, N + 1>& basis, const std::vector<T>& row, const std::array<int, N>& columnIndices)
+{
+    // The function is linear in the coefficients, so it's the dot product of the coefficients with these basis values
+    for (size_t i = 0; i < N; ++i)
+        basis[i] = row[columnIndices[i]];
+    basis[N] = 1.0f;
+}
+
+// Partial sums of the squared error, gradient and hessian over a range of rows, for the parallel loss calculations
+template <size_t N>
+struct LossGradientSums
+{
+    double squaredError = 0.0f;
+    std::array<double, N> gradient = {};
+};
+
+template <size_t N>
+struct LossGradientHessianSums
+{
+    double squaredError = 0.0f;
+    std::array<double, N> gradient = {};
+    std::array<std::array<double, N>, N> hessian = {};
+};
+
+template <size_t N, typename T>
+double LossAndGradient(std::array<double, N + 1>& gradient, const std::array<double, N + 1>& coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex, float L1RegAlpha = 0.0f, float L2RegAlpha = 0.0f)
+{
+    // Calculates the loss and the analytic gradient together, in a single pass over the data.
+    // Row ranges are summed in parallel.
+    LossGradientSums<N + 1> sums = ParallelReduce(size_t(0), data.Size(), c_lossRowGrainSize, LossGradientSums<N + 1>(),
+        [&](size_t rowBegin, size_t rowEnd, LossGradientSums<N + 1>& partial)
+        {
+            std::array<double, N + 1> basis;
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
+            {
+                const auto& row = data.Row(rowIndex);
+                CalculateBasis(basis, row, columnIndices);
+
+                double error = Dot(coefficients, basis) - row[valueIndex];
+
+                partial.squaredError += error * error;
+                for (size_t index = 0; index < basis.size(); ++index)
+                    partial.gradient[index] += error * basis[index];
+            }
+        },
+        [](LossGradientSums<N + 1>& result, const LossGradientSums<N + 1>& partial)
+        {
+            result.squaredError += partial.squaredError;
+            for (size_t index = 0; index < result.gradient.size(); ++index)
+                result.gradient[index] += partial.gradient[index];
+        }
+    );
+
+    double scale = 1.0f / double(data.Size());
+    double MSE = sums.squaredError * scale;
+    for (size_t index = 0; index < gradient.size(); ++index)
+        gradient[index] = sums.gradient[index] * 2.0f * scale;
+
+    // add the regularization terms
+    for (size_t index = 0; index < coefficients.size(); ++index)
+    {
+        double f = coefficients[index];
+        MSE += abs(f) * L1RegAlpha + f * f * L2RegAlpha;
+        gradient[index] += (f > 0.0f ? L1RegAlpha : (f < 0.0f ? -L1RegAlpha : 0.0f)) + 2.0f * f * L2RegAlpha;
+    }
+
+    return MSE;
+}
+
+template <size_t N, typename T>
+double LossGradientAndHessian(std::array<double, N + 1>& gradient, std::array<std::array<double, N + 1>, N + 1>& hessian, const std::array<double, N + 1>& coefficients, const DataView<T>& data, const std::array<int, N>& columnIndices, int valueIndex, float L1RegAlpha = 0.0f, float L2RegAlpha = 0.0f)
+{
+    // Same as LossAndGradient, but also calculates the Gauss-Newton hessian 2/n * J^T J.
+    // The function is linear in the coefficients so this is the exact hessian of the MSE, not an approximation.
+    LossGradientHessianSums<N + 1> sums = ParallelReduce(size_t(0), data.Size(), c_lossRowGrainSize, LossGradientHessianSums<N + 1>(),
+        [&](size_t rowBegin, size_t rowEnd, LossGradientHessianSums<N + 1>& partial)
+        {
+            std::array<double, N + 1> basis;
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
+            {
+                const auto& row = data.Row(rowIndex);
+                CalculateBasis(basis, row, columnIndices);
+
+                double error = Dot(coefficients, basis) - row[valueIndex];
+
+                partial.squaredError += error * error;
+                for (size_t i = 0; i < basis.size(); ++i)
+                {
+                    partial.gradient[i] += error * basis[i];
+                    for (size_t j = 0; j <= i; ++j)
+                        partial.hessian[i][j] += basis[i] * basis[j];
+                }
+            }
+        },
+        [](LossGradientHessianSums<N + 1>& result, const LossGradientHessianSums<N + 1>& partial)
+        {
+            result.squaredError += partial.squaredError;
+            for (size_t i = 0; i < result.gradient.size(); ++i)
+            {
+                result.gradient[i] += partial.gradient[i];
+                for (size_t j = 0; j <= i; ++j)
+                    result.hessian[i][j] += partial.hessian[i][j];
+            }
+        }
+    );
+
+    double scale = 1.0f / double(data.Size());
+    double MSE = sums.squaredError * scale;
+    for (size_t i = 0; i < gradient.size(); ++i)
+    {
+        gradient[i] = sums.gradient[i] * 2.0f * scale;
+        for (size_t j = 0; j <= i; ++j)
+        {
+            hessian[i][j] = sums.hessian[i][j] * 2.0f * scale;
+            hessian[j][i] = hessian[i][j];
+        }
+    }
+
+    // add the regularization terms. L1 has no curvature, L2 adds a constant to the diagonal.
+    for (size_t index = 0; index < coefficients.size(); ++index)
+    {
+        double f = coefficients[index];
+        MSE += abs(f) * L1RegAlpha + f * f * L2RegAlpha;
+        gradient[index] += (f > 0.0f ? L1RegAlpha : (f < 0.0f ? -L1RegAlpha : 0.0f)) + 2.0f * f * L2RegAlpha;
+        hessian[index][index] += 2.0f * L2RegAlpha;
+    }
+
+    return MSE;
+}
+
+template <size_t N>
+void UnstandardizeCoefficients(std::array<double, N + 1>& coefficients, const std::array<int, N>& columnIndices, const Standardization& standardization)
+{
+    // Coefficients learned on standardized data use z = (x - mean) / scale.
+    // Expanding that out gives the coefficients that work on the original data.
+    for (size_t i = 0; i < N; ++i)
+    {
+        double mean = standardization.Mean(columnIndices[i]);
+        double scale = standardization.Scale(columnIndices[i]);
+        double a = coefficients[i];
+
+        coefficients[i] = a / scale;
+        coefficients[N] -= a * mean / scale;
+    }
 }
\ No newline at end of file
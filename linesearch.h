@@ -0,0 +1,281 @@
+#pragma once
+
+#include <array>
+#include <math.h>
+#include "utils.h"
+
+/*
+
+Line search along a descent direction.
+
+Gradient descent used to divide the learning rate by 10 until the loss went down, and multiply it by 10 again afterwards.
+That costs a full loss function pass per probe, never tunes the step finer than a power of 10, and never ends if the gradient is zero.
+
+This does these instead:
+* Armijo backtracking - shrink the step until there is "sufficient decrease" in the loss. Uses quadratic then cubic interpolation
+  of the loss along the line to pick the next step, instead of a fixed divide.
+* Strong Wolfe - sufficient decrease plus a curvature condition on the slope at the new point. Needs the gradient at each probe,
+  which is what quasi newton methods want anyways.
+
+Both use the directional derivative (gradient dot direction) at the start of the line, which comes for free from the gradient.
+Both have a bounded number of probes, and both return false if the direction isn't a descent direction (like a zero gradient)
+so the caller knows to stop.
+
+*/
+
+struct LineSearch
+{
+    // sufficient decrease (Armijo) constant
+    double c1 = 1e-4f;
+
+    // curvature constant for the strong Wolfe condition. 0.9 is the usual value for (quasi) newton methods.
+    double c2 = 0.9f;
+
+    // maximum number of loss function evaluations per line search
+    int maxProbes = 20;
+
+    // The step size to try first. After a successful search it is the step that was accepted.
+    double stepSize = 1.0f;
+
+    // The most the initial step is allowed to grow from one search to the next
+    double maxStepGrowth = 10.0f;
+
+    // stats
+    size_t searches = 0;
+    size_t lossEvaluations = 0;
+    size_t gradientEvaluations = 0;
+    size_t failures = 0;
+
+    // Call this when starting a new descent, like for a new population member, so it doesn't use the step size and slope of the old one
+    void Restart(double initialStepSize)
+    {
+        stepSize = initialStepSize;
+        lastSlope = 0.0f;
+    }
+
+    // Armijo backtracking with interpolation.
+    // lossFunction(coefficients) returns the loss.
+    // On success, coefficients and loss are updated to the new point.
+    template <size_t N, typename LOSS_FUNCTION>
+    bool Armijo(std::array<double, N>& coefficients, double& loss, const std::array<double, N>& gradient, const std::array<double, N>& direction, const LOSS_FUNCTION& lossFunction)
+    {
+        searches++;
+
+        // the slope of the loss along the line, at the start of the line
+        double slope = Dot(gradient, direction);
+        if (!(slope < 0.0f))
+        {
+            failures++;
+            return false;
+        }
+
+        double alpha = InitialStep(slope);
+        double prevAlpha = 0.0f;
+        double prevLoss = loss;
+
+        std::array<double, N> newCoefficients;
+        for (int probe = 0; probe < maxProbes; ++probe)
+        {
+            for (size_t index = 0; index < N; ++index)
+                newCoefficients[index] = coefficients[index] + direction[index] * alpha;
+
+            double newLoss = lossFunction(newCoefficients);
+            lossEvaluations++;
+
+            // accept the step if there is sufficient decrease
+            if (newLoss <= loss + c1 * alpha * slope)
+            {
+                coefficients = newCoefficients;
+                loss = newLoss;
+                stepSize = alpha;
+                lastSlope = slope;
+                return true;
+            }
+
+            // otherwise, interpolate the loss along the line to guess a better step size
+            double newAlpha = (probe == 0)
+                ? InterpolateQuadratic(loss, slope, alpha, newLoss)
+                : InterpolateCubic(loss, slope, prevAlpha, prevLoss, alpha, newLoss);
+
+            // keep the new step in [0.1, 0.5] of the old step so it neither stalls nor barely moves
+            if (!isfinite(newAlpha) || newAlpha > alpha * 0.5f)
+                newAlpha = alpha * 0.5f;
+            else if (newAlpha < alpha * 0.1f)
+                newAlpha = alpha * 0.1f;
+
+            prevAlpha = alpha;
+            prevLoss = newLoss;
+            alpha = newAlpha;
+        }
+
+        failures++;
+        stepSize = alpha;
+        return false;
+    }
+
+    // Strong Wolfe line search (Nocedal & Wright algorithms 3.5 and 3.6).
+    // lossAndGradient(coefficients, gradient) returns the loss and fills out the gradient.
+    // On success, coefficients, loss and gradient are updated to the new point.
+    template <size_t N, typename LOSS_AND_GRADIENT>
+    bool StrongWolfe(std::array<double, N>& coefficients, double& loss, std::array<double, N>& gradient, const std::array<double, N>& direction, const LOSS_AND_GRADIENT& lossAndGradient)
+    {
+        searches++;
+
+        double slope = Dot(gradient, direction);
+        if (!(slope < 0.0f))
+        {
+            failures++;
+            return false;
+        }
+
+        Probe<N> start{ 0.0f, loss, slope, coefficients, gradient };
+        Probe<N> prev = start;
+        Probe<N> current;
+        current.alpha = InitialStep(slope);
+
+        int probe = 0;
+        while (probe < maxProbes)
+        {
+            Evaluate(current, coefficients, direction, lossAndGradient);
+            probe++;
+
+            if (current.loss > loss + c1 * current.alpha * slope || (probe > 1 && current.loss >= prev.loss))
+                return Zoom(prev, current, start, coefficients, loss, gradient, direction, lossAndGradient, probe);
+
+            if (fabs(current.slope) <= -c2 * slope)
+                return Accept(current, slope, coefficients, loss, gradient);
+
+            if (current.slope >= 0.0f)
+                return Zoom(current, prev, start, coefficients, loss, gradient, direction, lossAndGradient, probe);
+
+            // still going downhill and steeply, so take a bigger step
+            prev = current;
+            current.alpha *= 2.0f;
+        }
+
+        failures++;
+        return false;
+    }
+
+private:
+    template <size_t N>
+    struct Probe
+    {
+        double alpha;
+        double loss;
+        double slope;
+        std::array<double, N> coefficients;
+        std::array<double, N> gradient;
+    };
+
+    // the slope from the last successful search, for scaling the next initial step
+    double lastSlope = 0.0f;
+
+    double InitialStep(double slope) const
+    {
+        // assume the first order change in loss will be the same as last search (Nocedal & Wright 3.60)
+        if (lastSlope == 0.0f)
+            return stepSize;
+        double alpha = stepSize * lastSlope / slope;
+        return (alpha < stepSize * maxStepGrowth) ? alpha : stepSize * maxStepGrowth;
+    }
+
+    // minimizer of the quadratic that matches the loss and slope at 0, and the loss at alpha
+    static double InterpolateQuadratic(double loss0, double slope0, double alpha, double lossAlpha)
+    {
+        return -slope0 * alpha * alpha / (2.0f * (lossAlpha - loss0 - slope0 * alpha));
+    }
+
+    // minimizer of the cubic that matches the loss and slope at 0, and the loss at alpha0 and alpha1
+    static double InterpolateCubic(double loss0, double slope0, double alpha0, double lossAlpha0, double alpha1, double lossAlpha1)
+    {
+        double r0 = lossAlpha0 - loss0 - slope0 * alpha0;
+        double r1 = lossAlpha1 - loss0 - slope0 * alpha1;
+        double denominator = alpha0 * alpha0 * alpha1 * alpha1 * (alpha1 - alpha0);
+        double a = (alpha0 * alpha0 * r1 - alpha1 * alpha1 * r0) / denominator;
+        double b = (-alpha0 * alpha0 * alpha0 * r1 + alpha1 * alpha1 * alpha1 * r0) / denominator;
+
+        if (fabs(a) < 1e-12f)
+            return -slope0 / (2.0f * b);
+
+        double discriminant = b * b - 3.0f * a * slope0;
+        if (discriminant < 0.0f)
+            return alpha1 * 0.5f;
+
+        return (-b + sqrt(discriminant)) / (3.0f * a);
+    }
+
+    // minimizer of the cubic that matches the loss and slope at both ends of the interval
+    template <size_t N>
+    static double InterpolateCubicHermite(const Probe<N>& A, const Probe<N>& B)
+    {
+        double d1 = A.slope + B.slope - 3.0f * (A.loss - B.loss) / (A.alpha - B.alpha);
+        double discriminant = d1 * d1 - A.slope * B.slope;
+        if (discriminant < 0.0f)
+            return (A.alpha + B.alpha) * 0.5f;
+        double d2 = sqrt(discriminant) * (B.alpha > A.alpha ? 1.0f : -1.0f);
+        return B.alpha - (B.alpha - A.alpha) * (B.slope + d2 - d1) / (B.slope - A.slope + 2.0f * d2);
+    }
+
+    template <size_t N, typename LOSS_AND_GRADIENT>
+    void Evaluate(Probe<N>& probe, const std::array<double, N>& coefficients, const std::array<double, N>& direction, const LOSS_AND_GRADIENT& lossAndGradient)
+    {
+        for (size_t index = 0; index < N; ++index)
+            probe.coefficients[index] = coefficients[index] + direction[index] * probe.alpha;
+        probe.loss = lossAndGradient(probe.coefficients, probe.gradient);
+        probe.slope = Dot(probe.gradient, direction);
+        lossEvaluations++;
+        gradientEvaluations++;
+    }
+
+    template <size_t N>
+    bool Accept(const Probe<N>& probe, double slope, std::array<double, N>& coefficients, double& loss, std::array<double, N>& gradient)
+    {
+        coefficients = probe.coefficients;
+        loss = probe.loss;
+        gradient = probe.gradient;
+        stepSize = probe.alpha;
+        lastSlope = slope;
+        return true;
+    }
+
+    // shrink the interval [lo, hi] which is known to contain a step satisfying the strong Wolfe conditions
+    template <size_t N, typename LOSS_AND_GRADIENT>
+    bool Zoom(Probe<N> lo, Probe<N> hi, const Probe<N>& start, std::array<double, N>& coefficients, double& loss, std::array<double, N>& gradient, const std::array<double, N>& direction, const LOSS_AND_GRADIENT& lossAndGradient, int probe)
+    {
+        Probe<N> current;
+        while (probe < maxProbes)
+        {
+            // interpolate, but stay away from the ends of the interval
+            double low = (lo.alpha < hi.alpha) ? lo.alpha : hi.alpha;
+            double high = (lo.alpha < hi.alpha) ? hi.alpha : lo.alpha;
+            double margin = (high - low) * 0.1f;
+            current.alpha = InterpolateCubicHermite(lo, hi);
+            if (!isfinite(current.alpha) || current.alpha < low + margin || current.alpha > high - margin)
+                current.alpha = (low + high) * 0.5f;
+
+            Evaluate(current, coefficients, direction, lossAndGradient);
+            probe++;
+
+            if (current.loss > start.loss + c1 * current.alpha * start.slope || current.loss >= lo.loss)
+            {
+                hi = current;
+            }
+            else
+            {
+                if (fabs(current.slope) <= -c2 * start.slope)
+                    return Accept(current, start.slope, coefficients, loss, gradient);
+
+                if (current.slope * (hi.alpha - lo.alpha) >= 0.0f)
+                    hi = lo;
+                lo = current;
+            }
+        }
+
+        // out of probes. The low end of the interval always satisfies sufficient decrease, so take it if it moved.
+        if (lo.alpha > 0.0f)
+            return Accept(lo, start.slope, coefficients, loss, gradient);
+        failures++;
+        return false;
+    }
+};
@@ -1,54 +1,347 @@
+#include <algorithm>
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <thread>
 #include "utils.h"
+#include "runner.h"
+#include "scheduler.h"
+#include "incremental.h"
+#include "benchmark.h"
+#include "server.h"
+#include "datacache.h"
+
+static void PrintUsage()
+{
+    printf(
+        "usage: Regression [-threads <count>] [-pin] [-config <file>] [-out <file>] [-checkpoint <directory>] [-trace <directory>] [-targets <column,...>] [-incremental <file> [-window <rows>]] [-benchmark-init] [-export <directory>] [-generate <directory>] [-cache <directory>] [run ...]\n"
+        "       Regression -serve <model file> [-socket <path>]\n"
+        "       Regression -load <connections> [-requests <count>] [-rows <count>] [-stop-server] [-socket <path>]\n"
+        "  a run is a model and optional settings, like 6 or 8:L2=0.1,population=20\n"
+        "  settings: population, steps, initialStepSize, L1, L2, seed, bootstrap, confidence,\n"
+        "            trees, learningRate, depth, minLeaf, bins, k, leafSize, checkpointSteps,\n"
+        "            halving, halvingSteps, budgetSteps, budgetSeconds, init, tolerance, patience,\n"
+        "            gradientTolerance, validationSteps, validationFraction, evaluateSeconds, coreset,\n"
+        "            coresetGrowth, coresetTolerance, coresetPatience, coresetSteps, degree, quantize, packed\n"
+        "  tolerance, patience: stop a population member after patience steps in a row that lower its loss by less than\n"
+        "            tolerance, relative to the loss. Models 3 to 5 default to tolerance=1e-7,patience=5, and patience=0\n"
+        "            gives every member all of its steps. gradientTolerance stops it when the gradient gets shorter than that.\n"
+        "  validationSteps: hold out validationFraction of the training rows, and stop a member after patience checks of\n"
+        "            the loss on them, every validationSteps steps, that don't lower it by more than tolerance\n"
+        "  evaluateSeconds: score the best coefficients so far on the test set this often during training, on another\n"
+        "            thread, printing each score as it goes\n"
+        "  coreset: start gradient descent (Models 3 to 5) on a stratified sample of this fraction of the training rows,\n"
+        "            moving to samples coresetGrowth times larger, then all of the rows, after coresetPatience steps in a\n"
+        "            row that improve the loss by less than coresetTolerance. At most coresetSteps of the steps (a fraction)\n"
+        "            are on samples. With halving, the early rounds screen the members on the samples. Compare rows_scanned\n"
+        "            with a run without it, since it isn't always fewer\n"
+        "  degree: the highest power of each column that isn't 0/1, in the features of Model12\n"
+        "  quantize: 8 or 16. Score the fitted model (Models 3 to 5) with int8 or int16 features and coefficients too,\n"
+        "            and report the difference from scoring in double, and the throughput of both\n"
+        "  packed: 1 to store the training rows a column at a time, with the columns that only take two values as bits,\n"
+        "            for the loss and gradient passes of Model5 and the group by of Model2\n"
+        "  init: population initializer. 0 = random, 1 = Sobol, 2 = Halton, 3 = Latin hypercube, 4 = blue noise\n"
+        "  -threads  how many worker threads the task scheduler uses. Defaults to the number of cores.\n"
+        "  -pin      pin each worker thread to its own core\n"
+        "  -config   read runs from a file, one per line\n"
+        "  -out      where to write the results as JSON. Defaults to results.json.\n"
+        "  -checkpoint  save checkpoints of long running fits (Model7) in the directory, and resume from them\n"
+        "  -trace    write the loss of every optimizer step of every population member (Models 3 to 9) to a\n"
+        "            binary file per run in the directory\n"
+        "  -targets  the columns Model12 fits at once, from all of the other columns, like\n"
+        "            Item_Outlet_Sales,Item_Visibility. Defaults to Item_Outlet_Sales, Item_Visibility and Item_Weight.\n"
+        "  -incremental  keep the statistics of the linear models (1, 3, 4, 5) in a state file, and only read the rows\n"
+        "                appended to the training data since the last run. Creates the file if it doesn't exist.\n"
+        "  -window   with -incremental, only fit the most recent rows, removing older ones as new ones are appended\n"
+        "  -benchmark-init  repeat the runs with every initializer, several seeds and growing populations, and print how\n"
+        "                many population members each initializer needs to find the best fit. Defaults to models 3 to 9.\n"
+        "  -export   save the fitted models that are linear in the data columns (3, 4, 5, and the incremental runs) as\n"
+        "            scoring model files in the directory, one per run\n"
+        "  -generate  write the fitted polynomial models (3 to 9) as self contained C++ headers in the directory, one per\n"
+        "            run, with the coefficients as constexpr arrays and an unrolled constexpr Predict function\n"
+        "  -cache    keep the parsed data and the statistics of its columns in binary files in the directory, and load\n"
+        "            them from there instead of parsing the CSV files again, until the CSV files change\n"
+        "  -serve    score rows with a scoring model file for other processes, over a Unix domain socket, until stopped.\n"
+        "            Loads the file again whenever it changes.\n"
+        "  -socket   the socket path of the scoring server. Defaults to regression.sock.\n"
+        "  -load     send -requests requests (default 1000) of -rows test rows each (default 16) to the scoring server on\n"
+        "            this many connections at once, and report the throughput and latency. -stop-server stops it after.\n"
+        "  with no runs given, every model is run with its default settings.\n"
+    );
+}
+
+static int RunIncremental(const char* stateFileName, size_t windowSize, int threadCount, bool pinThreads, const std::vector<ModelRun>& runs, const char* outFileName)
+{
+    CSV test;
+    if (!LoadCSV("data/test.csv", test))
+    {
+        printf("could not load data/test.csv");
+        return 1;
+    }
+
+    // a missing state file means starting from scratch
+    IncrementalState state;
+    FILE* stateFile = nullptr;
+    fopen_s(&stateFile, stateFileName, "rb");
+    if (stateFile)
+    {
+        fclose(stateFile);
+        if (!LoadIncrementalState(stateFileName, state))
+            return 1;
+    }
+
+    StartTaskScheduler(threadCount, pinThreads);
+    IncrementalUpdateStats updateStats;
+    bool updated = UpdateIncrementalState("data/train.csv", windowSize, state, updateStats);
+    StopTaskScheduler();
+    if (!updated)
+        return 1;
+
+    printf("Incremental update: %zu rows added, %zu rows removed\n\n", updateStats.rowsAdded, updateStats.rowsRemoved);
+    if (!SaveIncrementalState(stateFileName, state))
+    {
+        printf("could not write %s\n", stateFileName);
+        return 1;
+    }
+
+    std::vector<ModelReport> reports;
+    ExecuteIncrementalRuns(state, test, runs, reports);
+
+    if (!WriteResults(outFileName, runs, reports))
+        return 1;
+    printf("Results written to %s\n", outFileName);
+
+    for (const ModelReport& report : reports)
+    {
+        if (!report.succeeded)
+            return 1;
+    }
+
+    return 0;
+}
 
 int main(int argc, char** argv)
 {
-    // load the training and test data
-    CSV train;
-    if (!LoadCSV("data/train.csv", train))
+    // read the command line
+    std::vector<ModelRun> runs;
+    int threadCount = int(std::thread::hardware_concurrency());
+    bool pinThreads = false;
+    const char* outFileName = "results.json";
+    const char* checkpointDirectory = nullptr;
+    const char* traceDirectory = nullptr;
+    std::vector<std::string> targets;
+    const char* incrementalFileName = nullptr;
+    size_t windowSize = 0;
+    bool benchmarkInitializers = false;
+    const char* exportDirectory = nullptr;
+    const char* generateDirectory = nullptr;
+    const char* cacheDirectory = nullptr;
+    const char* serveFileName = nullptr;
+    const char* socketPath = "regression.sock";
+    int loadConnections = -1;
+    size_t loadRequests = 1000;
+    size_t loadRows = 16;
+    bool stopServer = false;
+    for (int argIndex = 1; argIndex < argc; ++argIndex)
+    {
+        const char* arg = argv[argIndex];
+        bool hasValue = argIndex + 1 < argc;
+        if (!strcmp(arg, "-threads") && hasValue)
+        {
+            threadCount = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-pin"))
+        {
+            pinThreads = true;
+        }
+        else if (!strcmp(arg, "-config") && hasValue)
+        {
+            if (!LoadRunConfig(argv[++argIndex], runs))
+                return 1;
+        }
+        else if (!strcmp(arg, "-out") && hasValue)
+        {
+            outFileName = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-checkpoint") && hasValue)
+        {
+            checkpointDirectory = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-trace") && hasValue)
+        {
+            traceDirectory = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-targets") && hasValue)
+        {
+            // a comma separated list of column names, which can have spaces in them
+            std::string list = argv[++argIndex];
+            size_t begin = 0;
+            while (begin <= list.size())
+            {
+                size_t end = list.find(',', begin);
+                if (end == std::string::npos)
+                    end = list.size();
+                if (end > begin)
+                    targets.push_back(list.substr(begin, end - begin));
+                begin = end + 1;
+            }
+        }
+        else if (!strcmp(arg, "-incremental") && hasValue)
+        {
+            incrementalFileName = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-window") && hasValue)
+        {
+            windowSize = size_t(atoll(argv[++argIndex]));
+        }
+        else if (!strcmp(arg, "-benchmark-init"))
+        {
+            benchmarkInitializers = true;
+        }
+        else if (!strcmp(arg, "-export") && hasValue)
+        {
+            exportDirectory = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-generate") && hasValue)
+        {
+            generateDirectory = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-cache") && hasValue)
+        {
+            cacheDirectory = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-serve") && hasValue)
+        {
+            serveFileName = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-socket") && hasValue)
+        {
+            socketPath = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-load") && hasValue)
+        {
+            loadConnections = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-requests") && hasValue)
+        {
+            loadRequests = size_t(atoll(argv[++argIndex]));
+        }
+        else if (!strcmp(arg, "-rows") && hasValue)
+        {
+            loadRows = size_t(atoll(argv[++argIndex]));
+        }
+        else if (!strcmp(arg, "-stop-server"))
+        {
+            stopServer = true;
+        }
+        else if (arg[0] == '-')
+        {
+            PrintUsage();
+            return 1;
+        }
+        else
+        {
+            ModelRun run;
+            if (!ParseModelRun(arg, run))
+                return 1;
+            runs.push_back(run);
+        }
+    }
+
+    // the scoring server and its load generator don't do any runs
+    if (serveFileName)
+        return RunScoringServer(serveFileName, socketPath);
+    if (loadConnections >= 0 || stopServer)
+        return RunLoadGenerator(socketPath, size_t(std::max(loadConnections, 0)), loadRequests, std::max(loadRows, size_t(1)), stopServer);
+
+    if (runs.empty())
+    {
+        for (int model = 1; model <= ModelCount(); ++model)
+        {
+            if (incrementalFileName && !IsIncrementalModel(model))
+                continue;
+            // the models fit with a population
+            if (benchmarkInitializers && (model < 3 || model > 9))
+                continue;
+            ModelRun run;
+            ParseModelRun(std::to_string(model).c_str(), run);
+            runs.push_back(run);
+        }
+    }
+
+    if (checkpointDirectory)
+        SetCheckpointFiles(checkpointDirectory, runs);
+    if (traceDirectory)
+        SetTraceFiles(traceDirectory, runs);
+    if (exportDirectory)
+        SetScoringModelFiles(exportDirectory, runs);
+    if (generateDirectory)
+        SetScoringHeaderFiles(generateDirectory, runs);
+    for (ModelRun& run : runs)
+        run.settings.targets = targets;
+
+    // incremental runs update their state from the new training rows, instead of loading all of them
+    if (incrementalFileName)
+        return RunIncremental(incrementalFileName, windowSize, threadCount, pinThreads, runs, outFileName);
+
+    // load the training and test data, and the statistics of their columns
+    Dataset dataset;
+    bool trainFromCache = false;
+    bool testFromCache = false;
+    if (!LoadCSVCached("data/train.csv", cacheDirectory, dataset.train, dataset.trainStats, trainFromCache))
     {
         printf("could not load data/train.csv");
         return 1;
     }
 
-    CSV test;
-    if (!LoadCSV("data/test.csv", test))
+    if (!LoadCSVCached("data/test.csv", cacheDirectory, dataset.test, dataset.testStats, testFromCache))
     {
         printf("could not load data/test.csv");
         return 1;
     }
+    if (cacheDirectory)
+        printf("Data cache: data/train.csv %s, data/test.csv %s\n", trainFromCache ? "read from the cache" : "parsed", testFromCache ? "read from the cache" : "parsed");
 
-    // process the Outlet_Establishment_Year column to be smaller numbers, so fewer numerical concerns
+    // standardize every column except the sales, using the mean and scale of the training data
     {
-        int yearIndex = train.GetHeaderIndex("Outlet_Establishment_Year");
-        if (yearIndex == -1 || test.GetHeaderIndex("Outlet_Establishment_Year") != yearIndex)
+        int salesIndex = dataset.train.GetHeaderIndex("Item_Outlet_Sales");
+        if (salesIndex == -1 || dataset.test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
         {
-            printf("Couldn't find Outlet_Establishment_Year column.\n");
+            printf("Couldn't find Item_Outlet_Sales column.\n");
             return 1;
         }
 
-        for (auto& row : train.data)
-            row[yearIndex] = 2020.0f - row[yearIndex];
-
-        for (auto& row : test.data)
-            row[yearIndex] = 2020.0f - row[yearIndex];
+        CalculateStandardization(dataset.trainStats, { salesIndex }, dataset.standardization);
+        Standardize(dataset.train, dataset.standardization, dataset.trainStandardized);
+        Standardize(dataset.test, dataset.standardization, dataset.testStandardized);
     }
 
-    // TODO: TEMP!
-#if 0
-    Model1(train, test);
-    Model2(train, test);
-    Model3(train, test);
-    Model4(train, test);
-    Model5(train, test);
-
-    Model7(train, test);
-#endif
+    // do the runs, all sharing the loaded data. The runs, population members and loss calculations all share one scheduler.
+    StartTaskScheduler(threadCount, pinThreads);
+    std::vector<ModelReport> reports;
+    if (benchmarkInitializers)
+    {
+        std::vector<ModelRun> baseRuns;
+        baseRuns.swap(runs);
+        BenchmarkInitializers(dataset, baseRuns, runs, reports);
+    }
+    else
+    {
+        printf("Running %zu model runs on %i worker threads\n\n", runs.size(), TaskWorkerCount());
+        ExecuteRuns(dataset, runs, reports);
+    }
+    StopTaskScheduler();
 
+    if (!WriteResults(outFileName, runs, reports))
+        return 1;
+    printf("Results written to %s\n", outFileName);
 
-    Model6(train, test);
-    //Model8(train, test);
-    Model9(train, test);
+    // fail if any run failed, so scripts can tell
+    for (const ModelReport& report : reports)
+    {
+        if (!report.succeeded)
+            return 1;
+    }
 
     return 0;
 }
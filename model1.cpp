@@ -10,28 +10,29 @@ C is a constant.  C is the mean sales.
 
 */
 
-void Model1(const CSV& train, const CSV& test)
+void Model1(const Dataset& dataset, const ModelSettings& /*settings*/, ModelReport& report)
 {
-    printf(__FUNCTION__ "() - use mean sales as a prediction\n");
+    report.Printf(__FUNCTION__ "() - use mean sales as a prediction\n");
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
 
     // find out which column is the sales
     int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
     if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
     {
-        printf("Couldn't find Item_Outlet_Sales column.\n");
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
         return;
     }
 
-    // calculate average sales from training data
-    Average averageSales;
-    for (const auto& row : train.data)
-        averageSales.AddSample(row[salesIndex]);
+    // average sales from training data, from the column statistics
+    double averageSales = dataset.trainStats[salesIndex].mean;
 
     // calculate mean squared error (average squared error) and root mean squared error from training data
     Average Train_MSE;
     for (const auto& row : train.data)
     {
-        double error = row[salesIndex] - averageSales.average;
+        double error = row[salesIndex] - averageSales;
         Train_MSE.AddSample(error * error);
     }
     double Train_RMSE = sqrt(Train_MSE.average);
@@ -40,13 +41,17 @@ void Model1(const CSV& train, const CSV& test)
     Average Test_MSE;
     for (const auto& row : test.data)
     {
-        double error = row[salesIndex] - averageSales.average;
+        double error = row[salesIndex] - averageSales;
         Test_MSE.AddSample(error * error);
     }
     double Test_RMSE = sqrt(Test_MSE.average);
 
     // report results
-    printf("  Mean of Item_Outlet_Sales: %0.2f\n", averageSales.average);
-    printf("  RMSE on training set: %0.2f\n", Train_RMSE);
-    printf("  RMSE on test set: %0.2f\n\n", Test_RMSE);
+    report.Printf("  Mean of Item_Outlet_Sales: %0.2f\n", averageSales);
+    report.Printf("  RMSE on training set: %0.2f\n", Train_RMSE);
+    report.Printf("  RMSE on test set: %0.2f\n\n", Test_RMSE);
+
+    // structured results, for the runner
+    report.Value("train_rmse", Train_RMSE);
+    report.Value("test_rmse", Test_RMSE);
 }
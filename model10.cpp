@@ -0,0 +1,123 @@
+// how many trees are boosted. 1 tree with a learning rate of 1 is a plain regression tree.
+static const size_t c_treeCount = 100;
+
+// how much of each tree's fit is added to the prediction
+static const double c_learningRate = 0.1f;
+
+// how deep the trees go, and the fewest rows a leaf can have
+static const int c_maxDepth = 4;
+static const size_t c_minLeafSamples = 20;
+
+// L2 regularization of the leaf values
+static const double c_L2RegAlpha = 1.0f;
+
+// how many bins the continuous columns are split into
+static const int c_maxBins = 64;
+
+#include "utils.h"
+#include "trees.h"
+#include <algorithm>
+
+/*
+
+Model 10:
+
+f(x, y, ...) = C + T1(x, y, ...) + T2(x, y, ...) + ...
+
+x, y, ... are the data columns
+C is the mean sales, and T1, T2, ... are regression trees, each fit to what the ones before it got wrong (gradient boosting).
+
+Each tree is piecewise constant, like Model2, but it picks its own groups by splitting the data on whichever column and
+threshold helps most.
+
+*/
+
+void Model10(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
+{
+    report.Printf(__FUNCTION__ "() - Gradient boosted regression trees of Item_Outlet_Sales based on all data items\n");
+
+    // hyperparameters, which the runner can override
+    TreeSettings treeSettings;
+    treeSettings.treeCount = (size_t)settings.Get("trees", double(c_treeCount));
+    treeSettings.learningRate = settings.Get("learningRate", c_learningRate);
+    treeSettings.maxDepth = (int)settings.Get("depth", double(c_maxDepth));
+    treeSettings.minLeafSamples = (size_t)settings.Get("minLeaf", double(c_minLeafSamples));
+    treeSettings.L2RegAlpha = settings.Get("L2", c_L2RegAlpha);
+    treeSettings.maxBins = (int)settings.Get("bins", double(c_maxBins));
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
+
+    // get the columns of interest
+    int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
+    if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
+    {
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
+        return;
+    }
+
+    // use every column except the sales as a feature. Trees don't care about the scale of the data, so it isn't standardized.
+    std::vector<int> columns;
+    for (int index = 0; index < int(train.headers.size()); ++index)
+    {
+        if (index != salesIndex)
+            columns.push_back(index);
+    }
+
+    BoostedTrees model;
+    TrainBoostedTrees(train, columns, salesIndex, treeSettings, model);
+
+    // calculate mean squared error (average squared error) and root mean squared error, and R^2
+    auto score = [&](const CSV& data, double& RSquared)
+    {
+        Average averageSales;
+        for (const auto& row : data.data)
+            averageSales.AddSample(row[salesIndex]);
+
+        Average MSE;
+        double denominator = 0.0f;
+        for (const auto& row : data.data)
+        {
+            double error = model.Predict(row) - row[salesIndex];
+            MSE.AddSample(error * error);
+            denominator += sqr(row[salesIndex] - averageSales.average);
+        }
+        RSquared = 1.0f - MSE.average * double(data.data.size()) / denominator;
+        return MSE.average;
+    };
+    double Train_RSquared, Test_RSquared;
+    double Train_MSE = score(train, Train_RSquared);
+    double Test_MSE = score(test, Test_RSquared);
+
+    // the features with the most split gain
+    std::vector<size_t> featureOrder(columns.size());
+    for (size_t index = 0; index < featureOrder.size(); ++index)
+        featureOrder[index] = index;
+    std::stable_sort(featureOrder.begin(), featureOrder.end(), [&](size_t A, size_t B) { return model.featureGain[A] > model.featureGain[B]; });
+
+    double totalGain = 0.0f;
+    for (double gain : model.featureGain)
+        totalGain += gain;
+
+    size_t nodeCount = 0;
+    for (const RegressionTree& tree : model.trees)
+        nodeCount += tree.nodes.size();
+
+    // Report results
+    report.Printf("  %zu trees, depth %i, %0.2f nodes per tree\n", model.trees.size(), treeSettings.maxDepth, double(nodeCount) / double(model.trees.size()));
+    report.Printf("  Most important features:\n");
+    for (size_t index = 0; index < featureOrder.size() && index < 5; ++index)
+    {
+        size_t feature = featureOrder[index];
+        report.Printf("    %s: %0.1f%%\n", train.headers[columns[feature]].c_str(), totalGain > 0.0f ? 100.0f * model.featureGain[feature] / totalGain : 0.0f);
+    }
+    report.Printf("  test/train R^2 = %f  %f\n", Test_RSquared, Train_RSquared);
+    report.Printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
+    report.Printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+
+    // structured results, for the runner
+    report.Value("train_rmse", sqrt(Train_MSE));
+    report.Value("test_rmse", sqrt(Test_MSE));
+    report.Value("train_r2", Train_RSquared);
+    report.Value("test_r2", Test_RSquared);
+}
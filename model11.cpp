@@ -0,0 +1,113 @@
+// how many neighbors are averaged for a prediction
+static const size_t c_neighborCount = 10;
+
+// the most points in a leaf of the KD-tree
+static const size_t c_leafSize = 32;
+
+#include "utils.h"
+#include "knn.h"
+
+/*
+
+Model 11:
+
+f(x, y, ...) = the mean sales of the k training rows closest to (x, y, ...)
+
+x, y, ... are Item_MRP, Outlet_Establishment_Year and the Outlet_Type columns, standardized so they count equally in the
+distance.
+
+There are no coefficients to fit. It's a baseline for how well the data can be fit without assuming a shape for it.
+
+*/
+
+void Model11(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
+{
+    report.Printf(__FUNCTION__ "() - K nearest neighbor regression of Item_Outlet_Sales based on Item_MRP, Outlet_Establishment_Year and Outlet_Type\n");
+
+    // hyperparameters, which the runner can override
+    size_t neighborCount = (size_t)settings.Get("k", double(c_neighborCount));
+    size_t leafSize = (size_t)settings.Get("leafSize", double(c_leafSize));
+    if (neighborCount < 1)
+    {
+        report.Fail("k must be at least 1.\n");
+        return;
+    }
+
+    // distances are measured in the standardized data. The sales column isn't standardized.
+    const CSV& train = dataset.trainStandardized;
+    const CSV& test = dataset.testStandardized;
+
+    // get the columns of interest
+    int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
+    if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
+    {
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
+        return;
+    }
+
+    static const char* c_columnNames[] =
+    {
+        "Item_MRP", "Outlet_Establishment_Year",
+        "Outlet_Type_Grocery Store", "Outlet_Type_Supermarket Type1", "Outlet_Type_Supermarket Type2", "Outlet_Type_Supermarket Type3"
+    };
+    std::vector<int> columns;
+    for (const char* columnName : c_columnNames)
+    {
+        int index = train.GetHeaderIndex(columnName);
+        if (index == -1 || test.GetHeaderIndex(columnName) != index)
+        {
+            report.Fail("Couldn't find %s column.\n", columnName);
+            return;
+        }
+        columns.push_back(index);
+    }
+
+    // build the index once, and answer both sets of queries with it
+    KDTree tree;
+    BuildKDTree(AllRows(train), columns, salesIndex, leafSize, tree);
+
+    // calculate mean squared error (average squared error) and root mean squared error, and R^2.
+    // The training rows are scored leaving themselves out, or every row would be its own nearest neighbor.
+    auto score = [&](const CSV& data, bool leaveOneOut, double& RSquared, KNNQueryStats& stats)
+    {
+        std::vector<double> predictions;
+        KNNPredict(tree, AllRows(data), columns, neighborCount, leaveOneOut, predictions, stats);
+
+        Average averageSales;
+        for (const auto& row : data.data)
+            averageSales.AddSample(row[salesIndex]);
+
+        Average MSE;
+        double denominator = 0.0f;
+        for (size_t index = 0; index < data.data.size(); ++index)
+        {
+            double error = predictions[index] - data.data[index][salesIndex];
+            MSE.AddSample(error * error);
+            denominator += sqr(data.data[index][salesIndex] - averageSales.average);
+        }
+        RSquared = 1.0f - MSE.average * double(data.data.size()) / denominator;
+        return MSE.average;
+    };
+    double Train_RSquared, Test_RSquared;
+    KNNQueryStats trainStats, testStats;
+    double Train_MSE = score(train, true, Train_RSquared, trainStats);
+    double Test_MSE = score(test, false, Test_RSquared, testStats);
+
+    // how much of the brute force work the index did
+    size_t queryCount = trainStats.queries + testStats.queries;
+    double distancesPerQuery = double(trainStats.distanceEvaluations + testStats.distanceEvaluations) / double(queryCount > 0 ? queryCount : 1);
+
+    // Report results
+    report.Printf("  k = %zu, %zu points in %zu tree nodes\n", neighborCount, tree.pointCount, tree.nodes.size());
+    report.Printf("  %0.2f distance calculations per query (%0.1f%% of brute force)\n", distancesPerQuery, tree.pointCount > 0 ? 100.0f * distancesPerQuery / double(tree.pointCount) : 0.0f);
+    report.Printf("  test/train R^2 = %f  %f\n", Test_RSquared, Train_RSquared);
+    report.Printf("  RMSE on training set (leave one out): %0.2f\n", sqrt(Train_MSE));
+    report.Printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+
+    // structured results, for the runner
+    report.Value("train_rmse", sqrt(Train_MSE));
+    report.Value("test_rmse", sqrt(Test_MSE));
+    report.Value("train_r2", Train_RSquared);
+    report.Value("test_r2", Test_RSquared);
+    report.Value("distances_per_query", distancesPerQuery);
+}
@@ -0,0 +1,149 @@
+// the columns predicted when the -targets option isn't given
+static const char* c_defaultTargets[] = { "Item_Outlet_Sales", "Item_Visibility", "Item_Weight" };
+
+// the highest power of each feature that isn't a 0/1 column
+static const int c_degree = 1;
+
+#include "utils.h"
+#include "incremental.h"
+#include <algorithm>
+#include <string>
+
+/*
+
+Model 12:
+
+f_t(x, y, ...) = A_t x + B_t y + ... + Z_t, for each target t
+
+x, y, ... are every data column that isn't a target, standardized, with their powers up to the degree setting
+(like x^3 and x^2) for columns that aren't 0/1. A_t, B_t, ..., Z_t are the least squares coefficients of target t.
+
+Every target is fit at once, from a single pass over the training rows. The pass gathers the co-moments of all of the
+columns, features and targets together, so each row's features are read once no matter how many targets there are. The
+normal equations only depend on the features, so they are factored once, and each target is one more pair of triangular
+solves. Scoring the test set also reads each row once and predicts every target from it.
+
+*/
+
+void Model12(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
+{
+    report.Printf(__FUNCTION__ "() - Least squares fit of several targets at once, based on all of the other data items\n");
+
+    // hyperparameters, which the runner can override
+    int degree = std::max((int)settings.Get("degree", double(c_degree)), 1);
+    double L2 = settings.Get("L2", 0.0f);
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
+
+    // get the columns of interest
+    std::vector<std::string> targetNames = settings.targets;
+    if (targetNames.empty())
+        targetNames.assign(std::begin(c_defaultTargets), std::end(c_defaultTargets));
+
+    std::vector<int> targets;
+    for (const std::string& targetName : targetNames)
+    {
+        int index = train.GetHeaderIndex(targetName.c_str());
+        if (index == -1 || test.GetHeaderIndex(targetName.c_str()) != index)
+        {
+            report.Fail("Couldn't find %s column.\n", targetName.c_str());
+            return;
+        }
+        if (std::find(targets.begin(), targets.end(), index) != targets.end())
+        {
+            report.Fail("%s is a target more than once.\n", targetName.c_str());
+            return;
+        }
+        targets.push_back(index);
+    }
+
+    // the features are every other column, and the powers of the ones that aren't 0/1
+    std::vector<int> features;
+    std::vector<int> powers;
+    for (int column = 0; column < int(train.headers.size()); ++column)
+    {
+        if (std::find(targets.begin(), targets.end(), column) != targets.end())
+            continue;
+
+        for (int power = dataset.trainStats[column].binary ? 1 : degree; power > 0; --power)
+        {
+            features.push_back(column);
+            powers.push_back(power);
+        }
+    }
+    if (features.empty())
+    {
+        report.Fail("Every column is a target, so there's nothing to fit them from.\n");
+        return;
+    }
+
+    // lay the rows out as the features, from the standardized data so the powers stay well conditioned, then the targets
+    // in their original units
+    auto makeRows = [&](const CSV& standardized, const CSV& original, CSV& rows)
+    {
+        rows.data.resize(original.data.size());
+        for (size_t rowIndex = 0; rowIndex < original.data.size(); ++rowIndex)
+        {
+            std::vector<double>& row = rows.data[rowIndex];
+            row.clear();
+            row.reserve(features.size() + targets.size());
+            for (size_t index = 0; index < features.size(); ++index)
+                row.push_back(pow(standardized.data[rowIndex][features[index]], double(powers[index])));
+            for (int target : targets)
+                row.push_back(original.data[rowIndex][target]);
+        }
+    };
+    CSV trainRows, testRows;
+    makeRows(dataset.trainStandardized, train, trainRows);
+    makeRows(dataset.testStandardized, test, testRows);
+
+    // one pass over the training rows for the statistics of every column, then fit every target from them
+    MomentStats stats;
+    for (size_t column = 0; column < features.size() + targets.size(); ++column)
+        stats.columns.push_back(int(column));
+    CalculateMoments(AllRows(trainRows), stats);
+
+    std::vector<std::vector<double>> coefficients;
+    std::vector<double> Train_MSE;
+    FitLinear(stats, targets.size(), L2, coefficients, Train_MSE);
+
+    // calculate mean squared error (average squared error) and R^2 of every target on the test set. Each row's features are
+    // read once, to predict every target from them. The mean of each target comes from the column statistics.
+    std::vector<Average> Test_MSE(targets.size());
+    std::vector<double> denominator(targets.size(), 0.0f);
+    for (const auto& row : testRows.data)
+    {
+        for (size_t target = 0; target < targets.size(); ++target)
+        {
+            double value = row[features.size() + target];
+            double prediction = coefficients[target].back();
+            for (size_t index = 0; index < features.size(); ++index)
+                prediction += coefficients[target][index] * row[index];
+            Test_MSE[target].AddSample(sqr(prediction - value));
+            denominator[target] += sqr(value - dataset.testStats[targets[target]].mean);
+        }
+    }
+
+    // Report results
+    report.Printf("  %zu targets fit from %zu features (degree %i) in one pass over %zu training rows\n", targets.size(), features.size(), degree, stats.count);
+    for (size_t target = 0; target < targets.size(); ++target)
+    {
+        double Test_RSquared = (denominator[target] > 0.0f) ? 1.0f - Test_MSE[target].average * double(testRows.data.size()) / denominator[target] : 0.0f;
+        report.Printf("  %s: RMSE on training set %0.2f, on test set %0.2f, test R^2 %f\n", targetNames[target].c_str(), sqrt(Train_MSE[target]), sqrt(Test_MSE[target].average), Test_RSquared);
+
+        // structured results, for the runner. The first target is reported as the model's result.
+        if (target == 0)
+        {
+            report.Value("train_rmse", sqrt(Train_MSE[target]));
+            report.Value("test_rmse", sqrt(Test_MSE[target].average));
+            report.Value("test_r2", Test_RSquared);
+        }
+        report.Value(("train_rmse_" + targetNames[target]).c_str(), sqrt(Train_MSE[target]));
+        report.Value(("test_rmse_" + targetNames[target]).c_str(), sqrt(Test_MSE[target].average));
+    }
+    report.Printf("\n");
+
+    // the coefficients of the first target, for the standardized features
+    report.coefficients = coefficients[0];
+}
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "groupby.h"
 
 /*
 
@@ -11,79 +12,116 @@ C is a constant.  C is the mean sales for that location type
 
 */
 
-void Model2(const CSV& train, const CSV& test)
+void Model2(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
 {
-    printf(__FUNCTION__ "() - use mean sales per Outlet_Location_Type as a prediction\n");
+    report.Printf(__FUNCTION__ "() - use mean sales per Outlet_Location_Type as a prediction\n");
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
 
     // get the columns of interest
     int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
     if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
     {
-        printf("Couldn't find Item_Outlet_Sales column.\n");
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
         return;
     }
 
     int locationType1Index = train.GetHeaderIndex("Outlet_Location_Type_Tier 1");
     if (locationType1Index == -1 || test.GetHeaderIndex("Outlet_Location_Type_Tier 1") != locationType1Index)
     {
-        printf("Couldn't find Outlet_Location_Type_Tier 1 column.\n");
+        report.Fail("Couldn't find Outlet_Location_Type_Tier 1 column.\n");
         return;
     }
 
     int locationType2Index = train.GetHeaderIndex("Outlet_Location_Type_Tier 2");
     if (locationType2Index == -1 || test.GetHeaderIndex("Outlet_Location_Type_Tier 2") != locationType2Index)
     {
-        printf("Couldn't find Outlet_Location_Type_Tier 2 column.\n");
+        report.Fail("Couldn't find Outlet_Location_Type_Tier 2 column.\n");
         return;
     }
 
     int locationType3Index = train.GetHeaderIndex("Outlet_Location_Type_Tier 3");
     if (locationType3Index == -1 || test.GetHeaderIndex("Outlet_Location_Type_Tier 3") != locationType3Index)
     {
-        printf("Couldn't find Outlet_Location_Type_Tier 3 column.\n");
+        report.Fail("Couldn't find Outlet_Location_Type_Tier 3 column.\n");
         return;
     }
 
-    // calculate average sales from training data for each Outlet_Location_Type
-    std::unordered_map<double, Average> averageSalesMap;
-    for (const auto& row : train.data)
+    // group the rows by location type. The tier columns are one hot, so the key is the bitfield tier1*4 + tier2*2 + tier3.
+    GroupKey key;
+    if (!MakeGroupKey(train, { locationType1Index, locationType2Index, locationType3Index }, key))
     {
-        double locationType = row[locationType1Index] * 4.0f + row[locationType2Index] * 2.0f + row[locationType1Index];
-        averageSalesMap[locationType].AddSample(row[salesIndex]);
+        report.Fail("Couldn't make a group key from the Outlet_Location_Type columns.\n");
+        return;
     }
 
-    // calculate mean squared error (average squared error) and root mean squared error from training data
-    Average Train_MSE;
-    std::unordered_map<double, Average> Train_MSEs;
-    for (const auto& row : train.data)
+    // with the packed setting, the passes run on the rows packed a column at a time, with the keys built from the bits of the
+    // one hot columns
+    bool packed = settings.Get("packed", 0.0f) != 0.0f;
+    PackedColumns packedTrain, packedTest;
+    if (packed)
     {
-        double locationType = row[locationType1Index] * 4.0f + row[locationType2Index] * 2.0f + row[locationType1Index];
-        double error = row[salesIndex] - averageSalesMap[locationType].average;
-        Train_MSEs[locationType].AddSample(error * error);
-        Train_MSE.AddSample(error * error);
+        PackColumns(AllRows(train), packedTrain);
+        PackColumns(AllRows(test), packedTest);
     }
-    double Train_RMSE = sqrt(Train_MSE.average);
 
-    // calculate mean squared error (average squared error) and root mean squared error from test data
-    Average Test_MSE;
-    std::unordered_map<double, Average> Test_MSEs;
-    for (const auto& row : test.data)
+    // calculate the count, average sales and squared error from training data for each Outlet_Location_Type, in one pass
+    GroupStats stats;
+    if (packed)
+        AggregateGroups(packedTrain, key, salesIndex, stats);
+    else
+        AggregateGroups(AllRows(train), key, salesIndex, stats);
+
+    // rows of a group that has no training data are predicted with the overall average
+    double trainSquaredError = 0.0f;
+    Average averageSales;
+    for (size_t group = 0; group < stats.count.size(); ++group)
     {
-        double locationType = row[locationType1Index] * 4.0f + row[locationType2Index] * 2.0f + row[locationType1Index];
-        double error = row[salesIndex] - averageSalesMap[locationType].average;
-        Test_MSEs[locationType].AddSample(error * error);
-        Test_MSE.AddSample(error * error);
+        if (stats.count[group] == 0)
+            continue;
+        trainSquaredError += stats.squaredError[group];
+        averageSales.samples += int(stats.count[group]);
+        averageSales.average = Lerp(averageSales.average, stats.mean[group], double(stats.count[group]) / double(averageSales.samples));
     }
-    double Test_RMSE = sqrt(Test_MSE.average);
+
+    // root mean squared error from training data. The training rows are predicted with their own group mean, so it comes out of the pass above.
+    double Train_RMSE = sqrt(trainSquaredError / double(averageSales.samples));
+
+    // calculate mean squared error (average squared error) and root mean squared error from test data
+    GroupErrors testErrors;
+    if (packed)
+        CalculateGroupErrors(packedTest, key, salesIndex, stats, averageSales.average, testErrors);
+    else
+        CalculateGroupErrors(AllRows(test), key, salesIndex, stats, averageSales.average, testErrors);
+    double Test_RMSE = sqrt(testErrors.totalSquaredError / double(testErrors.totalCount));
 
     // report results
-    for (const auto it : averageSalesMap)
+    for (size_t group = 0; group < stats.count.size(); ++group)
     {
-        printf("  Item_Outlet_Sales %i  (%i samples)\n", (int)it.first, it.second.samples);
-        printf("    Mean of Item_Outlet_Sales: %0.2f\n", it.second.average);
-        printf("    RMSE on training set: %0.2f\n", sqrt(Train_MSEs[it.first].average));
-        printf("    RMSE on test set: %0.2f\n", sqrt(Test_MSEs[it.first].average));
+        if (stats.count[group] == 0)
+            continue;
+
+        double groupTrainRMSE = sqrt(stats.squaredError[group] / double(stats.count[group]));
+        double groupTestRMSE = (testErrors.count[group] > 0) ? sqrt(testErrors.squaredError[group] / double(testErrors.count[group])) : 0.0f;
+
+        report.Printf("  %s  (%zu samples)\n", GroupName(train, key, group).c_str(), stats.count[group]);
+        report.Printf("    Mean of Item_Outlet_Sales: %0.2f\n", stats.mean[group]);
+        report.Printf("    RMSE on training set: %0.2f\n", groupTrainRMSE);
+        report.Printf("    RMSE on test set: %0.2f  (%zu samples)\n", groupTestRMSE, testErrors.count[group]);
+
+        std::string name = "group_" + std::to_string(group);
+        report.Value((name + "_count").c_str(), double(stats.count[group]));
+        report.Value((name + "_mean").c_str(), stats.mean[group]);
+        report.Value((name + "_train_rmse").c_str(), groupTrainRMSE);
+        report.Value((name + "_test_rmse").c_str(), groupTestRMSE);
     }
-    printf("  RMSE on training set: %0.2f\n", Train_RMSE);
-    printf("  RMSE on test set: %0.2f\n\n", Test_RMSE);
+    if (packed)
+        ReportPackedColumns(report, packedTrain, train.DataBytes());
+    report.Printf("  RMSE on training set: %0.2f\n", Train_RMSE);
+    report.Printf("  RMSE on test set: %0.2f\n\n", Test_RMSE);
+
+    // structured results, for the runner
+    report.Value("train_rmse", Train_RMSE);
+    report.Value("test_rmse", Test_RMSE);
 }
@@ -1,8 +1,8 @@
 // This is for central differences, for calculating the gradient
 static const double c_epsilon = 0.01f;
 
-// The learning rate, for gradient descent
-static double c_learningRate = 1.0f;
+// The initial step size of the line search, for gradient descent
+static const double c_initialStepSize = 1.0f;
 
 // how many steps of gradient descent are done
 static const size_t c_gradientDescentSteps = 500;
@@ -10,8 +10,20 @@ static const size_t c_gradientDescentSteps = 500;
 // how many times should it pick a random set of parameters and do gradient descent?
 static const size_t c_population = 100;
 
+// a member stops after this many steps in a row that lower its loss by less than the tolerance, as a fraction of the loss
+static const double c_convergenceTolerance = 1e-7f;
+static const size_t c_convergencePatience = 5;
+
+// with successive halving, how many steps each member takes in the first round, and the total step budget (0 for none)
+static const size_t c_halvingFirstRoundSteps = 10;
+static const size_t c_halvingStepBudget = 0;
+
 #include "utils.h"
 #include "linearfit.h"
+#include "population.h"
+#include "linesearch.h"
+#include "convergence.h"
+#include "coreset.h"
 #include <random>
 
 /*
@@ -26,119 +38,309 @@ A, B, C and D are coefficients that were learned through gradient descent.
 */
 
 
-void Model4(const CSV& train, const CSV& test)
+void Model4(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
 {
-    printf(__FUNCTION__ "() - Linear fit of Item_Outlet_Sales based on Outlet_Establishment_Year, Item_MRP and Item_Weight\n");
+    report.Printf(__FUNCTION__ "() - Linear fit of Item_Outlet_Sales based on Outlet_Establishment_Year, Item_MRP and Item_Weight\n");
+
+    // hyperparameters, which the runner can override
+    size_t population = (size_t)settings.Get("population", double(c_population));
+    size_t steps = (size_t)settings.Get("steps", double(c_gradientDescentSteps));
+    double initialStepSize = settings.Get("initialStepSize", c_initialStepSize);
+    unsigned int seed = (unsigned int)settings.Get("seed", double(std::mt19937::default_seed));
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
 
     // get the columns of interest
     int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
     if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
     {
-        printf("Couldn't find Item_Outlet_Sales column.\n");
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
         return;
     }
 
     int yearIndex = train.GetHeaderIndex("Outlet_Establishment_Year");
     if (yearIndex == -1 || test.GetHeaderIndex("Outlet_Establishment_Year") != yearIndex)
     {
-        printf("Couldn't find Outlet_Establishment_Year column.\n");
+        report.Fail("Couldn't find Outlet_Establishment_Year column.\n");
         return;
     }
 
     int MRPIndex = train.GetHeaderIndex("Item_MRP");
     if (MRPIndex == -1 || test.GetHeaderIndex("Item_MRP") != MRPIndex)
     {
-        printf("Couldn't find Item_MRP column.\n");
+        report.Fail("Couldn't find Item_MRP column.\n");
         return;
     }
 
     int WeightIndex = train.GetHeaderIndex("Item_Weight");
     if (WeightIndex == -1 || test.GetHeaderIndex("Item_Weight") != WeightIndex)
     {
-        printf("Couldn't find Item_Weight column.\n");
+        report.Fail("Couldn't find Item_Weight column.\n");
         return;
     }
 
-    // do gradient descent
-    // NOTE: this does the same random numbers every program run, so is deterministic, as written.
-    std::mt19937 rng;
-    std::uniform_real_distribution<double> dist(-50.0f, 50.0f);
+    // store the training data as TrainingScalar. Losses and gradients still accumulate in double.
+    CSVT<TrainingScalar> trainingData;
+    ConvertCSV(dataset.trainStandardized, trainingData);
+
+    // the model trains on all of the training rows, except any held out to check for convergence
+    ConvergenceSettings convergence = ConvergenceFromSettings(settings, c_convergenceTolerance, c_convergencePatience);
+    DataView<TrainingScalar> trainingRows, validationRows;
+    SplitValidationRows(AllRows(trainingData), convergence, seed, trainingRows, validationRows);
+
+    // the early steps run on small samples of the training rows, if the coreset setting is on. The last one is all of them.
+    CoresetSettings coreset = CoresetFromSettings(settings);
+    std::vector<DataView<TrainingScalar>> coresets = StratifiedCoresets(trainingRows, salesIndex, coreset, 4, seed);
+
+    // do gradient descent, on the standardized training data
+    // NOTE: this does the same random numbers every run with the same seed, so is deterministic, as written.
+    std::mt19937 rng(seed);
+    // the data columns are standardized, so initialize the coefficients on the scale of the sales instead
+    std::uniform_real_distribution<double> dist(-dataset.standardization.scale[salesIndex], dataset.standardization.scale[salesIndex]);
     std::array<int, 3> columnIndices = { yearIndex, MRPIndex, WeightIndex };
 
-    double bestLoss = FLT_MAX;
-    std::array<double, 4> bestCoefficients;
-    size_t bestCoefficientsPopulationIndex = 0;
-    size_t bestCoefficientsStepIndex = 0;
+    // initialize the starting coefficients of every member of the population, randomly unless the init setting says otherwise
+    std::vector<PopulationMember<4>> members = InitialPopulation<4>(population, InitializerFromSettings(settings), rng, dist);
 
-    // for each member of the population
-    for (size_t populationIndex = 0; populationIndex < c_population; ++populationIndex)
+    // score the best coefficients so far on the test set during training, on a thread of its own, if asked to
+    AsyncEvaluator evaluator;
+    double evaluateInterval = EvaluateIntervalFromSettings(settings);
+    if (evaluateInterval > 0.0f)
     {
-        // random initialize some starting coefficients
+        evaluator.Start(4, evaluateInterval, "  " __FUNCTION__ "()",
+            [&](const std::vector<double>& snapshot, Evaluation& evaluation)
+            {
+                std::array<double, 4> coefficients;
+                std::copy(snapshot.begin(), snapshot.end(), coefficients.begin());
+                if (validationRows.Size() > 0)
+                    evaluation.validationRMSE = sqrt(LossFunction(coefficients, validationRows, columnIndices, salesIndex));
+                UnstandardizeCoefficients(coefficients, columnIndices, dataset.standardization);
+                evaluation.testRMSE = sqrt(LossFunction(coefficients, AllRows(test), columnIndices, salesIndex));
+            }
+        );
+    }
+
+    // where each member is in its gradient descent, so it can be continued a few steps at a time
+    struct DescentState
+    {
+        bool started = false;
+        bool done = false;
+        size_t stepIndex = 0;
+        size_t level = 0;
+        size_t stalls = 0;
         std::array<double, 4> coefficients;
-        for (double& f : coefficients)
-            f = dist(rng);
+        double loss = 0.0f;
+        LineSearch lineSearch;
+    };
+    std::vector<DescentState> states(members.size());
+    std::vector<ConvergenceMonitor> monitors = PopulationMonitors(members.size(), evaluator);
+
+    // successive halving, if it's on, gives the members different numbers of steps within a budget
+    HalvingBudget budget;
+    budget.firstRoundSteps = (size_t)settings.Get("halvingSteps", double(c_halvingFirstRoundSteps));
+    budget.steps = (size_t)settings.Get("budgetSteps", double(c_halvingStepBudget));
+    budget.seconds = settings.Get("budgetSeconds", 0.0f);
 
-        // keep the best coefficients seen
-        double loss = LossFunction(coefficients, train, columnIndices, salesIndex);
-        if (loss < bestLoss)
+    // the steps the coresets get a share of. With a step budget, a member may not get all of its steps, so it's the member's
+    // share of the budget if that is less.
+    size_t coresetStepLimit = (budget.steps > 0) ? std::min(steps, budget.steps / std::max(members.size(), size_t(1))) : steps;
+
+    // takes up to stepCount more steps of gradient descent on a member, with its own line search. Returns false once the
+    // member is done.
+    auto advance = [&](size_t memberIndex, size_t stepCount)
+    {
+        PopulationMember<4>& member = members[memberIndex];
+        DescentState& state = states[memberIndex];
+        ConvergenceMonitor& monitor = monitors[memberIndex];
+
+        // the loss function the line search searches along, on the member's current coreset
+        auto lossFunction = [&](const std::array<double, 4>& coefficients)
+        {
+            member.stats.passes++;
+            member.stats.rowsScanned += coresets[state.level].Size();
+            return LossFunction(coefficients, coresets[state.level], columnIndices, salesIndex);
+        };
+
+        // moves the member up to a larger coreset. The line search starts over, since the step sizes that were accepted on
+        // the smaller coreset would make it crawl on the larger one.
+        auto promote = [&](size_t level)
+        {
+            state.level = level;
+            state.stalls = 0;
+            state.loss = lossFunction(state.coefficients);
+            if (state.level + 1 == coresets.size())
+                member.Keep(state.coefficients, state.loss, state.stepIndex);
+            monitor.Continue(state.loss);
+            state.lineSearch.Restart(initialStepSize);
+        };
+
+        // keep the best coefficients seen. Only losses over all of the rows are kept, since they are what the members are
+        // compared on, and losses over different rows can't be compared.
+        if (!state.started)
         {
-            bestLoss = loss;
-            bestCoefficients = coefficients;
-            bestCoefficientsPopulationIndex = populationIndex;
-            bestCoefficientsStepIndex = 0;
+            state.started = true;
+            state.lineSearch.Restart(initialStepSize);
+            state.coefficients = member.start;
+            state.loss = lossFunction(state.coefficients);
+            if (coresets.size() == 1)
+                member.Keep(state.coefficients, state.loss, 0);
+            monitor.Start(convergence, state.loss);
         }
 
-        // do multiple steps of gradient descent
-        for (int i = 0; i < c_gradientDescentSteps; ++i)
+        // do multiple steps of gradient descent, counting the steps on a coreset like any other
+        for (size_t i = 0; i < stepCount && state.stepIndex < steps && !state.done && !budget.OutOfTime(); ++i)
         {
+            // the last steps are on all of the rows, however far along the coresets the member is
+            if (state.level + 1 < coresets.size() && CoresetOutOfSteps(coreset, state.stepIndex, coresetStepLimit))
+                promote(coresets.size() - 1);
+            bool onAllRows = state.level + 1 == coresets.size();
+
             // calculate the gradient
             std::array<double, 4> gradient;
-            CalculateGradient(gradient, coefficients, train, columnIndices, salesIndex);
+            CalculateGradient(gradient, state.coefficients, coresets[state.level], columnIndices, salesIndex);
+            member.stats.passes++;
+            member.stats.rowsScanned += coresets[state.level].Size();
+            if (monitor.SmallGradient(gradient))
+            {
+                if (!onAllRows)
+                {
+                    promote(state.level + 1);
+                    continue;
+                }
+                state.done = true;
+                break;
+            }
 
-            // do gradient descent with an adaptive learning rate to make sure it isn't increasing the loss function
-            bool newLossWasLarger = false;
-            double newLoss = 0.0f;
-            std::array<double, 4> newCoefficients;
-            do
+            // line search down the negative gradient to find how far to step. Stop if there's nowhere downhill to go.
+            std::array<double, 4> direction;
+            for (size_t index = 0; index < gradient.size(); ++index)
+                direction[index] = -gradient[index];
+
+            double oldLoss = state.loss;
+            bool stepped = state.lineSearch.Armijo(state.coefficients, state.loss, gradient, direction, lossFunction);
+            bool converged = false;
+            if (stepped)
             {
-                // descend
-                for (size_t index = 0; index < gradient.size(); ++index)
-                    newCoefficients[index] = coefficients[index] - gradient[index] * c_learningRate;
+                state.stepIndex++;
+                member.stats.steps++;
 
-                // keep the best coefficients seen
-                newLoss = LossFunction(newCoefficients, train, columnIndices, salesIndex);
-                if (newLoss >= loss)
+                if (onAllRows)
                 {
-                    c_learningRate /= 10.0f;
-                    newLossWasLarger = true;
+                    member.Keep(state.coefficients, state.loss, state.stepIndex);
+                    monitor.Offer(state.stepIndex, state.loss, state.coefficients);
                 }
-            } while (newLoss >= loss);
-            loss = newLoss;
-            coefficients = newCoefficients;
+                converged = monitor.Converged(state.stepIndex, state.loss, [&]() { return LossFunction(state.coefficients, validationRows, columnIndices, salesIndex); });
+            }
 
-            // grow the learning rate for next iteration
-            c_learningRate *= 10.0f;
+            // on a coreset, move up to the next larger one once progress slows down, instead of stopping
+            if (!onAllRows && (!stepped || converged || CoresetStalled(coreset, oldLoss, state.loss, state.stalls)))
+            {
+                promote(state.level + 1);
+                continue;
+            }
+
+            if (!stepped)
+            {
+                monitor.OptimizerStopped();
+                state.done = true;
+                break;
+            }
 
-            // keep the best coefficients seen
-            if (loss < bestLoss)
+            // stop once it stops making progress
+            if (converged)
             {
-                bestLoss = loss;
-                bestCoefficients = coefficients;
-                bestCoefficientsPopulationIndex = populationIndex;
-                bestCoefficientsStepIndex = i + 1;
+                state.done = true;
+                break;
             }
         }
+
+        // a member that stops on a coreset, for now or for good, is judged on all of the rows like the rest, before
+        // successive halving or the search for the best member compares it to them
+        if (state.level + 1 < coresets.size())
+        {
+            member.stats.passes++;
+            member.stats.rowsScanned += trainingRows.Size();
+            member.Keep(state.coefficients, LossFunction(state.coefficients, trainingRows, columnIndices, salesIndex), state.stepIndex);
+        }
+
+        member.stats.searches = state.lineSearch.searches;
+        member.stats.lossEvaluations = state.lineSearch.lossEvaluations;
+        return !state.done && state.stepIndex < steps;
+    };
+
+    // do gradient descent on every member in parallel, either all of them for all their steps, or with successive halving
+    bool halving = settings.Get("halving", 0.0f) != 0.0f;
+    HalvingStats halvingStats;
+    if (halving)
+    {
+        halvingStats = SuccessiveHalving(members, budget, advance);
+        HalvingStopped(monitors, halvingStats);
     }
+    else
+    {
+        ParallelFor(0, members.size(), 1,
+            [&](size_t memberIndex)
+            {
+                advance(memberIndex, steps);
+            }
+        );
+    }
+    evaluator.Stop();
+
+    // keep the best coefficients seen by any member
+    size_t bestCoefficientsPopulationIndex = BestMember(members);
+    std::array<double, 4> bestCoefficients = members[bestCoefficientsPopulationIndex].bestCoefficients;
+    size_t bestCoefficientsStepIndex = members[bestCoefficientsPopulationIndex].bestStepIndex;
+    PopulationStats stats = TotalStats(members);
+
+    // compare the loss of the best coefficients on the training data with the loss at full double precision
+    double trainingDataLoss = LossFunction(bestCoefficients, AllRows(trainingData), columnIndices, salesIndex);
+    double doubleDataLoss = LossFunction(bestCoefficients, AllRows(dataset.trainStandardized), columnIndices, salesIndex);
+
+    // describe the fit in the standardized units it was learned in, for generated code
+    FeatureExpansion linear;
+    linear.columns.assign(columnIndices.begin(), columnIndices.end());
+    DescribePolynomial(train, linear, dataset.standardization, bestCoefficients.data(), report.polynomial);
+
+    // map the best coefficients from standardized units back to the units of the original data
+    UnstandardizeCoefficients(bestCoefficients, columnIndices, dataset.standardization);
 
     // calculate mean squared error (average squared error) and root mean squared error from training data
-    double Train_MSE = LossFunction(bestCoefficients, train, columnIndices, salesIndex);
-    double Test_MSE = LossFunction(bestCoefficients, test, columnIndices, salesIndex);
+    double Train_MSE = LossFunction(bestCoefficients, AllRows(train), columnIndices, salesIndex);
+    double Test_MSE = LossFunction(bestCoefficients, AllRows(test), columnIndices, salesIndex);
+
+    // and R^2, adjusted for the number of predictors too
+    double Test_RSquared = RSquared(bestCoefficients, AllRows(test), columnIndices, salesIndex, dataset.testStats[salesIndex].mean);
+    double Train_RSquared = RSquared(bestCoefficients, AllRows(train), columnIndices, salesIndex, dataset.trainStats[salesIndex].mean);
+    double Test_AdjustedRSquared = AdjustedRSquared(Test_RSquared, test.data.size(), columnIndices.size());
+    double Train_AdjustedRSquared = AdjustedRSquared(Train_RSquared, train.data.size(), columnIndices.size());
 
     // Report results
-    printf("  Best coefficients = %0.4f, %0.4f, %0.4f, %0.4f  (from %zu:%zu)\n", bestCoefficients[0], bestCoefficients[1], bestCoefficients[2], bestCoefficients[3], bestCoefficientsPopulationIndex, bestCoefficientsStepIndex);
-    printf("  test/train R^2 = %f  %f\n", RSquared(bestCoefficients, test, columnIndices, salesIndex), RSquared(bestCoefficients, train, columnIndices, salesIndex));
-    printf("  test/train Adjusted R^2 = %f  %f\n", AdjustedRSquared(bestCoefficients, test, columnIndices, salesIndex), AdjustedRSquared(bestCoefficients, train, columnIndices, salesIndex));
-    printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
-    printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
-}
+    report.Printf("  Best coefficients = %0.4f, %0.4f, %0.4f, %0.4f  (from %zu:%zu)\n", bestCoefficients[0], bestCoefficients[1], bestCoefficients[2], bestCoefficients[3], bestCoefficientsPopulationIndex, bestCoefficientsStepIndex);
+    report.Printf("  test/train R^2 = %f  %f\n", Test_RSquared, Train_RSquared);
+    report.Printf("  test/train Adjusted R^2 = %f  %f\n", Test_AdjustedRSquared, Train_AdjustedRSquared);
+    if (halving)
+        report.Printf("  Successive halving: %zu rounds, %zu survivors%s\n", halvingStats.rounds, halvingStats.survivors, halvingStats.outOfBudget ? ", stopped by the budget" : "");
+    ReportConvergence(report, monitors);
+    ReportEvaluations(report, evaluator);
+    ReportCoresets(report, coresets, stats.rowsScanned);
+    report.Printf("  Line search: %0.2f loss evaluations per step over %zu steps\n", double(stats.lossEvaluations) / double(stats.searches), stats.searches);
+    report.Printf("  Training data stored as %s (%zu KB), relative loss error vs double: %0.2e\n", ScalarTypeName<TrainingScalar>(), trainingData.DataBytes() / 1024, fabs(trainingDataLoss - doubleDataLoss) / doubleDataLoss);
+    report.Printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
+    report.Printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+
+    if (!settings.traceFileName.empty() && !WriteConvergenceTrace(settings.traceFileName, monitors, evaluator.evaluations))
+        report.Printf("could not write trace %s\n", settings.traceFileName.c_str());
 
+    // structured results, for the runner
+    report.coefficients.assign(bestCoefficients.begin(), bestCoefficients.end());
+    for (int column : columnIndices)
+        report.coefficientColumns.push_back(train.headers[column]);
+    report.Value("train_rmse", sqrt(Train_MSE));
+    report.Value("test_rmse", sqrt(Test_MSE));
+    report.Value("train_r2", Train_RSquared);
+    report.Value("test_r2", Test_RSquared);
+    report.Value("train_adjusted_r2", Train_AdjustedRSquared);
+    report.Value("test_adjusted_r2", Test_AdjustedRSquared);
+}
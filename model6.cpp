@@ -1,17 +1,21 @@
 // This is for central differences, for calculating the gradient
 static const double c_epsilon = 0.001f;
 
-// The learning rate, for gradient descent
-static double c_learningRate = 1.0f;
-
-// how many steps of gradient descent are done
-static const size_t c_gradientDescentSteps = 1000;
+// The most steps of L-BFGS that are done. It stops early when it converges.
+static const size_t c_optimizerSteps = 100;
 
 // how many times should it pick a random set of parameters and do gradient descent?
 static const size_t c_population = 100;
 
+// whether to add an xy term to the fit
+static const bool c_xyTerm = false;
+
 #include "utils.h"
-#include "quadraticfit.h"
+#include "linearfit.h"
+#include "population.h"
+#include "bootstrap.h"
+#include "optimizers.h"
+#include "convergence.h"
 #include <array>
 #include <random>
 
@@ -21,122 +25,230 @@ Model 6:
 
 f(x,y) = Ax^2 + Bx + Cy^2 + Dy + E
 
+or with c_xyTerm:
+
+f(x,y) = Ax^2 + Bx + Cy^2 + Dy + Exy + F
+
 x and y are establishment year and MRP (price)
-A, B, C, D and E are coefficients that were learned through gradient descent.
+A, B, C, D and E are coefficients that were learned through L-BFGS.
 
 */
 
-void Model6(const CSV& train, const CSV& test)
+void Model6(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
 {
-    printf(__FUNCTION__ "() - Quadratic fit of Item_Outlet_Sales based on Outlet_Establishment_Year and Item_MRP\n");
+    report.Printf(__FUNCTION__ "() - Quadratic fit of Item_Outlet_Sales based on Outlet_Establishment_Year and Item_MRP\n");
+
+    // hyperparameters, which the runner can override
+    size_t population = (size_t)settings.Get("population", double(c_population));
+    size_t steps = (size_t)settings.Get("steps", double(c_optimizerSteps));
+    unsigned int seed = (unsigned int)settings.Get("seed", double(std::mt19937::default_seed));
+    size_t bootstrapCount = (size_t)settings.Get("bootstrap", 0.0f);
+    double confidence = settings.Get("confidence", 0.95f);
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
 
     // get the columns of interest
     int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
     if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
     {
-        printf("Couldn't find Item_Outlet_Sales column.\n");
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
         return;
     }
 
     int yearIndex = train.GetHeaderIndex("Outlet_Establishment_Year");
     if (yearIndex == -1 || test.GetHeaderIndex("Outlet_Establishment_Year") != yearIndex)
     {
-        printf("Couldn't find Outlet_Establishment_Year column.\n");
+        report.Fail("Couldn't find Outlet_Establishment_Year column.\n");
         return;
     }
 
     int MRPIndex = train.GetHeaderIndex("Item_MRP");
     if (MRPIndex == -1 || test.GetHeaderIndex("Item_MRP") != MRPIndex)
     {
-        printf("Couldn't find Item_MRP column.\n");
+        report.Fail("Couldn't find Item_MRP column.\n");
         return;
     }
 
-    // do gradient descent
-    // NOTE: this does the same random numbers every program run, so is deterministic, as written.
-    std::mt19937 rng;
-    std::uniform_real_distribution<double> dist(-10.0f, 10.0f);
-    std::array<int, 2> columnIndices = { yearIndex, MRPIndex };
-
-    double bestLoss = FLT_MAX;
-    std::array<double, 5> bestCoefficients;
-    size_t bestCoefficientsPopulationIndex = 0;
-    size_t bestCoefficientsStepIndex = 0;
-
-    // for each member of the population
-    for (size_t populationIndex = 0; populationIndex < c_population; ++populationIndex)
+    // expand the year and MRP columns into x^2, x, y^2, y (and xy) columns once up front, so the fit is a linear fit over them.
+    FeatureExpansion expansion;
+    expansion.columns = { yearIndex, MRPIndex };
+    expansion.degree = 2;
+    expansion.interactions = c_xyTerm;
+    expansion.valueIndex = salesIndex;
+
+    CSV trainExpanded, testExpanded, trainStandardizedExpanded;
+    ExpandFeatures(train, expansion, trainExpanded);
+    ExpandFeatures(test, expansion, testExpanded);
+    ExpandFeatures(dataset.trainStandardized, expansion, trainStandardizedExpanded);
+
+    // the fit is a linear fit over the expanded columns
+    static const size_t c_columnCount = c_xyTerm ? 5 : 4;
+    std::array<int, c_columnCount> columnIndices;
+    for (int index = 0; index < int(c_columnCount); ++index)
+        columnIndices[index] = index;
+    int expandedSalesIndex = int(expansion.ColumnCount());
+
+    // store the training data as TrainingScalar. Losses and gradients still accumulate in double.
+    CSVT<TrainingScalar> trainingData;
+    ConvertCSV(trainStandardizedExpanded, trainingData);
+
+    // the model trains on all of the training rows, except any held out to check for convergence
+    ConvergenceSettings convergence = ConvergenceFromSettings(settings);
+    DataView<TrainingScalar> trainingRows, validationRows;
+    SplitValidationRows(AllRows(trainingData), convergence, seed, trainingRows, validationRows);
+
+    // do L-BFGS, on the standardized training data
+    // NOTE: this does the same random numbers every run with the same seed, so is deterministic, as written.
+    std::mt19937 rng(seed);
+    // the data columns are standardized, so initialize the coefficients on the scale of the sales instead
+    std::uniform_real_distribution<double> dist(-dataset.standardization.scale[salesIndex], dataset.standardization.scale[salesIndex]);
+
+    // L-BFGS with a strong Wolfe line search from the member's starting coefficients, on the given rows, keeping the best coefficients seen.
+    // Each call has its own optimizer and line search, so it can run in parallel. The monitor stops it once it converges.
+    auto optimizeMonitored = [&](PopulationMember<c_columnCount + 1>& member, const DataView<TrainingScalar>& rows, ConvergenceMonitor& monitor)
     {
-        // random initialize some starting coefficients
-        std::array<double, 5> coefficients;
-        for (double& f : coefficients)
-            f = dist(rng);
+        // the fused loss and gradient function L-BFGS uses
+        auto lossAndGradient = [&](const std::array<double, c_columnCount + 1>& coefficients, std::array<double, c_columnCount + 1>& gradient)
+        {
+            return LossAndGradient(gradient, coefficients, rows, columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+        };
+
+        LineSearch lineSearch;
+        LBFGS<c_columnCount + 1> lbfgs;
 
         // keep the best coefficients seen
-        double loss = LossFunction(coefficients, train, columnIndices, salesIndex, 0.0f, 0.0f);
-        if (loss < bestLoss)
+        std::array<double, c_columnCount + 1> coefficients = member.start;
+        std::array<double, c_columnCount + 1> gradient;
+        double loss = lossAndGradient(coefficients, gradient);
+        member.Keep(coefficients, loss, 0);
+        monitor.Start(convergence, loss);
+
+        // the plain mean squared error on the held out rows
+        auto validationLoss = [&]()
         {
-            bestLoss = loss;
-            bestCoefficients = coefficients;
-            bestCoefficientsPopulationIndex = populationIndex;
-            bestCoefficientsStepIndex = 0;
-        }
+            return LossFunction(coefficients, validationRows, columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+        };
 
-        // do multiple steps of gradient descent
-        for (int i = 0; i < c_gradientDescentSteps; ++i)
+        // do multiple steps of L-BFGS, until it converges
+        for (size_t i = 0; i < steps; ++i)
         {
-            // calculate the gradient
-            std::array<double, 5> gradient;
-            CalculateGradient(gradient, coefficients, train, columnIndices, salesIndex, 0.0f, 0.0f);
-
-            // do gradient descent with an adaptive learning rate to make sure it isn't increasing the loss function
-            bool newLossWasLarger = false;
-            double newLoss = 0.0f;
-            std::array<double, 5> newCoefficients;
-            do
+            if (!lbfgs.Step(coefficients, loss, gradient, lineSearch, lossAndGradient))
             {
-                // descend
-                for (size_t index = 0; index < gradient.size(); ++index)
-                    newCoefficients[index] = coefficients[index] - gradient[index] * c_learningRate;
-
-                // keep the best coefficients seen
-                newLoss = LossFunction(newCoefficients, train, columnIndices, salesIndex, 0.0f, 0.0f);
-                if (newLoss >= loss)
-                {
-                    c_learningRate /= 10.0f;
-                    newLossWasLarger = true;
-                }
+                monitor.OptimizerStopped();
+                break;
             }
-            while (newLoss >= loss);
-            loss = newLoss;
-            coefficients = newCoefficients;
+            member.stats.steps++;
+
+            member.Keep(coefficients, loss, i + 1);
+            monitor.Offer(i + 1, loss, coefficients);
 
-            // grow the learning rate for next iteration
-            c_learningRate *= 10.0f;
+            // stop once it stops making progress
+            if (monitor.SmallGradient(gradient) || monitor.Converged(i + 1, loss, validationLoss))
+                break;
+        }
 
-            if (loss < bestLoss)
+        member.stats.searches = lineSearch.searches;
+        member.stats.lossEvaluations = lineSearch.lossEvaluations;
+    };
+    auto optimize = [&](PopulationMember<c_columnCount + 1>& member, const DataView<TrainingScalar>& rows)
+    {
+        ConvergenceMonitor monitor;
+        optimizeMonitored(member, rows, monitor);
+    };
+
+    // score the best coefficients so far on the test set during training, on a thread of its own, if asked to
+    AsyncEvaluator evaluator;
+    double evaluateInterval = EvaluateIntervalFromSettings(settings);
+    if (evaluateInterval > 0.0f)
+    {
+        evaluator.Start(c_columnCount + 1, evaluateInterval, "  " __FUNCTION__ "()",
+            [&](const std::vector<double>& snapshot, Evaluation& evaluation)
             {
-                bestLoss = loss;
-                bestCoefficients = coefficients;
-                bestCoefficientsPopulationIndex = populationIndex;
-                bestCoefficientsStepIndex = i + 1;
+                std::array<double, c_columnCount + 1> coefficients;
+                std::copy(snapshot.begin(), snapshot.end(), coefficients.begin());
+                if (validationRows.Size() > 0)
+                    evaluation.validationRMSE = sqrt(LossFunction(coefficients, validationRows, columnIndices, expandedSalesIndex, 0.0f, 0.0f));
+                UnstandardizeExpandedCoefficients(coefficients.data(), expansion, dataset.standardization);
+                evaluation.testRMSE = sqrt(LossFunction(coefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f));
             }
-        }
+        );
+    }
+
+    // initialize the starting coefficients of every member of the population, randomly unless the init setting says otherwise, and optimize them all in parallel
+    std::vector<PopulationMember<c_columnCount + 1>> members = InitialPopulation<c_columnCount + 1>(population, InitializerFromSettings(settings), rng, dist);
+    std::vector<ConvergenceMonitor> monitors = PopulationMonitors(members.size(), evaluator);
+    ParallelFor(0, members.size(), 1, [&](size_t memberIndex) { optimizeMonitored(members[memberIndex], trainingRows, monitors[memberIndex]); });
+    evaluator.Stop();
+
+    // keep the best coefficients seen by any member
+    size_t bestCoefficientsPopulationIndex = BestMember(members);
+    std::array<double, c_columnCount + 1> bestCoefficients = members[bestCoefficientsPopulationIndex].bestCoefficients;
+    size_t bestCoefficientsStepIndex = members[bestCoefficientsPopulationIndex].bestStepIndex;
+    PopulationStats stats = TotalStats(members);
+
+    // bootstrap confidence intervals, from refitting on resamples of the training rows warm started from the best fit
+    BootstrapIntervals<c_columnCount + 1> bootstrapIntervals;
+    if (bootstrapCount > 0)
+    {
+        std::vector<PopulationMember<c_columnCount + 1>> fits = BootstrapFits(trainingRows, bootstrapCount, seed, bestCoefficients, optimize);
+        bootstrapIntervals = CalculateBootstrapIntervals(fits, confidence,
+            [&](std::array<double, c_columnCount + 1>& coefficients)
+            {
+                UnstandardizeExpandedCoefficients(coefficients.data(), expansion, dataset.standardization);
+                return sqrt(LossFunction(coefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f));
+            }
+        );
     }
 
+    // compare the loss of the best coefficients on the training data with the loss at full double precision
+    double trainingDataLoss = LossFunction(bestCoefficients, AllRows(trainingData), columnIndices, expandedSalesIndex);
+    double doubleDataLoss = LossFunction(bestCoefficients, AllRows(trainStandardizedExpanded), columnIndices, expandedSalesIndex);
+
+    // describe the fit in the standardized units it was learned in, for generated code
+    DescribePolynomial(train, expansion, dataset.standardization, bestCoefficients.data(), report.polynomial);
+
+    // map the best coefficients from standardized units back to the units of the original data
+    UnstandardizeExpandedCoefficients(bestCoefficients.data(), expansion, dataset.standardization);
+
     // calculate mean squared error (average squared error) and root mean squared error from training data
-    double Train_MSE = LossFunction(bestCoefficients, train, columnIndices, salesIndex, 0.0f, 0.0f);
-    double Test_MSE = LossFunction(bestCoefficients, test, columnIndices, salesIndex, 0.0f, 0.0f);
+    double Train_MSE = LossFunction(bestCoefficients, AllRows(trainExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+    double Test_MSE = LossFunction(bestCoefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+
+    // and R^2, adjusted for the number of predictors too
+    double Test_RSquared = RSquared(bestCoefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, dataset.testStats[salesIndex].mean);
+    double Train_RSquared = RSquared(bestCoefficients, AllRows(trainExpanded), columnIndices, expandedSalesIndex, dataset.trainStats[salesIndex].mean);
+    double Test_AdjustedRSquared = AdjustedRSquared(Test_RSquared, testExpanded.data.size(), columnIndices.size());
+    double Train_AdjustedRSquared = AdjustedRSquared(Train_RSquared, trainExpanded.data.size(), columnIndices.size());
 
     // Report results
-    printf("  Best coefficients are from %zu:%zu\n", bestCoefficientsPopulationIndex, bestCoefficientsStepIndex);
+    report.Printf("  Best coefficients are from %zu:%zu\n", bestCoefficientsPopulationIndex, bestCoefficientsStepIndex);
     int i = -1;
     for (double f : bestCoefficients)
     {
         i++;
-        printf("    [%i]: %0.4f\n", i, f);
+        report.Printf("    [%i]: %0.4f\n", i, f);
     }
-    printf("  test/train R^2 = %f  %f\n", RSquared(bestCoefficients, test, columnIndices, salesIndex), RSquared(bestCoefficients, train, columnIndices, salesIndex));
-    printf("  test/train Adjusted R^2 = %f  %f\n", AdjustedRSquared(bestCoefficients, test, columnIndices, salesIndex), AdjustedRSquared(bestCoefficients, train, columnIndices, salesIndex));
-    printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
-    printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+    report.Printf("  test/train R^2 = %f  %f\n", Test_RSquared, Train_RSquared);
+    report.Printf("  test/train Adjusted R^2 = %f  %f\n", Test_AdjustedRSquared, Train_AdjustedRSquared);
+    ReportConvergence(report, monitors);
+    ReportEvaluations(report, evaluator);
+    report.Printf("  L-BFGS: %0.2f steps per population member, %0.2f loss evaluations per step\n", double(stats.steps) / double(population), double(stats.lossEvaluations) / double(stats.searches));
+    report.Printf("  Training data stored as %s (%zu KB), relative loss error vs double: %0.2e\n", ScalarTypeName<TrainingScalar>(), trainingData.DataBytes() / 1024, fabs(trainingDataLoss - doubleDataLoss) / doubleDataLoss);
+    if (bootstrapCount > 0)
+        ReportBootstrapIntervals(report, bootstrapIntervals);
+    report.Printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
+    report.Printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+
+    if (!settings.traceFileName.empty() && !WriteConvergenceTrace(settings.traceFileName, monitors, evaluator.evaluations))
+        report.Printf("could not write trace %s\n", settings.traceFileName.c_str());
+
+    // structured results, for the runner
+    report.coefficients.assign(bestCoefficients.begin(), bestCoefficients.end());
+    report.Value("train_rmse", sqrt(Train_MSE));
+    report.Value("test_rmse", sqrt(Test_MSE));
+    report.Value("train_r2", Train_RSquared);
+    report.Value("test_r2", Test_RSquared);
+    report.Value("train_adjusted_r2", Train_AdjustedRSquared);
+    report.Value("test_adjusted_r2", Test_AdjustedRSquared);
 }
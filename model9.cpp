@@ -1,21 +1,22 @@
 // This is for central differences, for calculating the gradient
 static const double c_epsilon = 0.001f;
 
-// The learning rate, for gradient descent
-static double c_learningRate = 1.0f;
-
-// how many steps of gradient descent are done
-static const size_t c_gradientDescentSteps = 1000;
+// The most steps of OWL-QN that are done. It stops early when it converges.
+static const size_t c_optimizerSteps = 100;
 
 // how many times should it pick a random set of parameters and do gradient descent?
 static const size_t c_population = 100;
 
-// L2 regularization alpha value
-static const double c_L1RegAlpha = 100000.0f;
+// regularization alpha values. These apply to the coefficients of the standardized data.
+static const double c_L1RegAlpha = 100.0f;
 static const double c_L2RegAlpha = 0.0f;
 
 #include "utils.h"
-#include "quadraticfit.h"
+#include "linearfit.h"
+#include "population.h"
+#include "bootstrap.h"
+#include "optimizers.h"
+#include "convergence.h"
 #include <array>
 #include <random>
 
@@ -26,123 +27,225 @@ Model 9:  Model 6 with lasso (L1) regression
 f(x,y) = Ax^2 + Bx + Cy^2 + Dy + E
 
 x and y are establishment year and MRP (price)
-A, B, C, D and E are coefficients that were learned through gradient descent.
+A, B, C, D and E are coefficients that were learned through OWL-QN.
 
 Ridge regression (L2 regression) means the square of the coefficients times an alpha is added into the MSE to promote smaller coefficients
 
 */
 
-void Model9(const CSV& train, const CSV& test)
+void Model9(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
 {
-    printf(__FUNCTION__ "() - Quadratic fit of Item_Outlet_Sales based on Outlet_Establishment_Year and Item_MRP, with Lasso (L1) Reg\n");
+    report.Printf(__FUNCTION__ "() - Quadratic fit of Item_Outlet_Sales based on Outlet_Establishment_Year and Item_MRP, with Lasso (L1) Reg\n");
+
+    // hyperparameters, which the runner can override
+    size_t population = (size_t)settings.Get("population", double(c_population));
+    size_t steps = (size_t)settings.Get("steps", double(c_optimizerSteps));
+    double L1RegAlpha = settings.Get("L1", c_L1RegAlpha);
+    double L2RegAlpha = settings.Get("L2", c_L2RegAlpha);
+    unsigned int seed = (unsigned int)settings.Get("seed", double(std::mt19937::default_seed));
+    size_t bootstrapCount = (size_t)settings.Get("bootstrap", 0.0f);
+    double confidence = settings.Get("confidence", 0.95f);
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
 
     // get the columns of interest
     int salesIndex = train.GetHeaderIndex("Item_Outlet_Sales");
     if (salesIndex == -1 || test.GetHeaderIndex("Item_Outlet_Sales") != salesIndex)
     {
-        printf("Couldn't find Item_Outlet_Sales column.\n");
+        report.Fail("Couldn't find Item_Outlet_Sales column.\n");
         return;
     }
 
     int yearIndex = train.GetHeaderIndex("Outlet_Establishment_Year");
     if (yearIndex == -1 || test.GetHeaderIndex("Outlet_Establishment_Year") != yearIndex)
     {
-        printf("Couldn't find Outlet_Establishment_Year column.\n");
+        report.Fail("Couldn't find Outlet_Establishment_Year column.\n");
         return;
     }
 
     int MRPIndex = train.GetHeaderIndex("Item_MRP");
     if (MRPIndex == -1 || test.GetHeaderIndex("Item_MRP") != MRPIndex)
     {
-        printf("Couldn't find Item_MRP column.\n");
+        report.Fail("Couldn't find Item_MRP column.\n");
         return;
     }
 
-    // do gradient descent
-    // NOTE: this does the same random numbers every program run, so is deterministic, as written.
-    std::mt19937 rng;
-    std::uniform_real_distribution<double> dist(-10.0f, 10.0f);
-    std::array<int, 2> columnIndices = { yearIndex, MRPIndex };
-
-    double bestLoss = FLT_MAX;
-    std::array<double, 5> bestCoefficients;
-    size_t bestCoefficientsPopulationIndex = 0;
-    size_t bestCoefficientsStepIndex = 0;
-
-    // for each member of the population
-    for (size_t populationIndex = 0; populationIndex < c_population; ++populationIndex)
+    // expand the year and MRP columns into x^2, x, y^2, y columns once up front, so the fit is a linear fit over them.
+    FeatureExpansion expansion;
+    expansion.columns = { yearIndex, MRPIndex };
+    expansion.degree = 2;
+    expansion.interactions = false;
+    expansion.valueIndex = salesIndex;
+
+    CSV trainExpanded, testExpanded, trainStandardizedExpanded;
+    ExpandFeatures(train, expansion, trainExpanded);
+    ExpandFeatures(test, expansion, testExpanded);
+    ExpandFeatures(dataset.trainStandardized, expansion, trainStandardizedExpanded);
+
+    std::array<int, 4> columnIndices = { 0, 1, 2, 3 };
+    int expandedSalesIndex = int(expansion.ColumnCount());
+
+    // store the training data as TrainingScalar. Losses and gradients still accumulate in double.
+    CSVT<TrainingScalar> trainingData;
+    ConvertCSV(trainStandardizedExpanded, trainingData);
+
+    // the model trains on all of the training rows, except any held out to check for convergence
+    ConvergenceSettings convergence = ConvergenceFromSettings(settings);
+    DataView<TrainingScalar> trainingRows, validationRows;
+    SplitValidationRows(AllRows(trainingData), convergence, seed, trainingRows, validationRows);
+
+    // do OWL-QN, on the standardized training data
+    // NOTE: this does the same random numbers every run with the same seed, so is deterministic, as written.
+    std::mt19937 rng(seed);
+    // the data columns are standardized, so initialize the coefficients on the scale of the sales instead
+    std::uniform_real_distribution<double> dist(-dataset.standardization.scale[salesIndex], dataset.standardization.scale[salesIndex]);
+
+    // OWL-QN from the member's starting coefficients, on the given rows, keeping the best coefficients seen.
+    // Each call has its own optimizer and line search, so it can run in parallel. The monitor stops it once it converges.
+    auto optimizeMonitored = [&](PopulationMember<5>& member, const DataView<TrainingScalar>& rows, ConvergenceMonitor& monitor)
     {
-        // random initialize some starting coefficients
-        std::array<double, 5> coefficients;
-        for (double& f : coefficients)
-            f = dist(rng);
+        // the loss and gradient function OWL-QN uses. The L1 term is left out of the loss and gradient since OWL-QN handles it.
+        auto smoothLossAndGradient = [&](const std::array<double, 5>& coefficients, std::array<double, 5>& gradient)
+        {
+            return LossAndGradient(gradient, coefficients, rows, columnIndices, expandedSalesIndex, 0.0f, L2RegAlpha);
+        };
+
+        LineSearch lineSearch;
+        OWLQN<5> owlqn;
 
         // keep the best coefficients seen
-        double loss = LossFunction(coefficients, train, columnIndices, salesIndex, c_L1RegAlpha, c_L2RegAlpha);
-        if (loss < bestLoss)
+        std::array<double, 5> coefficients = member.start;
+        std::array<double, 5> gradient;
+        double loss = OWLQN<5>::FullLoss(coefficients, smoothLossAndGradient(coefficients, gradient), L1RegAlpha);
+        member.Keep(coefficients, loss, 0);
+        monitor.Start(convergence, loss);
+
+        // the plain mean squared error on the held out rows
+        auto validationLoss = [&]()
         {
-            bestLoss = loss;
-            bestCoefficients = coefficients;
-            bestCoefficientsPopulationIndex = populationIndex;
-            bestCoefficientsStepIndex = 0;
-        }
+            return LossFunction(coefficients, validationRows, columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+        };
 
-        // do multiple steps of gradient descent
-        for (int i = 0; i < c_gradientDescentSteps; ++i)
+        // do multiple steps of OWL-QN, until it converges
+        for (size_t i = 0; i < steps; ++i)
         {
-            // calculate the gradient
-            std::array<double, 5> gradient;
-            CalculateGradient(gradient, coefficients, train, columnIndices, salesIndex, c_L1RegAlpha, c_L2RegAlpha);
-
-            // do gradient descent with an adaptive learning rate to make sure it isn't increasing the loss function
-            bool newLossWasLarger = false;
-            double newLoss = 0.0f;
-            std::array<double, 5> newCoefficients;
-            do
+            if (!owlqn.Step(coefficients, loss, gradient, L1RegAlpha, lineSearch, smoothLossAndGradient))
             {
-                // descend
-                for (size_t index = 0; index < gradient.size(); ++index)
-                    newCoefficients[index] = coefficients[index] - gradient[index] * c_learningRate;
-
-                // keep the best coefficients seen
-                newLoss = LossFunction(newCoefficients, train, columnIndices, salesIndex, c_L1RegAlpha, c_L2RegAlpha);
-                if (newLoss >= loss)
-                {
-                    c_learningRate /= 10.0f;
-                    newLossWasLarger = true;
-                }
+                monitor.OptimizerStopped();
+                break;
             }
-            while (newLoss >= loss);
-            loss = newLoss;
-            coefficients = newCoefficients;
+            member.stats.steps++;
+
+            member.Keep(coefficients, loss, i + 1);
+            monitor.Offer(i + 1, loss, coefficients);
+
+            // stop once it stops making progress. The gradient doesn't go to zero at an L1 optimum, so it isn't checked.
+            if (monitor.Converged(i + 1, loss, validationLoss))
+                break;
+        }
 
-            // grow the learning rate for next iteration
-            c_learningRate *= 10.0f;
+        member.stats.searches = lineSearch.searches;
+        member.stats.lossEvaluations = lineSearch.lossEvaluations;
+    };
+    auto optimize = [&](PopulationMember<5>& member, const DataView<TrainingScalar>& rows)
+    {
+        ConvergenceMonitor monitor;
+        optimizeMonitored(member, rows, monitor);
+    };
+
+    // score the best coefficients so far on the test set during training, on a thread of its own, if asked to
+    AsyncEvaluator evaluator;
+    double evaluateInterval = EvaluateIntervalFromSettings(settings);
+    if (evaluateInterval > 0.0f)
+    {
+        evaluator.Start(5, evaluateInterval, "  " __FUNCTION__ "()",
+            [&](const std::vector<double>& snapshot, Evaluation& evaluation)
+            {
+                std::array<double, 5> coefficients;
+                std::copy(snapshot.begin(), snapshot.end(), coefficients.begin());
+                if (validationRows.Size() > 0)
+                    evaluation.validationRMSE = sqrt(LossFunction(coefficients, validationRows, columnIndices, expandedSalesIndex, 0.0f, 0.0f));
+                UnstandardizeExpandedCoefficients(coefficients.data(), expansion, dataset.standardization);
+                evaluation.testRMSE = sqrt(LossFunction(coefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f));
+            }
+        );
+    }
 
-            if (loss < bestLoss)
+    // initialize the starting coefficients of every member of the population, randomly unless the init setting says otherwise, and optimize them all in parallel
+    std::vector<PopulationMember<5>> members = InitialPopulation<5>(population, InitializerFromSettings(settings), rng, dist);
+    std::vector<ConvergenceMonitor> monitors = PopulationMonitors(members.size(), evaluator);
+    ParallelFor(0, members.size(), 1, [&](size_t memberIndex) { optimizeMonitored(members[memberIndex], trainingRows, monitors[memberIndex]); });
+    evaluator.Stop();
+
+    // keep the best coefficients seen by any member
+    size_t bestCoefficientsPopulationIndex = BestMember(members);
+    std::array<double, 5> bestCoefficients = members[bestCoefficientsPopulationIndex].bestCoefficients;
+    size_t bestCoefficientsStepIndex = members[bestCoefficientsPopulationIndex].bestStepIndex;
+    PopulationStats stats = TotalStats(members);
+
+    // bootstrap confidence intervals, from refitting on resamples of the training rows warm started from the best fit
+    BootstrapIntervals<5> bootstrapIntervals;
+    if (bootstrapCount > 0)
+    {
+        std::vector<PopulationMember<5>> fits = BootstrapFits(trainingRows, bootstrapCount, seed, bestCoefficients, optimize);
+        bootstrapIntervals = CalculateBootstrapIntervals(fits, confidence,
+            [&](std::array<double, 5>& coefficients)
             {
-                bestLoss = loss;
-                bestCoefficients = coefficients;
-                bestCoefficientsPopulationIndex = populationIndex;
-                bestCoefficientsStepIndex = i + 1;
+                UnstandardizeExpandedCoefficients(coefficients.data(), expansion, dataset.standardization);
+                return sqrt(LossFunction(coefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f));
             }
-        }
+        );
     }
 
+    // compare the loss of the best coefficients on the training data with the loss at full double precision
+    double trainingDataLoss = LossFunction(bestCoefficients, AllRows(trainingData), columnIndices, expandedSalesIndex);
+    double doubleDataLoss = LossFunction(bestCoefficients, AllRows(trainStandardizedExpanded), columnIndices, expandedSalesIndex);
+
+    // describe the fit in the standardized units it was learned in, for generated code
+    DescribePolynomial(train, expansion, dataset.standardization, bestCoefficients.data(), report.polynomial);
+
+    // map the best coefficients from standardized units back to the units of the original data
+    UnstandardizeExpandedCoefficients(bestCoefficients.data(), expansion, dataset.standardization);
+
     // calculate mean squared error (average squared error) and root mean squared error from training data
-    double Train_MSE = LossFunction(bestCoefficients, train, columnIndices, salesIndex, c_L1RegAlpha, c_L2RegAlpha);
-    double Test_MSE = LossFunction(bestCoefficients, test, columnIndices, salesIndex, c_L1RegAlpha, c_L2RegAlpha);
+    double Train_MSE = LossFunction(bestCoefficients, AllRows(trainExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+    double Test_MSE = LossFunction(bestCoefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, 0.0f, 0.0f);
+
+    // and R^2, adjusted for the number of predictors too
+    double Test_RSquared = RSquared(bestCoefficients, AllRows(testExpanded), columnIndices, expandedSalesIndex, dataset.testStats[salesIndex].mean);
+    double Train_RSquared = RSquared(bestCoefficients, AllRows(trainExpanded), columnIndices, expandedSalesIndex, dataset.trainStats[salesIndex].mean);
+    double Test_AdjustedRSquared = AdjustedRSquared(Test_RSquared, testExpanded.data.size(), columnIndices.size());
+    double Train_AdjustedRSquared = AdjustedRSquared(Train_RSquared, trainExpanded.data.size(), columnIndices.size());
 
     // Report results
-    printf("  Best coefficients are from %zu:%zu\n", bestCoefficientsPopulationIndex, bestCoefficientsStepIndex);
+    report.Printf("  Best coefficients are from %zu:%zu\n", bestCoefficientsPopulationIndex, bestCoefficientsStepIndex);
     int i = -1;
     for (double f : bestCoefficients)
     {
         i++;
-        printf("    [%i]: %0.4f\n", i, f);
+        report.Printf("    [%i]: %0.4f\n", i, f);
     }
-    printf("  test/train R^2 = %f  %f\n", RSquared(bestCoefficients, test, columnIndices, salesIndex), RSquared(bestCoefficients, train, columnIndices, salesIndex));
-    printf("  test/train Adjusted R^2 = %f  %f\n", AdjustedRSquared(bestCoefficients, test, columnIndices, salesIndex), AdjustedRSquared(bestCoefficients, train, columnIndices, salesIndex));
-    printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
-    printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+    report.Printf("  test/train R^2 = %f  %f\n", Test_RSquared, Train_RSquared);
+    report.Printf("  test/train Adjusted R^2 = %f  %f\n", Test_AdjustedRSquared, Train_AdjustedRSquared);
+    ReportConvergence(report, monitors);
+    ReportEvaluations(report, evaluator);
+    report.Printf("  OWL-QN: %0.2f steps per population member, %0.2f loss evaluations per step\n", double(stats.steps) / double(population), double(stats.lossEvaluations) / double(stats.searches));
+    report.Printf("  Training data stored as %s (%zu KB), relative loss error vs double: %0.2e\n", ScalarTypeName<TrainingScalar>(), trainingData.DataBytes() / 1024, fabs(trainingDataLoss - doubleDataLoss) / doubleDataLoss);
+    if (bootstrapCount > 0)
+        ReportBootstrapIntervals(report, bootstrapIntervals);
+    report.Printf("  RMSE on training set: %0.2f\n", sqrt(Train_MSE));
+    report.Printf("  RMSE on test set: %0.2f\n\n", sqrt(Test_MSE));
+
+    if (!settings.traceFileName.empty() && !WriteConvergenceTrace(settings.traceFileName, monitors, evaluator.evaluations))
+        report.Printf("could not write trace %s\n", settings.traceFileName.c_str());
+
+    // structured results, for the runner
+    report.coefficients.assign(bestCoefficients.begin(), bestCoefficients.end());
+    report.Value("train_rmse", sqrt(Train_MSE));
+    report.Value("test_rmse", sqrt(Test_MSE));
+    report.Value("train_r2", Train_RSquared);
+    report.Value("test_r2", Test_RSquared);
+    report.Value("train_adjusted_r2", Train_AdjustedRSquared);
+    report.Value("test_adjusted_r2", Test_AdjustedRSquared);
 }
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <array>
+#include <math.h>
+#include "utils.h"
+#include "linesearch.h"
+
+/*
+
+Second order optimizers, to converge in tens of iterations instead of thousands of gradient descent steps.
+
+* LBFGS - a quasi newton method. Builds an approximation of the inverse hessian out of the last M steps and gradient changes.
+  Uses the strong Wolfe line search, which guarantees the curvature information it gathers is usable.
+* OWLQN - L-BFGS modified for L1 regularization (Andrew & Gao 2007). The L1 term isn't differentiable at 0, so it uses a
+  "pseudo gradient" and keeps each step inside one orthant, letting coefficients land exactly on 0.
+* LevenbergMarquardt - Gauss-Newton with damping. Solves (H + damping * diag(H)) step = -gradient each iteration. The fits are
+  linear in their coefficients, so undamped Gauss-Newton would solve them in a single step. The damping and the diagonal
+  scaling keep it stable when the problem is badly conditioned, like the cubic fit.
+
+All of them use the fused loss and gradient kernels from the fit headers.
+
+*/
+
+// Solves A x = b using a Cholesky decomposition. A must be symmetric positive definite; returns false if it isn't.
+template <size_t N>
+bool SolveCholesky(std::array<double, N>& x, std::array<std::array<double, N>, N> A, const std::array<double, N>& b)
+{
+    // decompose A into L L^T, storing L in the lower triangle of A
+    for (size_t j = 0; j < N; ++j)
+    {
+        double diagonal = A[j][j];
+        for (size_t k = 0; k < j; ++k)
+            diagonal -= A[j][k] * A[j][k];
+        if (!(diagonal > 0.0f))
+            return false;
+        A[j][j] = sqrt(diagonal);
+
+        for (size_t i = j + 1; i < N; ++i)
+        {
+            double value = A[i][j];
+            for (size_t k = 0; k < j; ++k)
+                value -= A[i][k] * A[j][k];
+            A[i][j] = value / A[j][j];
+        }
+    }
+
+    // solve L y = b
+    for (size_t i = 0; i < N; ++i)
+    {
+        double value = b[i];
+        for (size_t k = 0; k < i; ++k)
+            value -= A[i][k] * x[k];
+        x[i] = value / A[i][i];
+    }
+
+    // solve L^T x = y
+    for (size_t i = N; i-- > 0;)
+    {
+        double value = x[i];
+        for (size_t k = i + 1; k < N; ++k)
+            value -= A[k][i] * x[k];
+        x[i] = value / A[i][i];
+    }
+
+    return true;
+}
+
+template <size_t N, size_t M = 8>
+struct LBFGS
+{
+    // Call this when starting a new optimization, like for a new population member
+    void Restart()
+    {
+        historyCount = 0;
+        historyNext = 0;
+    }
+
+    size_t HistoryCount() const
+    {
+        return historyCount;
+    }
+
+    // Calculates direction = -H * vector, where H is the approximate inverse hessian.
+    // This is the L-BFGS "two loop recursion".
+    void CalculateDirection(std::array<double, N>& direction, const std::array<double, N>& vector) const
+    {
+        std::array<double, M> alpha;
+        std::array<double, N> q = vector;
+
+        // newest to oldest
+        for (size_t n = 0; n < historyCount; ++n)
+        {
+            size_t index = (historyNext + M - 1 - n) % M;
+            alpha[index] = rho[index] * Dot(s[index], q);
+            for (size_t i = 0; i < N; ++i)
+                q[i] -= alpha[index] * y[index][i];
+        }
+
+        // scale by the initial inverse hessian guess, s^T y / y^T y from the newest step
+        if (historyCount > 0)
+        {
+            size_t newest = (historyNext + M - 1) % M;
+            double gamma = Dot(s[newest], y[newest]) / Dot(y[newest], y[newest]);
+            for (double& f : q)
+                f *= gamma;
+        }
+
+        // oldest to newest
+        for (size_t n = historyCount; n-- > 0;)
+        {
+            size_t index = (historyNext + M - 1 - n) % M;
+            double beta = rho[index] * Dot(y[index], q);
+            for (size_t i = 0; i < N; ++i)
+                q[i] += s[index][i] * (alpha[index] - beta);
+        }
+
+        for (size_t i = 0; i < N; ++i)
+            direction[i] = -q[i];
+    }
+
+    // Remember a step and the change in gradient it caused. Skipped if it has no usable curvature information.
+    void AddHistory(const std::array<double, N>& oldCoefficients, const std::array<double, N>& newCoefficients, const std::array<double, N>& oldGradient, const std::array<double, N>& newGradient)
+    {
+        std::array<double, N> newS, newY;
+        for (size_t i = 0; i < N; ++i)
+        {
+            newS[i] = newCoefficients[i] - oldCoefficients[i];
+            newY[i] = newGradient[i] - oldGradient[i];
+        }
+
+        double sy = Dot(newS, newY);
+        if (!(sy > 1e-10f * Dot(newY, newY)))
+            return;
+
+        s[historyNext] = newS;
+        y[historyNext] = newY;
+        rho[historyNext] = 1.0f / sy;
+        historyNext = (historyNext + 1) % M;
+        if (historyCount < M)
+            historyCount++;
+    }
+
+    // Take a single step. coefficients, loss and gradient are updated to the new point.
+    // lossAndGradient(coefficients, gradient) returns the loss and fills out the gradient.
+    // Returns false when no more progress can be made.
+    template <typename LOSS_AND_GRADIENT>
+    bool Step(std::array<double, N>& coefficients, double& loss, std::array<double, N>& gradient, LineSearch& lineSearch, const LOSS_AND_GRADIENT& lossAndGradient)
+    {
+        std::array<double, N> oldCoefficients = coefficients;
+        std::array<double, N> oldGradient = gradient;
+
+        if (!LineSearchStep(coefficients, loss, gradient, lineSearch, lossAndGradient))
+        {
+            // if the history has gone bad, forget it and try again from steepest descent
+            if (historyCount == 0)
+                return false;
+            Restart();
+            if (!LineSearchStep(coefficients, loss, gradient, lineSearch, lossAndGradient))
+                return false;
+        }
+
+        AddHistory(oldCoefficients, coefficients, oldGradient, gradient);
+        return true;
+    }
+
+private:
+    template <typename LOSS_AND_GRADIENT>
+    bool LineSearchStep(std::array<double, N>& coefficients, double& loss, std::array<double, N>& gradient, LineSearch& lineSearch, const LOSS_AND_GRADIENT& lossAndGradient)
+    {
+        std::array<double, N> direction;
+        CalculateDirection(direction, gradient);
+
+        // A quasi newton direction is already scaled, so a step of 1 is the natural first guess.
+        // Without history it's just the negative gradient, so start with a step that moves a distance of 1.
+        lineSearch.Restart(historyCount > 0 ? 1.0f : 1.0f / sqrt(Dot(gradient, gradient)));
+        return lineSearch.StrongWolfe(coefficients, loss, gradient, direction, lossAndGradient);
+    }
+
+    std::array<std::array<double, N>, M> s;
+    std::array<std::array<double, N>, M> y;
+    std::array<double, M> rho;
+    size_t historyCount = 0;
+    size_t historyNext = 0;
+};
+
+template <size_t N, size_t M = 8>
+struct OWLQN
+{
+    // Call this when starting a new optimization, like for a new population member
+    void Restart()
+    {
+        lbfgs.Restart();
+    }
+
+    // The loss including the L1 term, from the loss without it
+    static double FullLoss(const std::array<double, N>& coefficients, double smoothLoss, double L1RegAlpha)
+    {
+        double L1RegSum = 0.0f;
+        for (double f : coefficients)
+            L1RegSum += abs(f);
+        return smoothLoss + L1RegSum * L1RegAlpha;
+    }
+
+    // Take a single step. coefficients, loss and gradient are updated to the new point.
+    // smoothLossAndGradient(coefficients, gradient) returns the loss and fills out the gradient, without the L1 term.
+    // loss includes the L1 term (see FullLoss) and gradient does not.
+    // Returns false when no more progress can be made.
+    template <typename SMOOTH_LOSS_AND_GRADIENT>
+    bool Step(std::array<double, N>& coefficients, double& loss, std::array<double, N>& gradient, double L1RegAlpha, LineSearch& lineSearch, const SMOOTH_LOSS_AND_GRADIENT& smoothLossAndGradient)
+    {
+        // The pseudo gradient is the gradient of the full loss where it exists.
+        // At 0 it is the one sided derivative that goes downhill, or 0 if neither side does.
+        std::array<double, N> pseudoGradient;
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (coefficients[i] > 0.0f)
+                pseudoGradient[i] = gradient[i] + L1RegAlpha;
+            else if (coefficients[i] < 0.0f)
+                pseudoGradient[i] = gradient[i] - L1RegAlpha;
+            else if (gradient[i] + L1RegAlpha < 0.0f)
+                pseudoGradient[i] = gradient[i] + L1RegAlpha;
+            else if (gradient[i] - L1RegAlpha > 0.0f)
+                pseudoGradient[i] = gradient[i] - L1RegAlpha;
+            else
+                pseudoGradient[i] = 0.0f;
+        }
+
+        // the quasi newton direction, with any component that goes uphill according to the pseudo gradient zeroed out
+        std::array<double, N> direction;
+        lbfgs.CalculateDirection(direction, pseudoGradient);
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (direction[i] * pseudoGradient[i] >= 0.0f)
+                direction[i] = 0.0f;
+        }
+
+        double slope = Dot(direction, pseudoGradient);
+        if (!(slope < 0.0f))
+            return false;
+
+        // the orthant the step has to stay in
+        std::array<double, N> orthant;
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (coefficients[i] != 0.0f)
+                orthant[i] = (coefficients[i] > 0.0f) ? 1.0f : -1.0f;
+            else
+                orthant[i] = (pseudoGradient[i] < 0.0f) ? 1.0f : -1.0f;
+        }
+
+        // backtracking line search, projecting each probe back onto the orthant
+        lineSearch.searches++;
+        double alpha = (lbfgs.HistoryCount() > 0) ? 1.0f : 1.0f / sqrt(Dot(pseudoGradient, pseudoGradient));
+        std::array<double, N> newCoefficients, newGradient;
+        for (int probe = 0; probe < lineSearch.maxProbes; ++probe)
+        {
+            for (size_t i = 0; i < N; ++i)
+            {
+                newCoefficients[i] = coefficients[i] + direction[i] * alpha;
+                if (newCoefficients[i] * orthant[i] <= 0.0f)
+                    newCoefficients[i] = 0.0f;
+            }
+
+            double newLoss = FullLoss(newCoefficients, smoothLossAndGradient(newCoefficients, newGradient), L1RegAlpha);
+            lineSearch.lossEvaluations++;
+            lineSearch.gradientEvaluations++;
+
+            double decrease = 0.0f;
+            for (size_t i = 0; i < N; ++i)
+                decrease += pseudoGradient[i] * (newCoefficients[i] - coefficients[i]);
+
+            if (newLoss <= loss + lineSearch.c1 * decrease)
+            {
+                lbfgs.AddHistory(coefficients, newCoefficients, gradient, newGradient);
+                coefficients = newCoefficients;
+                gradient = newGradient;
+                loss = newLoss;
+                return true;
+            }
+
+            alpha *= 0.5f;
+        }
+
+        lineSearch.failures++;
+        return false;
+    }
+
+private:
+    LBFGS<N, M> lbfgs;
+};
+
+template <size_t N>
+struct LevenbergMarquardt
+{
+    // how much to damp the Gauss-Newton step. Adapts as it goes: smaller after a good step, larger after a bad one.
+    double damping = 1e-3f;
+    double minDamping = 1e-12f;
+    double maxDamping = 1e10f;
+
+    // stop when a step is predicted to lower the loss by less than this fraction of the loss
+    double tolerance = 1e-12f;
+
+    // stats
+    size_t lossEvaluations = 0;
+    size_t hessianEvaluations = 0;
+
+    // Call this when starting a new optimization, like for a new population member
+    void Restart(double initialDamping)
+    {
+        damping = initialDamping;
+    }
+
+    // Take a single step. coefficients and loss are updated to the new point.
+    // lossGradientAndHessian(coefficients, gradient, hessian) returns the loss and fills out the gradient and hessian.
+    // lossFunction(coefficients) returns the loss.
+    // Returns false when no more progress can be made.
+    template <typename LOSS_GRADIENT_AND_HESSIAN, typename LOSS_FUNCTION>
+    bool Step(std::array<double, N>& coefficients, double& loss, const LOSS_GRADIENT_AND_HESSIAN& lossGradientAndHessian, const LOSS_FUNCTION& lossFunction)
+    {
+        std::array<double, N> gradient;
+        std::array<std::array<double, N>, N> hessian;
+        loss = lossGradientAndHessian(coefficients, gradient, hessian);
+        hessianEvaluations++;
+
+        // Scale the problem by the diagonal of the hessian. Powers of the data columns have wildly different magnitudes,
+        // and this makes the system much better conditioned. It's the same as damping by diag(H).
+        std::array<double, N> scale;
+        for (size_t i = 0; i < N; ++i)
+            scale[i] = (hessian[i][i] > 0.0f) ? 1.0f / sqrt(hessian[i][i]) : 1.0f;
+
+        std::array<std::array<double, N>, N> A;
+        std::array<double, N> b;
+        for (size_t i = 0; i < N; ++i)
+        {
+            for (size_t j = 0; j < N; ++j)
+                A[i][j] = hessian[i][j] * scale[i] * scale[j];
+            b[i] = -gradient[i] * scale[i];
+        }
+
+        while (damping < maxDamping)
+        {
+            std::array<std::array<double, N>, N> dampedA = A;
+            for (size_t i = 0; i < N; ++i)
+                dampedA[i][i] += damping;
+
+            std::array<double, N> step;
+            if (SolveCholesky(step, dampedA, b))
+            {
+                // the decrease in loss that the quadratic model predicts. If it's tiny, we've converged.
+                std::array<double, N> Astep;
+                for (size_t i = 0; i < N; ++i)
+                    Astep[i] = Dot(A[i], step);
+                double predictedDecrease = Dot(b, step) - 0.5f * Dot(step, Astep);
+                if (predictedDecrease <= tolerance * loss)
+                    return false;
+
+                std::array<double, N> newCoefficients;
+                for (size_t i = 0; i < N; ++i)
+                    newCoefficients[i] = coefficients[i] + step[i] * scale[i];
+
+                double newLoss = lossFunction(newCoefficients);
+                lossEvaluations++;
+                if (newLoss < loss)
+                {
+                    coefficients = newCoefficients;
+                    loss = newLoss;
+                    damping = (damping * 0.1f > minDamping) ? damping * 0.1f : minDamping;
+                    return true;
+                }
+            }
+
+            damping *= 10.0f;
+        }
+
+        return false;
+    }
+};
@@ -0,0 +1,161 @@
+#include "packed.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+// words with up to this many bits set visit the bits one by one, instead of going through all 64 rows. The bits mark the less
+// common value, so a word is rarely any denser than this.
+static const size_t c_sparseWordBits = 32;
+
+namespace
+{
+    // the index of the lowest bit set in the word, which isn't 0
+    size_t LowestBit(uint64_t word)
+    {
+#ifdef _WIN32
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return size_t(index);
+#else
+        return size_t(__builtin_ctzll(word));
+#endif
+    }
+
+    // the values of a column for the rows of a tile
+    void TileValues(const PackedColumns& data, size_t column, size_t rowBegin, size_t rowEnd, double* values)
+    {
+        if (!data.isBits[column])
+        {
+            std::copy(&data.values[column][rowBegin], &data.values[column][0] + rowEnd, values);
+            return;
+        }
+
+        std::fill(values, values + (rowEnd - rowBegin), data.unset[column]);
+        double delta = data.set[column] - data.unset[column];
+        for (size_t rowIndex = rowBegin; rowIndex < rowEnd; rowIndex += 64)
+            MaskedAdd(data.bits[column][rowIndex / 64], delta, values + (rowIndex - rowBegin));
+    }
+
+    // calls f(rowBegin, rowEnd) for every tile of the rows, in parallel, and sums up what they give
+    template <typename T, typename F, typename COMBINE>
+    T ParallelTiles(size_t rowCount, const T& identity, const F& f, const COMBINE& combine)
+    {
+        size_t tileCount = (rowCount + c_packedTileRows - 1) / c_packedTileRows;
+        return ParallelReduce(size_t(0), tileCount, 8, identity,
+            [&](size_t tileBegin, size_t tileEnd, T& partial)
+            {
+                for (size_t tile = tileBegin; tile < tileEnd; ++tile)
+                    f(tile * c_packedTileRows, std::min((tile + 1) * c_packedTileRows, rowCount), partial);
+            },
+            combine
+        );
+    }
+}
+
+size_t PopCount(uint64_t word)
+{
+#ifdef _WIN32
+    return size_t(__popcnt64(word));
+#else
+    return size_t(__builtin_popcountll(word));
+#endif
+}
+
+void MaskedAdd(uint64_t word, double delta, double* values)
+{
+    size_t count = PopCount(word);
+    if (count == 0)
+        return;
+
+    if (count <= c_sparseWordBits)
+    {
+        for (; word != 0; word &= word - 1)
+            values[LowestBit(word)] += delta;
+        return;
+    }
+
+    // rows past the end of the data have no bits set, so they're only ever added 0
+    for (size_t bit = 0; bit < 64; ++bit)
+        values[bit] += delta * double((word >> bit) & 1);
+}
+
+void PredictPacked(const PackedColumns& data, const std::vector<int>& columns, const double* coefficients, size_t rowBegin, size_t rowEnd, double* predictions)
+{
+    // the unset values of the bit columns are the same for every row, so they go into the constant
+    double constant = coefficients[columns.size()];
+    for (size_t index = 0; index < columns.size(); ++index)
+    {
+        if (data.isBits[columns[index]])
+            constant += coefficients[index] * data.unset[columns[index]];
+    }
+
+    size_t rowCount = rowEnd - rowBegin;
+    std::fill(predictions, predictions + rowCount, constant);
+    for (size_t index = 0; index < columns.size(); ++index)
+    {
+        size_t column = columns[index];
+        double coefficient = coefficients[index];
+        if (data.isBits[column])
+        {
+            double delta = coefficient * (data.set[column] - data.unset[column]);
+            if (delta == 0.0f)
+                continue;
+            for (size_t rowIndex = rowBegin; rowIndex < rowEnd; rowIndex += 64)
+                MaskedAdd(data.bits[column][rowIndex / 64], delta, predictions + (rowIndex - rowBegin));
+        }
+        else
+        {
+            const double* values = &data.values[column][rowBegin];
+            for (size_t row = 0; row < rowCount; ++row)
+                predictions[row] += coefficient * values[row];
+        }
+    }
+}
+
+double PackedLoss(const PackedColumns& data, const std::vector<int>& columns, const double* coefficients, int valueIndex)
+{
+    // the tiles are padded to a whole word, so a masked add on the last one stays in bounds. The padding is 0, since the
+    // dense path of a masked add reads it.
+    double squaredErrorSum = ParallelTiles(data.rowCount, 0.0,
+        [&](size_t rowBegin, size_t rowEnd, double& sum)
+        {
+            double predictions[c_packedTileRows] = {};
+            double actual[c_packedTileRows] = {};
+            PredictPacked(data, columns, coefficients, rowBegin, rowEnd, predictions);
+            TileValues(data, valueIndex, rowBegin, rowEnd, actual);
+            for (size_t row = 0; row < rowEnd - rowBegin; ++row)
+                sum += sqr(predictions[row] - actual[row]);
+        },
+        [](double& result, double partial) { result += partial; }
+    );
+    return squaredErrorSum / double(data.rowCount);
+}
+
+void PackedGradient(const PackedColumns& data, const std::vector<int>& columns, const double* coefficients, int valueIndex, double epsilon, double* gradient)
+{
+    // central differences, like CalculateGradient, so packing the rows doesn't change how the optimizer steps
+    std::vector<double> shifted(coefficients, coefficients + columns.size() + 1);
+    for (size_t index = 0; index <= columns.size(); ++index)
+    {
+        shifted[index] = coefficients[index] - epsilon;
+        double A = PackedLoss(data, columns, shifted.data(), valueIndex);
+
+        shifted[index] = coefficients[index] + epsilon;
+        double B = PackedLoss(data, columns, shifted.data(), valueIndex);
+
+        shifted[index] = coefficients[index];
+        gradient[index] = (B - A) / (2.0f * epsilon);
+    }
+}
+
+void ReportPackedColumns(ModelReport& report, const PackedColumns& data, size_t unpackedBytes)
+{
+    report.Printf("  Packed columns: %zu of %zu columns stored as bits, %zu KB instead of %zu KB\n",
+        data.BitColumnCount(), data.headers.size(), data.DataBytes() / 1024, unpackedBytes / 1024);
+    report.Value("packed_bit_columns", double(data.BitColumnCount()));
+    report.Value("packed_bytes", double(data.DataBytes()));
+}
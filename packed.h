@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Packed columns: rows stored a column at a time, with every column that only takes two values stored as one bit per row.
+
+Most of the columns are one hot, so a row stored as doubles is mostly 8 byte zeros and ones. A column that only takes two
+values (0 and 1, or what 0 and 1 become once standardized) is stored as a bit vector, 64 rows to a word, with its two values
+on the side. The bits mark the rows with the less common of the two values, so at most half of them are set, and usually far
+fewer. The other columns are stored as doubles. Which is which is found when the rows are packed, so nothing needs to know
+ahead of time.
+
+The kernels work on tiles of rows, 64 rows per word of bits:
+
+* A bit column's part of a linear model is coefficient * unset for every row, which folds into the constant, plus
+  coefficient * (set - unset) on the rows where the bit is set. That is a masked add into the tile's predictions.
+* Group keys made of one hot columns are built straight from the bits, a digit per column, without looking at the rows.
+
+Packing only changes how the rows are stored. The gradient is central differences of the packed loss, the same as
+CalculateGradient does on unpacked rows, so a fit takes the same steps either way.
+
+A masked add looks at the popcount of the word first. Words with no bits set are skipped, and the usual sparse words
+visit their set bits one by one, so a row only costs as much as the bits it has set instead of a multiply add per column.
+The rare words with more than half of their bits set go through all 64 rows with a multiply by the bit instead, which has
+no branches. Group keys are built the same way, branch free, a whole tile at a time.
+
+*/
+
+// how many rows the kernels work on at a time. A multiple of 64.
+static const size_t c_packedTileRows = 256;
+
+struct PackedColumns
+{
+    size_t rowCount = 0;
+    std::vector<std::string> headers;
+
+    // per column: if it's stored as bits, and the values of the rows whose bit isn't set and is
+    std::vector<bool> isBits;
+    std::vector<double> unset;
+    std::vector<double> set;
+
+    // per column, the bits of a bit column, or the values of any other column. The other one is empty.
+    std::vector<std::vector<uint64_t>> bits;
+    std::vector<std::vector<double>> values;
+
+    size_t BitColumnCount() const
+    {
+        size_t count = 0;
+        for (bool b : isBits)
+            count += b ? 1 : 0;
+        return count;
+    }
+
+    size_t DataBytes() const
+    {
+        size_t bytes = 0;
+        for (size_t column = 0; column < headers.size(); ++column)
+            bytes += bits[column].size() * sizeof(uint64_t) + values[column].size() * sizeof(double);
+        return bytes;
+    }
+
+    // the value of a row, whichever way its column is stored
+    double Value(size_t column, size_t rowIndex) const
+    {
+        if (!isBits[column])
+            return values[column][rowIndex];
+        return ((bits[column][rowIndex / 64] >> (rowIndex % 64)) & 1) ? set[column] : unset[column];
+    }
+};
+
+// Packs the rows of the view, storing every column that takes no more than two values as bits
+template <typename T>
+void PackColumns(const DataView<T>& data, PackedColumns& packed)
+{
+    size_t rowCount = data.Size();
+    size_t columnCount = data.csv->headers.size();
+    size_t wordCount = (rowCount + 63) / 64;
+    packed.rowCount = rowCount;
+    packed.headers = data.csv->headers;
+    packed.isBits.assign(columnCount, false);
+    packed.unset.assign(columnCount, 0.0f);
+    packed.set.assign(columnCount, 0.0f);
+    packed.bits.assign(columnCount, std::vector<uint64_t>());
+    packed.values.assign(columnCount, std::vector<double>());
+
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        // find if the column has two values or fewer, and how many rows have each
+        double values[2] = { 0.0f, 0.0f };
+        size_t counts[2] = { 0, 0 };
+        size_t valueCount = 0;
+        for (size_t rowIndex = 0; rowIndex < rowCount && valueCount <= 2; ++rowIndex)
+        {
+            double value = double(data.Row(rowIndex)[column]);
+            if (valueCount > 0 && value == values[0])
+                counts[0]++;
+            else if (valueCount > 1 && value == values[1])
+                counts[1]++;
+            else
+            {
+                if (valueCount < 2)
+                {
+                    values[valueCount] = value;
+                    counts[valueCount] = 1;
+                }
+                valueCount++;
+            }
+        }
+
+        if (valueCount > 2)
+        {
+            std::vector<double>& columnValues = packed.values[column];
+            columnValues.resize(rowCount);
+            for (size_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+                columnValues[rowIndex] = double(data.Row(rowIndex)[column]);
+            continue;
+        }
+
+        // the bits are set on the less common value
+        if (valueCount == 2 && counts[1] > counts[0])
+            std::swap(values[0], values[1]);
+        packed.isBits[column] = true;
+        packed.unset[column] = values[0];
+        packed.set[column] = (valueCount == 2) ? values[1] : values[0];
+
+        std::vector<uint64_t>& columnBits = packed.bits[column];
+        columnBits.assign(wordCount, 0);
+        for (size_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+        {
+            if (valueCount == 2 && double(data.Row(rowIndex)[column]) == values[1])
+                columnBits[rowIndex / 64] |= uint64_t(1) << (rowIndex % 64);
+        }
+    }
+}
+
+// how many bits of the word are set
+size_t PopCount(uint64_t word);
+
+// Adds delta to the values of the 64 rows where the bits of the word are set
+void MaskedAdd(uint64_t word, double delta, double* values);
+
+// Predicts the rows of a tile with a linear model: coefficients has one per column, then the constant. rowBegin is a multiple
+// of 64, and the tile is at most c_packedTileRows rows. predictions needs room for the tile rounded up to a whole word.
+void PredictPacked(const PackedColumns& data, const std::vector<int>& columns, const double* coefficients, size_t rowBegin, size_t rowEnd, double* predictions);
+
+// The mean squared error of a linear model, over all of the rows, in parallel
+double PackedLoss(const PackedColumns& data, const std::vector<int>& columns, const double* coefficients, int valueIndex);
+
+// The gradient of the mean squared error of a linear model, by central differences of epsilon. gradient has one per column,
+// then one for the constant.
+void PackedGradient(const PackedColumns& data, const std::vector<int>& columns, const double* coefficients, int valueIndex, double epsilon, double* gradient);
+
+// For runs with the "packed" setting on: reports how the rows were packed, and how much memory that saved
+void ReportPackedColumns(ModelReport& report, const PackedColumns& data, size_t unpackedBytes);
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <float.h>
+#include <random>
+#include <vector>
+#include "scheduler.h"
+#include "initializers.h"
+
+/*
+
+Population based fitting: optimize from many random starting points and keep the best coefficients seen.
+
+The members of the population don't depend on each other, so they are optimized in parallel on the task scheduler, each with
+its own optimizer and line search. Members converge after different numbers of steps, and work stealing keeps every worker
+busy until the last one is done.
+
+All the starting coefficients are drawn from the random number generator up front, in member order, so the results are the
+same no matter which order the members run in, or how many workers there are.
+
+Instead of giving every member its full number of steps, successive halving runs all the members for a few steps, drops the
+worse half, and gives the survivors twice as many steps the next round, until one is left or the budget runs out. Bad
+starting points get dropped early, so most of the work goes to the ones that end up best.
+
+*/
+
+// Totals for reporting how an optimization went
+struct PopulationStats
+{
+    // optimizer steps taken
+    size_t steps = 0;
+
+    // line searches (or for Levenberg-Marquardt, hessian evaluations)
+    size_t searches = 0;
+
+    // loss function evaluations done by the line searches
+    size_t lossEvaluations = 0;
+
+    // passes of the loss and gradient functions over the rows, and how many rows they went through, where it's counted
+    size_t passes = 0;
+    size_t rowsScanned = 0;
+
+    void Add(const PopulationStats& other)
+    {
+        steps += other.steps;
+        searches += other.searches;
+        lossEvaluations += other.lossEvaluations;
+        passes += other.passes;
+        rowsScanned += other.rowsScanned;
+    }
+};
+
+template <size_t N>
+struct PopulationMember
+{
+    // where this member starts
+    std::array<double, N> start;
+
+    // the best coefficients this member has seen, their loss, and which step they were seen at. Step 0 is the start.
+    std::array<double, N> bestCoefficients;
+    double bestLoss = FLT_MAX;
+    size_t bestStepIndex = 0;
+
+    PopulationStats stats;
+
+    void Keep(const std::array<double, N>& coefficients, double loss, size_t stepIndex)
+    {
+        if (loss < bestLoss)
+        {
+            bestLoss = loss;
+            bestCoefficients = coefficients;
+            bestStepIndex = stepIndex;
+        }
+    }
+};
+
+// Makes a population with random starting coefficients
+template <size_t N, typename DISTRIBUTION>
+std::vector<PopulationMember<N>> RandomPopulation(size_t count, std::mt19937& rng, DISTRIBUTION& dist)
+{
+    std::vector<PopulationMember<N>> population(count);
+    for (PopulationMember<N>& member : population)
+    {
+        for (double& f : member.start)
+            f = dist(rng);
+    }
+    return population;
+}
+
+// Makes a population with starting coefficients from an initializer, scaled to the range [low, high] of each coefficient
+template <size_t N>
+std::vector<PopulationMember<N>> InitialPopulation(size_t count, PopulationInitializer initializer, std::mt19937& rng, const std::array<double, N>& low, const std::array<double, N>& high)
+{
+    std::vector<double> points;
+    InitializerPoints(initializer, count, N, rng, points);
+
+    std::vector<PopulationMember<N>> population(count);
+    for (size_t memberIndex = 0; memberIndex < count; ++memberIndex)
+    {
+        for (size_t index = 0; index < N; ++index)
+            population[memberIndex].start[index] = Lerp(low[index], high[index], points[memberIndex * N + index]);
+    }
+    return population;
+}
+
+// Same, with every coefficient in the range of the distribution. Random draws from the distribution itself, like RandomPopulation.
+template <size_t N>
+std::vector<PopulationMember<N>> InitialPopulation(size_t count, PopulationInitializer initializer, std::mt19937& rng, std::uniform_real_distribution<double>& dist)
+{
+    if (initializer == PopulationInitializer::Random)
+        return RandomPopulation<N>(count, rng, dist);
+
+    std::array<double, N> low, high;
+    low.fill(dist.a());
+    high.fill(dist.b());
+    return InitialPopulation<N>(count, initializer, rng, low, high);
+}
+
+// Calls optimize(member) for every member of the population, in parallel
+template <size_t N, typename OPTIMIZE>
+void OptimizePopulation(std::vector<PopulationMember<N>>& population, const OPTIMIZE& optimize)
+{
+    ParallelFor(0, population.size(), 1,
+        [&](size_t populationIndex)
+        {
+            optimize(population[populationIndex]);
+        }
+    );
+}
+
+// The index of the member with the lowest loss. Ties go to the earlier member, same as a serial loop keeping the best.
+template <size_t N>
+size_t BestMember(const std::vector<PopulationMember<N>>& population)
+{
+    size_t bestIndex = 0;
+    for (size_t populationIndex = 1; populationIndex < population.size(); ++populationIndex)
+    {
+        if (population[populationIndex].bestLoss < population[bestIndex].bestLoss)
+            bestIndex = populationIndex;
+    }
+    return bestIndex;
+}
+
+template <size_t N>
+PopulationStats TotalStats(const std::vector<PopulationMember<N>>& population)
+{
+    PopulationStats stats;
+    for (const PopulationMember<N>& member : population)
+        stats.Add(member.stats);
+    return stats;
+}
+
+// What successive halving is allowed to spend
+struct HalvingBudget
+{
+    // how many steps each member takes in the first round. Each round after, half as many members take twice as many steps.
+    size_t firstRoundSteps = 10;
+
+    // the most optimizer steps of all the members in total, and the most wall clock time. 0 for no limit.
+    size_t steps = 0;
+    double seconds = 0.0f;
+
+    std::chrono::steady_clock::time_point deadline;
+
+    void Start()
+    {
+        deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    // optimizers should check this between steps, to stop when the time is up
+    bool OutOfTime() const
+    {
+        return seconds > 0.0f && std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
+struct HalvingStats
+{
+    size_t rounds = 0;
+    size_t survivors = 0;
+    bool outOfBudget = false;
+
+    // the members that could have kept going when a round dropped them, or when the budget ran out
+    std::vector<size_t> dropped;
+    std::vector<size_t> cutShort;
+};
+
+// Successive halving of the population. advance(memberIndex, stepCount) should take up to stepCount more steps of a member,
+// continuing from where it left off, keeping member.stats.steps up to date. It should return false once the member can't go
+// any further. Members run in parallel within a round. With only a step budget, the results don't depend on timing.
+template <size_t N, typename ADVANCE>
+HalvingStats SuccessiveHalving(std::vector<PopulationMember<N>>& population, HalvingBudget& budget, const ADVANCE& advance)
+{
+    HalvingStats ret;
+    budget.Start();
+
+    std::vector<size_t> survivors(population.size());
+    for (size_t index = 0; index < survivors.size(); ++index)
+        survivors[index] = index;
+    std::vector<char> active(population.size(), 1);
+
+    size_t roundSteps = std::max<size_t>(budget.firstRoundSteps, 1);
+    while (!survivors.empty())
+    {
+        // every survivor gets the round's steps, if there is enough budget left
+        size_t stepCount = roundSteps;
+        if (budget.steps > 0)
+        {
+            size_t usedSteps = TotalStats(population).steps;
+            size_t remainingSteps = (usedSteps < budget.steps) ? budget.steps - usedSteps : 0;
+            stepCount = std::min(stepCount, remainingSteps / survivors.size());
+        }
+        if (stepCount == 0 || budget.OutOfTime())
+        {
+            ret.outOfBudget = true;
+            for (size_t memberIndex : survivors)
+            {
+                if (active[memberIndex])
+                    ret.cutShort.push_back(memberIndex);
+            }
+            break;
+        }
+
+        // char instead of bool, since std::vector<bool> packs bits and the members write their own entries in parallel
+        std::vector<char> stillActive(survivors.size(), 0);
+        ParallelFor(0, survivors.size(), 1,
+            [&](size_t survivorIndex)
+            {
+                size_t memberIndex = survivors[survivorIndex];
+                stillActive[survivorIndex] = (active[memberIndex] && advance(memberIndex, stepCount)) ? 1 : 0;
+            }
+        );
+        ret.rounds++;
+
+        bool anyActive = false;
+        for (size_t survivorIndex = 0; survivorIndex < survivors.size(); ++survivorIndex)
+        {
+            active[survivors[survivorIndex]] = stillActive[survivorIndex];
+            anyActive = anyActive || stillActive[survivorIndex] != 0;
+        }
+        if (!anyActive)
+            break;
+
+        // keep the better half. Ties go to the earlier member.
+        std::sort(survivors.begin(), survivors.end(),
+            [&](size_t A, size_t B)
+            {
+                if (population[A].bestLoss != population[B].bestLoss)
+                    return population[A].bestLoss < population[B].bestLoss;
+                return A < B;
+            }
+        );
+        size_t survivorCount = (survivors.size() + 1) / 2;
+        for (size_t survivorIndex = survivorCount; survivorIndex < survivors.size(); ++survivorIndex)
+        {
+            if (active[survivors[survivorIndex]])
+                ret.dropped.push_back(survivors[survivorIndex]);
+        }
+        survivors.resize(survivorCount);
+        roundSteps *= 2;
+    }
+
+    ret.survivors = survivors.size();
+    return ret;
+}
@@ -0,0 +1,231 @@
+#include "quantize.h"
+#include "scoring.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+
+// how long each scoring path is timed for, when reporting throughput
+static const double c_benchmarkSeconds = 0.05f;
+
+namespace
+{
+    template <typename T>
+    size_t QuantizeRowsT(const QuantizedModel& model, const CSV& data, const std::vector<int>& columns, std::vector<T>& values)
+    {
+        double maxValue = double((1 << (model.bits - 1)) - 1);
+        size_t rowCount = data.data.size();
+        size_t clampedCount = 0;
+        values.resize(model.columnCount * rowCount);
+        for (size_t column = 0; column < model.columnCount; ++column)
+        {
+            T* quantized = &values[column * rowCount];
+            for (size_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+            {
+                double q = floor((data.data[rowIndex][columns[column]] - model.offset[column]) / model.scale[column] + 0.5f);
+                if (q < -maxValue || q > maxValue)
+                    clampedCount++;
+                quantized[rowIndex] = T(std::min(std::max(q, -maxValue), maxValue));
+            }
+        }
+        return clampedCount;
+    }
+
+    template <typename T>
+    void ScoreQuantizedT(const QuantizedModel& model, size_t rowCount, const T* values, const T* weights, double* predictions)
+    {
+        int32_t sums[c_quantizedTileRows];
+        for (size_t tileBegin = 0; tileBegin < rowCount; tileBegin += c_quantizedTileRows)
+        {
+            size_t tileRows = std::min(c_quantizedTileRows, rowCount - tileBegin);
+            for (size_t row = 0; row < tileRows; ++row)
+                sums[row] = 0;
+
+            for (size_t column = 0; column < model.columnCount; ++column)
+            {
+                int32_t weight = weights[column];
+                const T* x = values + column * rowCount + tileBegin;
+                for (size_t row = 0; row < tileRows; ++row)
+                    sums[row] += weight * int32_t(x[row]);
+            }
+
+            for (size_t row = 0; row < tileRows; ++row)
+                predictions[tileBegin + row] = model.constant + model.weightScale * double(sums[row]);
+        }
+    }
+
+    // how many rows per second the scoring function does, repeating it over the same rows
+    template <typename LAMBDA>
+    double RowsPerSecond(size_t rowCount, const LAMBDA& score)
+    {
+        size_t passes = 0;
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        double seconds = 0.0f;
+        do
+        {
+            score();
+            passes++;
+            seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        } while (seconds < c_benchmarkSeconds);
+        return double(passes * rowCount) / seconds;
+    }
+}
+
+bool CalibrateQuantizedModel(const std::vector<ColumnStats>& stats, const std::vector<int>& columns, const double* coefficients, int bits, QuantizedModel& model)
+{
+    if (bits != 8 && bits != 16)
+        return false;
+
+    double maxValue = double((1 << (bits - 1)) - 1);
+    model.bits = bits;
+    model.columnCount = columns.size();
+
+    // map each feature's training range onto the integers, and fold the offsets into the constant and the scales into the weights
+    model.offset.assign(columns.size(), 0.0f);
+    model.scale.assign(columns.size(), 1.0f);
+    model.constant = coefficients[columns.size()];
+    std::vector<double> weights(columns.size());
+    double maxWeight = 0.0f;
+    double weightSum = 0.0f;
+    for (size_t column = 0; column < columns.size(); ++column)
+    {
+        double minX = stats[columns[column]].min;
+        double maxX = stats[columns[column]].max;
+
+        // a column that doesn't vary is all offset
+        model.offset[column] = (minX + maxX) / 2.0f;
+        if (maxX > minX)
+            model.scale[column] = (maxX - minX) / (2.0f * maxValue);
+
+        model.constant += coefficients[column] * model.offset[column];
+        weights[column] = coefficients[column] * model.scale[column];
+        maxWeight = std::max(maxWeight, fabs(weights[column]));
+        weightSum += fabs(weights[column]);
+    }
+
+    // use the whole range for the weights, unless the dot product could overflow 32 bits
+    model.weightScale = std::max(maxWeight / maxValue, weightSum * maxValue / double(INT32_MAX));
+    if (model.weightScale <= 0.0f)
+        model.weightScale = 1.0f;
+
+    model.weights8.assign(bits == 8 ? columns.size() : 0, 0);
+    model.weights16.assign(bits == 16 ? columns.size() : 0, 0);
+    for (size_t column = 0; column < columns.size(); ++column)
+    {
+        double w = std::min(std::max(floor(weights[column] / model.weightScale + 0.5f), -maxValue), maxValue);
+        if (bits == 8)
+            model.weights8[column] = int8_t(w);
+        else
+            model.weights16[column] = int16_t(w);
+    }
+    return true;
+}
+
+void QuantizeRows(const QuantizedModel& model, const CSV& data, const std::vector<int>& columns, QuantizedRows& rows)
+{
+    rows.rowCount = data.data.size();
+    rows.values8.clear();
+    rows.values16.clear();
+    if (model.bits == 8)
+        rows.clampedCount = QuantizeRowsT(model, data, columns, rows.values8);
+    else
+        rows.clampedCount = QuantizeRowsT(model, data, columns, rows.values16);
+}
+
+void ScoreQuantized(const QuantizedModel& model, const QuantizedRows& rows, double* predictions)
+{
+    if (model.bits == 8)
+        ScoreQuantizedT(model, rows.rowCount, rows.values8.data(), model.weights8.data(), predictions);
+    else
+        ScoreQuantizedT(model, rows.rowCount, rows.values16.data(), model.weights16.data(), predictions);
+}
+
+void ReportQuantizedScoring(const Dataset& dataset, const ModelSettings& settings, ModelReport& report)
+{
+    int bits = (int)settings.Get("quantize", 0.0f);
+    if (bits == 0 || !report.succeeded)
+        return;
+
+    if (report.coefficientColumns.empty())
+    {
+        report.Printf("  Quantized scoring needs a model with coefficients for the data columns\n\n");
+        return;
+    }
+
+    const CSV& train = dataset.train;
+    const CSV& test = dataset.test;
+    int salesIndex = test.GetHeaderIndex("Item_Outlet_Sales");
+    std::vector<int> columns;
+    for (const std::string& name : report.coefficientColumns)
+    {
+        int index = train.GetHeaderIndex(name.c_str());
+        if (index == -1 || test.GetHeaderIndex(name.c_str()) != index)
+        {
+            report.Printf("  Couldn't find %s column for quantized scoring.\n\n", name.c_str());
+            return;
+        }
+        columns.push_back(index);
+    }
+
+    QuantizedModel model;
+    if (!CalibrateQuantizedModel(dataset.trainStats, columns, report.coefficients.data(), bits, model))
+    {
+        report.Printf("  quantize must be 8 or 16, not %i\n\n", bits);
+        return;
+    }
+    QuantizedRows rows;
+    QuantizeRows(model, test, columns, rows);
+
+    // the double path is ScoreBatch, the kernel of the scoring server, on the same rows in the same layout
+    size_t rowCount = test.data.size();
+    size_t columnCount = columns.size();
+    std::vector<double> doubleRows(columnCount * rowCount);
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        for (size_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+            doubleRows[column * rowCount + rowIndex] = test.data[rowIndex][columns[column]];
+    }
+    ScoringModel doubleModel;
+    doubleModel.columns = report.coefficientColumns;
+    doubleModel.coefficients = report.coefficients.data();
+    std::vector<double> doublePredictions(rowCount);
+    auto scoreDouble = [&]()
+    {
+        ScoreBatch(doubleModel, doubleRows.data(), rowCount, doublePredictions.data());
+    };
+    std::vector<double> quantizedPredictions(rowCount);
+    auto scoreQuantized = [&]()
+    {
+        ScoreQuantized(model, rows, quantizedPredictions.data());
+    };
+
+    double doubleRowsPerSecond = RowsPerSecond(rowCount, scoreDouble);
+    double quantizedRowsPerSecond = RowsPerSecond(rowCount, scoreQuantized);
+
+    // how far the quantized predictions are from the double ones, and what that does to the test error
+    double maxError = 0.0f;
+    Average squaredError, doubleMSE, quantizedMSE;
+    for (size_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+    {
+        double error = quantizedPredictions[rowIndex] - doublePredictions[rowIndex];
+        maxError = std::max(maxError, fabs(error));
+        squaredError.AddSample(error * error);
+        if (salesIndex != -1)
+        {
+            doubleMSE.AddSample(sqr(doublePredictions[rowIndex] - test.data[rowIndex][salesIndex]));
+            quantizedMSE.AddSample(sqr(quantizedPredictions[rowIndex] - test.data[rowIndex][salesIndex]));
+        }
+    }
+
+    report.Printf("  Quantized to int%i (%zu bytes per row instead of %zu): predictions differ from double by %0.3f RMS, %0.3f at most, with %zu values clamped\n",
+        bits, columnCount * size_t(bits / 8), columnCount * sizeof(double), sqrt(squaredError.average), maxError, rows.clampedCount);
+    if (salesIndex != -1)
+        report.Printf("  Quantized RMSE on test set: %0.2f (%0.2f in double)\n", sqrt(quantizedMSE.average), sqrt(doubleMSE.average));
+    report.Printf("  Quantized scoring: %0.1fM rows/s, double: %0.1fM rows/s (%0.2fx)\n\n",
+        quantizedRowsPerSecond / 1000000.0f, doubleRowsPerSecond / 1000000.0f, quantizedRowsPerSecond / doubleRowsPerSecond);
+
+    report.Value("quantized_error_rms", sqrt(squaredError.average));
+    report.Value("quantized_speedup", quantizedRowsPerSecond / doubleRowsPerSecond);
+    if (salesIndex != -1)
+        report.Value("quantized_test_rmse", sqrt(quantizedMSE.average));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Quantized scoring: scoring a linear model with small integers instead of doubles, once its coefficients are fixed.
+
+Each feature is calibrated on the training data: its values are mapped from [min, max] onto the whole range of the integer
+type, as x = offset + scale * q. A 0/1 column becomes exactly -127 or 127, so one hot columns lose nothing. The offsets
+fold into the constant, and the scales fold into the coefficients, which are then quantized with one shared scale:
+
+    f(x) = constant + sum of c_i * x_i = constant' + weightScale * (sum of w_i * q_i)
+
+The sum is an integer dot product, accumulated in 32 bits. A row is 1 or 2 bytes per feature instead of 8. The rows are stored
+column major like ScoreBatch takes them, and scored a tile of rows at a time: each feature is an integer multiply add over the
+tile into 32 bit sums that stay in the L1 cache. The compiler turns those loops into SIMD integer multiply adds.
+
+With 16 bits, the weights are scaled down if needed so no dot product can overflow 32 bits. Values outside the training
+range are clamped.
+
+*/
+
+// how many rows are scored at a time, with their sums kept on the stack
+static const size_t c_quantizedTileRows = 256;
+
+struct QuantizedModel
+{
+    // 8 or 16
+    int bits = 8;
+
+    size_t columnCount = 0;
+
+    // per feature, x = offset + scale * q
+    std::vector<double> offset;
+    std::vector<double> scale;
+
+    // the quantized coefficients. Only the ones for the model's bits are used.
+    std::vector<int8_t> weights8;
+    std::vector<int16_t> weights16;
+
+    // f(x) = constant + weightScale * (the integer dot product)
+    double weightScale = 1.0f;
+    double constant = 0.0f;
+};
+
+// Rows of data quantized for a model, column major: values[column * rowCount + row]
+struct QuantizedRows
+{
+    size_t rowCount = 0;
+    std::vector<int8_t> values8;
+    std::vector<int16_t> values16;
+
+    // how many values were outside the calibrated range, and clamped
+    size_t clampedCount = 0;
+};
+
+// Calibrates the model on the ranges of the columns, from the statistics of the training data. coefficients has one per
+// column, then the constant. Returns false if bits isn't 8 or 16.
+bool CalibrateQuantizedModel(const std::vector<ColumnStats>& stats, const std::vector<int>& columns, const double* coefficients, int bits, QuantizedModel& model);
+
+void QuantizeRows(const QuantizedModel& model, const CSV& data, const std::vector<int>& columns, QuantizedRows& rows);
+
+void ScoreQuantized(const QuantizedModel& model, const QuantizedRows& rows, double* predictions);
+
+// For a run with coefficients for data columns, and the "quantize" setting at 8 or 16: quantizes the model, and reports its
+// prediction error on the test data and its scoring throughput, against scoring in double
+void ReportQuantizedScoring(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
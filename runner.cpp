@@ -0,0 +1,347 @@
+#include "runner.h"
+#include "scheduler.h"
+#include "codegen.h"
+#include "quantize.h"
+#include "scoring.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef void(*ModelFunction)(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+
+static const ModelFunction c_models[] =
+{
+    Model1, Model2, Model3, Model4, Model5, Model6, Model7, Model8, Model9, Model10, Model11, Model12
+};
+
+static const int c_modelCount = int(sizeof(c_models) / sizeof(c_models[0]));
+
+int ModelCount()
+{
+    return c_modelCount;
+}
+
+// the settings that models know about. Anything else is most likely a typo, which would silently run the defaults.
+static const char* c_settingNames[] =
+{
+    "population", "steps", "initialStepSize", "L1", "L2", "seed", "bootstrap", "confidence",
+    "trees", "learningRate", "depth", "minLeaf", "bins",
+    "k", "leafSize", "checkpointSteps", "halving", "halvingSteps", "budgetSteps", "budgetSeconds",
+    "init", "tolerance", "patience", "gradientTolerance", "validationSteps", "validationFraction",
+    "evaluateSeconds", "coreset", "coresetGrowth", "coresetTolerance", "coresetPatience", "coresetSteps", "degree", "quantize", "packed"
+};
+
+static bool IsSeparator(char c)
+{
+    return c == ':' || c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool ParseModelRun(const char* spec, ModelRun& run)
+{
+    run = ModelRun();
+
+    // read the model number
+    const char* cursor = spec;
+    while (IsSeparator(*cursor))
+        cursor++;
+    char* end = nullptr;
+    long model = strtol(cursor, &end, 10);
+    if (end == cursor || model < 1 || model > c_modelCount)
+    {
+        printf("Bad model in \"%s\". Models are 1 to %i.\n", spec, c_modelCount);
+        return false;
+    }
+    run.model = int(model);
+    cursor = end;
+
+    // read the name=value settings
+    while (true)
+    {
+        while (IsSeparator(*cursor))
+            cursor++;
+        if (*cursor == 0)
+            break;
+
+        const char* nameBegin = cursor;
+        while (*cursor != 0 && *cursor != '=' && !IsSeparator(*cursor))
+            cursor++;
+        std::string name(nameBegin, cursor);
+        if (*cursor != '=')
+        {
+            printf("Bad setting \"%s\" in \"%s\". Settings look like name=value.\n", name.c_str(), spec);
+            return false;
+        }
+        cursor++;
+
+        double value = strtod(cursor, &end);
+        if (end == cursor || (*end != 0 && !IsSeparator(*end)))
+        {
+            printf("Bad value for \"%s\" in \"%s\".\n", name.c_str(), spec);
+            return false;
+        }
+        cursor = end;
+
+        bool known = false;
+        for (const char* settingName : c_settingNames)
+            known = known || (name == settingName);
+        if (!known)
+        {
+            printf("Unknown setting \"%s\" in \"%s\".\n", name.c_str(), spec);
+            return false;
+        }
+
+        run.settings.values[name] = value;
+    }
+
+    // remember the spec, without the leading and trailing white space
+    run.spec = spec;
+    size_t first = run.spec.find_first_not_of(" \t\r\n");
+    size_t last = run.spec.find_last_not_of(" \t\r\n");
+    run.spec = (first == std::string::npos) ? std::string() : run.spec.substr(first, last - first + 1);
+    return true;
+}
+
+bool LoadRunConfig(const char* fileName, std::vector<ModelRun>& runs)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, "rb");
+    if (!file)
+    {
+        printf("Could not open config file %s\n", fileName);
+        return false;
+    }
+
+    char line[1024];
+    int lineNumber = 0;
+    bool ret = true;
+    while (ret && fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+
+        const char* cursor = line;
+        while (*cursor == ' ' || *cursor == '\t')
+            cursor++;
+        if (*cursor == '#' || *cursor == '\r' || *cursor == '\n' || *cursor == 0)
+            continue;
+
+        ModelRun run;
+        if (ParseModelRun(cursor, run))
+            runs.push_back(run);
+        else
+        {
+            printf("  (%s line %i)\n", fileName, lineNumber);
+            ret = false;
+        }
+    }
+
+    fclose(file);
+    return ret;
+}
+
+// the run index and spec, with anything that isn't a letter or number made into an underscore, like run1_8_L2_0_1
+static std::string RunFileName(size_t runIndex, const ModelRun& run)
+{
+    std::string name = "run" + std::to_string(runIndex + 1) + "_" + run.spec;
+    for (size_t index = 3; index < name.size(); ++index)
+    {
+        char c = name[index];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            name[index] = '_';
+    }
+    return name;
+}
+
+void SetCheckpointFiles(const char* directory, std::vector<ModelRun>& runs)
+{
+    for (size_t runIndex = 0; runIndex < runs.size(); ++runIndex)
+        runs[runIndex].settings.checkpointFileName = std::string(directory) + "/" + RunFileName(runIndex, runs[runIndex]) + ".checkpoint";
+}
+
+void SetTraceFiles(const char* directory, std::vector<ModelRun>& runs)
+{
+    for (size_t runIndex = 0; runIndex < runs.size(); ++runIndex)
+        runs[runIndex].settings.traceFileName = std::string(directory) + "/" + RunFileName(runIndex, runs[runIndex]) + ".trace";
+}
+
+void SetScoringModelFiles(const char* directory, std::vector<ModelRun>& runs)
+{
+    for (size_t runIndex = 0; runIndex < runs.size(); ++runIndex)
+        runs[runIndex].settings.scoringModelFileName = std::string(directory) + "/" + RunFileName(runIndex, runs[runIndex]) + ".model";
+}
+
+void SaveScoringModel(const ModelRun& run, ModelReport& report)
+{
+    const std::string& fileName = run.settings.scoringModelFileName;
+    if (fileName.empty() || !report.succeeded)
+        return;
+
+    if (report.coefficientColumns.empty())
+        report.Printf("  Model%i doesn't give coefficients for the data columns, so it can't be saved as a scoring model\n\n", run.model);
+    else if (!WriteScoringModel(fileName, report.coefficientColumns, report.coefficients))
+        report.Printf("could not write scoring model %s\n\n", fileName.c_str());
+    else
+        report.Printf("  Saved scoring model %s\n\n", fileName.c_str());
+}
+
+void SetScoringHeaderFiles(const char* directory, std::vector<ModelRun>& runs)
+{
+    for (size_t runIndex = 0; runIndex < runs.size(); ++runIndex)
+        runs[runIndex].settings.scoringHeaderFileName = std::string(directory) + "/" + RunFileName(runIndex, runs[runIndex]) + ".h";
+}
+
+void SaveScoringHeader(const ModelRun& run, ModelReport& report)
+{
+    const std::string& fileName = run.settings.scoringHeaderFileName;
+    if (fileName.empty() || !report.succeeded)
+        return;
+
+    if (report.polynomial.columns.empty())
+    {
+        report.Printf("  Model%i isn't a polynomial of the data columns, so it can't be generated as code\n\n", run.model);
+        return;
+    }
+
+    // the namespace is the name of the file, which is already a valid identifier
+    size_t nameBegin = fileName.find_last_of("/\\");
+    nameBegin = (nameBegin == std::string::npos) ? 0 : nameBegin + 1;
+    std::string namespaceName = fileName.substr(nameBegin, fileName.size() - nameBegin - 2);
+
+    std::string description = "Model" + std::to_string(run.model) + " run \"" + run.spec + "\"";
+    for (const auto& value : report.values)
+    {
+        if (value.first == "test_rmse")
+            description += ", test RMSE " + std::to_string(value.second);
+    }
+
+    if (WriteScoringHeader(fileName, namespaceName, description, report.polynomial))
+        report.Printf("  Generated scoring code %s\n\n", fileName.c_str());
+    else
+        report.Printf("could not generate scoring code %s\n\n", fileName.c_str());
+}
+
+void ExecuteRuns(const Dataset& dataset, const std::vector<ModelRun>& runs, std::vector<ModelReport>& reports, bool printReports)
+{
+    reports.clear();
+    reports.resize(runs.size());
+
+    // each run is a task on the scheduler. The models fork their own work from inside these tasks.
+    std::mutex printMutex;
+    ParallelFor(0, runs.size(), 1,
+        [&](size_t runIndex)
+        {
+            const ModelRun& run = runs[runIndex];
+            ModelReport& report = reports[runIndex];
+
+            // only the run's own work is timed. While it waits on its tasks, its thread can help with other runs.
+            WorkTimer timer;
+            {
+                WorkTimerScope timerScope(&timer);
+                c_models[run.model - 1](dataset, run.settings, report);
+            }
+            report.Value("work_seconds", timer.Seconds());
+            SaveScoringModel(run, report);
+            SaveScoringHeader(run, report);
+            ReportQuantizedScoring(dataset, run.settings, report);
+            if (!printReports)
+                return;
+
+            std::lock_guard<std::mutex> lock(printMutex);
+            printf("[%zu/%zu] %s (%0.2f seconds of work)\n%s", runIndex + 1, runs.size(), run.spec.c_str(), timer.Seconds(), report.text.c_str());
+            fflush(stdout);
+        }
+    );
+}
+
+static void WriteJSONString(FILE* file, const std::string& s)
+{
+    fputc('"', file);
+    for (char c : s)
+    {
+        switch (c)
+        {
+            case '"': fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\r': fputs("\\r", file); break;
+            case '\t': fputs("\\t", file); break;
+            default:
+            {
+                if ((unsigned char)c < 0x20)
+                    fprintf(file, "\\u%04x", (unsigned int)(unsigned char)c);
+                else
+                    fputc(c, file);
+                break;
+            }
+        }
+    }
+    fputc('"', file);
+}
+
+static void WriteJSONNumber(FILE* file, double value)
+{
+    // JSON has no inf or nan
+    if (isfinite(value))
+        fprintf(file, "%.17g", value);
+    else
+        fputs("null", file);
+}
+
+bool WriteResults(const char* fileName, const std::vector<ModelRun>& runs, const std::vector<ModelReport>& reports)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, "wb");
+    if (!file)
+    {
+        printf("Could not open %s for writing\n", fileName);
+        return false;
+    }
+
+    fputs("[\n", file);
+    for (size_t runIndex = 0; runIndex < runs.size(); ++runIndex)
+    {
+        const ModelRun& run = runs[runIndex];
+        const ModelReport& report = reports[runIndex];
+
+        fputs("  {\n    \"run\": ", file);
+        WriteJSONString(file, run.spec);
+        fprintf(file, ",\n    \"model\": %i,\n    \"succeeded\": %s,\n    \"settings\": {", run.model, report.succeeded ? "true" : "false");
+
+        // sort the settings by name so the output doesn't depend on the hash map order
+        std::vector<std::pair<std::string, double>> settings(run.settings.values.begin(), run.settings.values.end());
+        std::sort(settings.begin(), settings.end());
+        for (size_t index = 0; index < settings.size(); ++index)
+        {
+            fputs(index == 0 ? " " : ", ", file);
+            WriteJSONString(file, settings[index].first);
+            fputs(": ", file);
+            WriteJSONNumber(file, settings[index].second);
+        }
+        fputs(settings.empty() ? "},\n    \"values\": {" : " },\n    \"values\": {", file);
+
+        for (size_t index = 0; index < report.values.size(); ++index)
+        {
+            fputs(index == 0 ? " " : ", ", file);
+            WriteJSONString(file, report.values[index].first);
+            fputs(": ", file);
+            WriteJSONNumber(file, report.values[index].second);
+        }
+        fputs(report.values.empty() ? "},\n    \"coefficients\": [" : " },\n    \"coefficients\": [", file);
+
+        for (size_t index = 0; index < report.coefficients.size(); ++index)
+        {
+            fputs(index == 0 ? " " : ", ", file);
+            WriteJSONNumber(file, report.coefficients[index]);
+        }
+        fputs(report.coefficients.empty() ? "],\n    \"text\": " : " ],\n    \"text\": ", file);
+
+        WriteJSONString(file, report.text);
+        fputs(runIndex + 1 < runs.size() ? "\n  },\n" : "\n  }\n", file);
+    }
+    fputs("]\n", file);
+
+    fclose(file);
+    return true;
+}
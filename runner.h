@@ -0,0 +1,47 @@
+#pragma once
+
+#include "utils.h"
+
+// One model run: which model, and the hyperparameters to run it with.
+struct ModelRun
+{
+    int model = 0;
+    ModelSettings settings;
+
+    // the run as it was written, like "8:L2=0.1,population=20", to identify it in the results
+    std::string spec;
+};
+
+// How many models there are. They are numbered from 1.
+int ModelCount();
+
+// Parses a run like "6" or "8:L2=0.1,population=20". Settings can also be separated by spaces, like in a config file.
+bool ParseModelRun(const char* spec, ModelRun& run);
+
+// Reads runs from a file, one per line. Blank lines and lines starting with # are skipped.
+bool LoadRunConfig(const char* fileName, std::vector<ModelRun>& runs);
+
+// Gives each run its own checkpoint file in the directory, named after the run, so the same runs can resume after an interruption
+void SetCheckpointFiles(const char* directory, std::vector<ModelRun>& runs);
+
+// Gives each run its own convergence trace file in the directory, named the same way
+void SetTraceFiles(const char* directory, std::vector<ModelRun>& runs);
+
+// Gives each run its own scoring model file in the directory, named the same way, to save the fitted model in
+void SetScoringModelFiles(const char* directory, std::vector<ModelRun>& runs);
+
+// Saves the fitted model of a run as a scoring model, if the run has a scoring model file, noting it in the report
+void SaveScoringModel(const ModelRun& run, ModelReport& report);
+
+// Gives each run its own generated scoring header in the directory, named the same way
+void SetScoringHeaderFiles(const char* directory, std::vector<ModelRun>& runs);
+
+// Generates the scoring header of a run, if the run has a scoring header file, noting it in the report
+void SaveScoringHeader(const ModelRun& run, ModelReport& report);
+
+// Does the runs concurrently on the task scheduler. The dataset is shared, read only, by all of them.
+// The text of each run is printed as it finishes, unless printReports is false, and reports[i] is the report of runs[i].
+void ExecuteRuns(const Dataset& dataset, const std::vector<ModelRun>& runs, std::vector<ModelReport>& reports, bool printReports = true);
+
+// Writes the runs and their reports as JSON
+bool WriteResults(const char* fileName, const std::vector<ModelRun>& runs, const std::vector<ModelReport>& reports);
@@ -0,0 +1,277 @@
+#include "scheduler.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup* group = nullptr;
+        WorkTimer* timer = nullptr;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+
+        // keep each worker on its own cache line, so pushing and popping doesn't contend with the neighbors
+        char padding[64];
+    };
+
+    std::vector<Worker*> s_workers;
+    std::vector<std::thread> s_threads;
+    std::atomic<bool> s_stopping{ false };
+
+    // how many tasks are sitting in deques, and how many workers are asleep waiting for one
+    std::atomic<size_t> s_queuedTasks{ 0 };
+    std::atomic<int> s_sleepingWorkers{ 0 };
+    std::mutex s_sleepMutex;
+    std::condition_variable s_sleepCondition;
+
+    // which worker the current thread is. -1 for threads that aren't workers.
+    thread_local int t_workerIndex = -1;
+
+    // whether the current thread runs everything it forks itself, instead of giving it to the workers
+    thread_local bool t_runInline = false;
+
+    // which work timer the current thread's time goes to, and since when. nullptr if it isn't timed.
+    thread_local WorkTimer* t_timer = nullptr;
+    thread_local std::chrono::steady_clock::time_point t_timerStart;
+
+    // charges the time since the last switch to the current timer, and moves the thread over to the new one
+    void SwitchTimer(WorkTimer* timer)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (t_timer)
+            t_timer->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(now - t_timerStart).count();
+        t_timer = timer;
+        t_timerStart = now;
+    }
+
+    void PinThread(int coreIndex)
+    {
+        unsigned int coreCount = std::thread::hardware_concurrency();
+        if (coreCount == 0)
+            return;
+        coreIndex = coreIndex % int(coreCount);
+
+#ifdef _WIN32
+        if (coreIndex < 64)
+            SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << coreIndex);
+#elif defined(__linux__)
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(coreIndex, &cpuSet);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+    }
+
+    void PushTask(Task&& task)
+    {
+        // threads that aren't workers give their tasks to worker 0
+        Worker& worker = *s_workers[t_workerIndex >= 0 ? t_workerIndex : 0];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        }
+        s_queuedTasks++;
+
+        // wake a sleeping worker. Taking the lock means a worker can't miss this between checking for work and sleeping.
+        if (s_sleepingWorkers > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(s_sleepMutex);
+            }
+            s_sleepCondition.notify_one();
+        }
+    }
+
+    bool FindTask(Task& task)
+    {
+        if (s_queuedTasks == 0)
+            return false;
+
+        // newest task from our own deque first
+        int workerCount = int(s_workers.size());
+        int self = t_workerIndex;
+        if (self >= 0)
+        {
+            Worker& worker = *s_workers[self];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.tasks.empty())
+            {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+                s_queuedTasks--;
+                return true;
+            }
+        }
+
+        // otherwise steal the oldest task from someone else, starting with the next worker over so thieves spread out
+        int start = (self >= 0) ? self + 1 : 0;
+        for (int offset = 0; offset < workerCount; ++offset)
+        {
+            int victim = (start + offset) % workerCount;
+            if (victim == self)
+                continue;
+
+            Worker& worker = *s_workers[victim];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.tasks.empty())
+            {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+                s_queuedTasks--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ExecuteTask(Task& task)
+    {
+        // the task's time goes to the timer of the thread that forked it, not to whatever this thread was timing
+        WorkTimer* previous = t_timer;
+        if (task.timer != previous)
+            SwitchTimer(task.timer);
+        task.function();
+        if (t_timer != previous)
+            SwitchTimer(previous);
+        task.group->pending--;
+    }
+
+    void WorkerThread(int workerIndex, bool pinThreads)
+    {
+        t_workerIndex = workerIndex;
+        if (pinThreads)
+            PinThread(workerIndex);
+
+        while (true)
+        {
+            Task task;
+            if (FindTask(task))
+            {
+                ExecuteTask(task);
+                continue;
+            }
+
+            // no work anywhere, so sleep until some shows up
+            std::unique_lock<std::mutex> lock(s_sleepMutex);
+            s_sleepingWorkers++;
+            s_sleepCondition.wait(lock, []() { return s_queuedTasks > 0 || s_stopping; });
+            s_sleepingWorkers--;
+            if (s_stopping)
+                return;
+        }
+    }
+}
+
+void StartTaskScheduler(int workerCount, bool pinThreads)
+{
+    StopTaskScheduler();
+
+    if (workerCount < 1)
+        workerCount = 1;
+
+    for (int workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+        s_workers.push_back(new Worker);
+
+    // the calling thread is worker 0
+    t_workerIndex = 0;
+    if (pinThreads)
+        PinThread(0);
+
+    s_stopping = false;
+    for (int workerIndex = 1; workerIndex < workerCount; ++workerIndex)
+        s_threads.push_back(std::thread(WorkerThread, workerIndex, pinThreads));
+}
+
+void StopTaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_sleepMutex);
+        s_stopping = true;
+    }
+    s_sleepCondition.notify_all();
+
+    for (std::thread& thread : s_threads)
+        thread.join();
+    s_threads.clear();
+
+    for (Worker* worker : s_workers)
+        delete worker;
+    s_workers.clear();
+    s_queuedTasks = 0;
+    t_workerIndex = -1;
+}
+
+int TaskWorkerCount()
+{
+    return (s_workers.empty() || t_runInline) ? 1 : int(s_workers.size());
+}
+
+void RunTasksInline()
+{
+    t_runInline = true;
+}
+
+void TaskGroup::Run(std::function<void()> task)
+{
+    // not started, or this thread runs its own tasks, so run it now
+    if (s_workers.empty() || t_runInline)
+    {
+        task();
+        return;
+    }
+
+    pending++;
+    Task newTask;
+    newTask.function = std::move(task);
+    newTask.group = this;
+    newTask.timer = t_timer;
+    PushTask(std::move(newTask));
+}
+
+void TaskGroup::Wait()
+{
+    // run tasks while waiting, instead of blocking the worker. Time spent idling isn't charged to the timer.
+    WorkTimer* timer = t_timer;
+    while (pending > 0)
+    {
+        Task task;
+        if (FindTask(task))
+            ExecuteTask(task);
+        else
+        {
+            if (t_timer)
+                SwitchTimer(nullptr);
+            std::this_thread::yield();
+        }
+    }
+    if (t_timer != timer)
+        SwitchTimer(timer);
+}
+
+WorkTimerScope::WorkTimerScope(WorkTimer* timer)
+{
+    previous = t_timer;
+    SwitchTimer(timer);
+}
+
+WorkTimerScope::~WorkTimerScope()
+{
+    SwitchTimer(previous);
+}
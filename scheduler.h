@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+/*
+
+Work stealing task scheduler, shared by everything that runs in parallel: whole model runs, the members of a population,
+and row ranges of the loss functions. Having one scheduler means nested parallelism doesn't oversubscribe the cores.
+
+* Every worker has its own deque of tasks. A worker pushes and pops tasks at the back of its own deque, so it works depth
+  first on what it just forked, and idle workers steal from the front of other deques, which is the oldest and biggest work.
+* Fork/join is done with TaskGroup. Run() forks a task, and Wait() joins. A thread waiting on a group runs tasks (its own
+  or stolen ones) until the group is done, instead of blocking, so nesting groups inside tasks doesn't deadlock or idle.
+* The thread that starts the scheduler is worker 0. Until the scheduler is started, everything runs inline on the calling thread.
+* A thread waiting on a group can run tasks from unrelated work, like another model run, so wall time around a piece of work
+  overstates it. WorkTimer adds up only the time threads spend on the work itself and on the tasks it forks.
+
+*/
+
+// Starts workerCount workers, counting the calling thread. If pinThreads is true, worker i is pinned to core i.
+void StartTaskScheduler(int workerCount, bool pinThreads);
+
+// Waits for the workers to finish and stops them
+void StopTaskScheduler();
+
+// How many workers there are, counting the thread that started the scheduler. 1 if it isn't started.
+int TaskWorkerCount();
+
+// Makes everything the calling thread forks from now on run inline on it. For threads outside of the scheduler, like the
+// test set evaluator, that shouldn't take time away from the workers.
+void RunTasksInline();
+
+// Time spent on a piece of work and on everything it forks, summed over the threads that ran it. Time a waiting thread
+// spends on other work's tasks, or idling, isn't counted.
+struct WorkTimer
+{
+    double Seconds() const
+    {
+        return double(nanoseconds) * 1e-9;
+    }
+
+    std::atomic<long long> nanoseconds{ 0 };
+};
+
+// Charges the calling thread's time, and the tasks it forks, to timer until the scope ends
+struct WorkTimerScope
+{
+    WorkTimerScope(WorkTimer* timer);
+    ~WorkTimerScope();
+
+    WorkTimer* previous;
+};
+
+struct TaskGroup
+{
+    ~TaskGroup()
+    {
+        Wait();
+    }
+
+    // Forks a task, which may run on any worker
+    void Run(std::function<void()> task);
+
+    // Joins all the tasks forked from this group, running tasks while it waits
+    void Wait();
+
+    std::atomic<size_t> pending{ 0 };
+};
+
+// Calls f(index) for every index in [begin, end) in parallel. The range is split in half recursively until the pieces are
+// at most grainSize indices, so idle workers can steal big pieces of work.
+template <typename F>
+void ParallelFor(size_t begin, size_t end, size_t grainSize, const F& f)
+{
+    if (grainSize < 1)
+        grainSize = 1;
+
+    if (end - begin <= grainSize || TaskWorkerCount() == 1)
+    {
+        for (size_t index = begin; index < end; ++index)
+            f(index);
+        return;
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    TaskGroup group;
+    group.Run([&]() { ParallelFor(middle, end, grainSize, f); });
+    ParallelFor(begin, middle, grainSize, f);
+    group.Wait();
+}
+
+// Splits [begin, end) into chunks of grainSize, runs f(chunkBegin, chunkEnd, partial) on each chunk in parallel, then
+// combines the partial results with combine(result, partial) in chunk order. The chunks don't depend on the worker count,
+// so the result is the same bit for bit no matter how many workers there are.
+template <typename T, typename F, typename COMBINE>
+T ParallelReduce(size_t begin, size_t end, size_t grainSize, const T& identity, const F& f, const COMBINE& combine)
+{
+    if (grainSize < 1)
+        grainSize = 1;
+
+    size_t chunkCount = (end - begin + grainSize - 1) / grainSize;
+    if (chunkCount <= 1)
+    {
+        T result = identity;
+        f(begin, end, result);
+        return result;
+    }
+
+    std::vector<T> partials(chunkCount, identity);
+    ParallelFor(0, chunkCount, 1,
+        [&](size_t chunkIndex)
+        {
+            size_t chunkBegin = begin + chunkIndex * grainSize;
+            size_t chunkEnd = (chunkBegin + grainSize < end) ? chunkBegin + grainSize : end;
+            f(chunkBegin, chunkEnd, partials[chunkIndex]);
+        }
+    );
+
+    T result = identity;
+    for (const T& partial : partials)
+        combine(result, partial);
+    return result;
+}
@@ -0,0 +1,181 @@
+#include "scoring.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ScoringModel::~ScoringModel()
+{
+    if (!view)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+    CloseHandle(HANDLE(mapping));
+#else
+    munmap((void*)view, viewSize);
+#endif
+}
+
+bool WriteScoringModel(const std::string& fileName, const std::vector<std::string>& columns, const std::vector<double>& coefficients)
+{
+    if (coefficients.size() != columns.size() + 1)
+        return false;
+
+    ScoringModelHeader header;
+    header.columnCount = uint32_t(columns.size());
+    size_t namesSize = 0;
+    for (const std::string& column : columns)
+        namesSize += column.size() + 1;
+    header.coefficientOffset = uint32_t((sizeof(header) + namesSize + 7) & ~size_t(7));
+
+    std::vector<char> bytes(header.coefficientOffset + coefficients.size() * sizeof(double), 0);
+    memcpy(bytes.data(), &header, sizeof(header));
+    char* cursor = bytes.data() + sizeof(header);
+    for (const std::string& column : columns)
+    {
+        memcpy(cursor, column.c_str(), column.size() + 1);
+        cursor += column.size() + 1;
+    }
+    memcpy(bytes.data() + header.coefficientOffset, coefficients.data(), coefficients.size() * sizeof(double));
+
+    // write a temporary file, then replace the model with it
+    std::string tempFileName = fileName + ".tmp";
+    FILE* file = nullptr;
+    fopen_s(&file, tempFileName.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(bytes.data(), bytes.size(), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        return false;
+    remove(fileName.c_str());
+    return rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
+
+std::shared_ptr<const ScoringModel> LoadScoringModel(const std::string& fileName)
+{
+    std::shared_ptr<ScoringModel> model = std::make_shared<ScoringModel>();
+    model->fileName = fileName;
+
+#ifdef _WIN32
+    // Windows won't replace a file while it's mapped, so the file is copied into shared memory backed by the paging file
+    // instead, and closed
+    FILE* file = nullptr;
+    fopen_s(&file, fileName.c_str(), "rb");
+    if (!file)
+    {
+        printf("could not open %s\n", fileName.c_str());
+        return nullptr;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    HANDLE mapping = (size > 0) ? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, DWORD(size), nullptr) : nullptr;
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size_t(size)) : nullptr;
+    bool ok = view && fread(view, size_t(size), 1, file) == 1;
+    fclose(file);
+    if (view)
+    {
+        model->view = (const char*)view;
+        model->viewSize = size_t(size);
+        model->mapping = mapping;
+    }
+    else if (mapping)
+    {
+        CloseHandle(mapping);
+    }
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        printf("could not open %s\n", fileName.c_str());
+        return nullptr;
+    }
+    struct stat fileStat;
+    void* view = (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) ? mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    bool ok = view != MAP_FAILED;
+    if (ok)
+    {
+        model->view = (const char*)view;
+        model->viewSize = size_t(fileStat.st_size);
+    }
+#endif
+    if (!ok)
+    {
+        printf("could not map %s\n", fileName.c_str());
+        return nullptr;
+    }
+
+    // check the header, and that the names and coefficients fit in the file
+    ScoringModelHeader header;
+    if (model->viewSize < sizeof(header))
+    {
+        printf("%s is not a scoring model\n", fileName.c_str());
+        return nullptr;
+    }
+    memcpy(&header, model->view, sizeof(header));
+    if (header.magic != c_scoringModelMagic || header.version != c_scoringModelVersion || (header.coefficientOffset & 7) != 0 ||
+        header.coefficientOffset < sizeof(header) || size_t(header.coefficientOffset) + (size_t(header.columnCount) + 1) * sizeof(double) != model->viewSize)
+    {
+        printf("%s is not a scoring model\n", fileName.c_str());
+        return nullptr;
+    }
+
+    const char* cursor = model->view + sizeof(header);
+    const char* namesEnd = model->view + header.coefficientOffset;
+    for (uint32_t column = 0; column < header.columnCount; ++column)
+    {
+        const char* end = (const char*)memchr(cursor, 0, size_t(namesEnd - cursor));
+        if (!end)
+        {
+            printf("%s is not a scoring model\n", fileName.c_str());
+            return nullptr;
+        }
+        model->columns.push_back(std::string(cursor, end));
+        cursor = end + 1;
+    }
+    model->coefficients = (const double*)namesEnd;
+    return model;
+}
+
+uint64_t FileStamp(const std::string& fileName)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &data))
+        return 0;
+    uint64_t writeTime = (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | uint64_t(data.ftLastWriteTime.dwLowDateTime);
+    return writeTime ^ (uint64_t(data.nFileSizeLow) << 40);
+#else
+    // the inode changes when a new file is renamed over the old one, even within the same second
+    struct stat fileStat;
+    if (stat(fileName.c_str(), &fileStat) != 0)
+        return 0;
+    return (uint64_t(fileStat.st_mtime) * 1000003) ^ (uint64_t(fileStat.st_ino) << 20) ^ uint64_t(fileStat.st_size) ^ 1;
+#endif
+}
+
+void ScoreBatch(const ScoringModel& model, const double* features, size_t rowCount, double* predictions)
+{
+    size_t columnCount = model.columns.size();
+    double constant = model.coefficients[columnCount];
+    for (size_t row = 0; row < rowCount; ++row)
+        predictions[row] = constant;
+
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        double coefficient = model.coefficients[column];
+        const double* x = features + column * rowCount;
+        for (size_t row = 0; row < rowCount; ++row)
+            predictions[row] += coefficient * x[row];
+    }
+}
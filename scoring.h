@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+
+Scoring models: fitted linear models saved in a form that other processes can score rows with.
+
+A scoring model file has a header, then the names of the data columns the model reads, then one coefficient per column and
+the constant. The coefficients start on an 8 byte boundary, so a mapping of the file can be used in place. Loading a model
+maps the file and checks the header, and scoring reads the coefficients straight out of the mapping.
+
+A file is written to a temporary file first and then renamed over the old one. A server watching the file never sees a
+half written model.
+
+*/
+
+static const uint32_t c_scoringModelMagic = 0x4D534752; // "RGSM"
+static const uint32_t c_scoringModelVersion = 1;
+
+struct ScoringModelHeader
+{
+    uint32_t magic = c_scoringModelMagic;
+    uint32_t version = c_scoringModelVersion;
+    uint32_t columnCount = 0;
+
+    // where the columnCount + 1 coefficients start, in bytes from the start of the file. The column names are between the
+    // header and the coefficients, each one ending with a 0.
+    uint32_t coefficientOffset = 0;
+};
+
+// A scoring model file, mapped into memory. Read only, so any number of threads can score with it at once.
+struct ScoringModel
+{
+    ~ScoringModel();
+
+    std::string fileName;
+    std::vector<std::string> columns;
+
+    // columns.size() + 1 of them, pointing into the mapping. The last one is the constant.
+    const double* coefficients = nullptr;
+
+    // the mapping
+    const char* view = nullptr;
+    size_t viewSize = 0;
+    void* mapping = nullptr;
+};
+
+bool WriteScoringModel(const std::string& fileName, const std::vector<std::string>& columns, const std::vector<double>& coefficients);
+
+// Maps a scoring model file. Returns null, and prints why, if it can't be read or isn't a scoring model.
+std::shared_ptr<const ScoringModel> LoadScoringModel(const std::string& fileName);
+
+// Something that changes whenever the file is replaced or written to, to tell when to load it again. 0 if it doesn't exist.
+uint64_t FileStamp(const std::string& fileName);
+
+// Scores a batch of rows. The features are column major: features[column * rowCount + row], with the columns in the order of
+// model.columns. Each column is a multiply add over every row, which the compiler vectorizes.
+void ScoreBatch(const ScoringModel& model, const double* features, size_t rowCount, double* predictions);
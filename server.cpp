@@ -0,0 +1,656 @@
+#include "server.h"
+#include "scoring.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// how often the batching thread checks the model file for changes
+static const double c_reloadCheckSeconds = 0.25f;
+
+// the most rows the batching thread scores in one pass. A request with more than this is a batch on its own.
+static const size_t c_maxBatchRows = 65536;
+
+// the biggest request the server accepts, in rows and in the bytes of its rows
+static const uint32_t c_maxRequestRows = 1 << 20;
+static const uint64_t c_maxRequestBytes = 256ull << 20;
+
+namespace
+{
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    const Socket c_invalidSocket = INVALID_SOCKET;
+    const int c_shutdownBoth = SD_BOTH;
+    const int c_sendFlags = 0;
+
+    void CloseSocket(Socket s)
+    {
+        closesocket(s);
+    }
+
+    bool StartSockets()
+    {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }
+
+    void StopSockets()
+    {
+        WSACleanup();
+    }
+#else
+    typedef int Socket;
+    const Socket c_invalidSocket = -1;
+    const int c_shutdownBoth = SHUT_RDWR;
+
+    // a client going away shouldn't kill the server with SIGPIPE
+#ifdef MSG_NOSIGNAL
+    const int c_sendFlags = MSG_NOSIGNAL;
+#else
+    const int c_sendFlags = 0;
+#endif
+
+    void CloseSocket(Socket s)
+    {
+        close(s);
+    }
+
+    bool StartSockets()
+    {
+        return true;
+    }
+
+    void StopSockets()
+    {
+    }
+#endif
+
+    bool MakeAddress(const std::string& path, sockaddr_un& address)
+    {
+        memset(&address, 0, sizeof(address));
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            printf("socket path %s is too long\n", path.c_str());
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    bool SendAll(Socket s, const void* data, size_t size)
+    {
+        const char* bytes = (const char*)data;
+        while (size > 0)
+        {
+            int sent = send(s, bytes, int(std::min(size, size_t(1 << 30))), c_sendFlags);
+            if (sent <= 0)
+                return false;
+            bytes += sent;
+            size -= size_t(sent);
+        }
+        return true;
+    }
+
+    bool ReceiveAll(Socket s, void* data, size_t size)
+    {
+        char* bytes = (char*)data;
+        while (size > 0)
+        {
+            int received = recv(s, bytes, int(std::min(size, size_t(1 << 30))), 0);
+            if (received <= 0)
+                return false;
+            bytes += received;
+            size -= size_t(received);
+        }
+        return true;
+    }
+
+    Socket Connect(const std::string& path)
+    {
+        sockaddr_un address;
+        if (!MakeAddress(path, address))
+            return c_invalidSocket;
+
+        Socket s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s == c_invalidSocket)
+            return c_invalidSocket;
+        if (connect(s, (const sockaddr*)&address, sizeof(address)) != 0)
+        {
+            CloseSocket(s);
+            return c_invalidSocket;
+        }
+        return s;
+    }
+
+    // A scoring request, from the connection thread that read it to the batching thread
+    struct PendingRequest
+    {
+        // row major
+        const double* rows = nullptr;
+        uint32_t rowCount = 0;
+        uint32_t columnCount = 0;
+
+        double* predictions = nullptr;
+        ScoringStatus status = ScoringStatus::Ok;
+        bool done = false;
+    };
+
+    struct ScoringServer
+    {
+        std::string modelFileName;
+
+        // the model new batches score with. The batching thread swaps in a new one when the file changes.
+        std::mutex modelMutex;
+        std::shared_ptr<const ScoringModel> model;
+
+        // the requests waiting to be batched, the connections, and whether to stop, under the mutex
+        std::mutex mutex;
+        std::condition_variable queueCondition;
+        std::condition_variable doneCondition;
+        std::deque<PendingRequest*> queue;
+        std::vector<Socket> connections;
+        bool stop = false;
+
+        // the threads of the connections, and the ones that are done and can be joined, under the mutex
+        std::vector<std::thread> connectionThreads;
+        std::vector<std::thread::id> finishedThreads;
+        Socket listenSocket = c_invalidSocket;
+
+        // what the server did, under the mutex
+        size_t requestCount = 0;
+        size_t rowCount = 0;
+        size_t batchCount = 0;
+        size_t reloadCount = 0;
+
+        std::shared_ptr<const ScoringModel> CurrentModel()
+        {
+            std::lock_guard<std::mutex> lock(modelMutex);
+            return model;
+        }
+
+        // Stops taking connections, and disconnects the ones there are. Requests already waiting are still scored.
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stop)
+                    return;
+                stop = true;
+                for (Socket connection : connections)
+                    shutdown(connection, c_shutdownBoth);
+                shutdown(listenSocket, c_shutdownBoth);
+#ifdef _WIN32
+                // closing it is what wakes up accept() on Windows
+                CloseSocket(listenSocket);
+                listenSocket = c_invalidSocket;
+#endif
+            }
+            queueCondition.notify_all();
+        }
+
+        void BatchThread()
+        {
+            uint64_t stamp = FileStamp(modelFileName);
+            std::chrono::high_resolution_clock::time_point lastCheck = std::chrono::high_resolution_clock::now();
+            std::vector<PendingRequest*> batch;
+            std::vector<double> features;
+            std::vector<double> predictions;
+            while (true)
+            {
+                // take every request that's waiting, up to the batch size
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    queueCondition.wait_for(lock, std::chrono::duration<double>(c_reloadCheckSeconds), [this]() { return stop || !queue.empty(); });
+                    if (stop && queue.empty())
+                        return;
+
+                    size_t batchRows = 0;
+                    batch.clear();
+                    while (!queue.empty() && (batch.empty() || batchRows + queue.front()->rowCount <= c_maxBatchRows))
+                    {
+                        batchRows += queue.front()->rowCount;
+                        batch.push_back(queue.front());
+                        queue.pop_front();
+                    }
+                }
+
+                // between batches, load the model again if the file changed
+                std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+                if (std::chrono::duration<double>(now - lastCheck).count() >= c_reloadCheckSeconds)
+                {
+                    lastCheck = now;
+                    uint64_t newStamp = FileStamp(modelFileName);
+                    if (newStamp != 0 && newStamp != stamp)
+                    {
+                        stamp = newStamp;
+                        std::shared_ptr<const ScoringModel> newModel = LoadScoringModel(modelFileName);
+                        if (newModel)
+                        {
+                            {
+                                std::lock_guard<std::mutex> lock(modelMutex);
+                                model = newModel;
+                            }
+                            std::lock_guard<std::mutex> lock(mutex);
+                            reloadCount++;
+                            printf("Reloaded %s (%zu columns)\n", modelFileName.c_str(), newModel->columns.size());
+                            fflush(stdout);
+                        }
+                    }
+                }
+
+                if (batch.empty())
+                    continue;
+
+                ScoreBatchRequests(batch, features, predictions);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (PendingRequest* request : batch)
+                    {
+                        request->done = true;
+                        requestCount++;
+                        rowCount += request->rowCount;
+                    }
+                    batchCount++;
+                }
+                doneCondition.notify_all();
+            }
+        }
+
+        // Scores the requests of a batch with one pass of the kernel, over all of their rows transposed to column major
+        void ScoreBatchRequests(const std::vector<PendingRequest*>& batch, std::vector<double>& features, std::vector<double>& predictions)
+        {
+            std::shared_ptr<const ScoringModel> batchModel = CurrentModel();
+            size_t columnCount = batchModel->columns.size();
+
+            size_t batchRows = 0;
+            for (PendingRequest* request : batch)
+            {
+                request->status = (request->columnCount == columnCount) ? ScoringStatus::Ok : ScoringStatus::WrongColumnCount;
+                if (request->status == ScoringStatus::Ok)
+                    batchRows += request->rowCount;
+            }
+
+            features.resize(columnCount * batchRows);
+            predictions.resize(batchRows);
+            size_t rowBegin = 0;
+            for (const PendingRequest* request : batch)
+            {
+                if (request->status != ScoringStatus::Ok)
+                    continue;
+                for (size_t row = 0; row < request->rowCount; ++row)
+                {
+                    for (size_t column = 0; column < columnCount; ++column)
+                        features[column * batchRows + rowBegin + row] = request->rows[row * columnCount + column];
+                }
+                rowBegin += request->rowCount;
+            }
+
+            ScoreBatch(*batchModel, features.data(), batchRows, predictions.data());
+
+            rowBegin = 0;
+            for (PendingRequest* request : batch)
+            {
+                if (request->status != ScoringStatus::Ok)
+                    continue;
+                std::copy(predictions.begin() + rowBegin, predictions.begin() + rowBegin + request->rowCount, request->predictions);
+                rowBegin += request->rowCount;
+            }
+        }
+
+        void ConnectionThread(Socket s)
+        {
+            std::vector<double> rows;
+            std::vector<double> predictions;
+            ScoringRequestHeader request;
+            while (ReceiveAll(s, &request, sizeof(request)) && request.magic == c_scoringProtocolMagic)
+            {
+                ScoringResponseHeader response;
+                if (request.type == ScoringRequestType::Describe)
+                {
+                    std::shared_ptr<const ScoringModel> describedModel = CurrentModel();
+                    std::string names;
+                    for (const std::string& column : describedModel->columns)
+                        names += (names.empty() ? "" : "\n") + column;
+                    response.rowCount = uint32_t(names.size());
+                    response.columnCount = uint32_t(describedModel->columns.size());
+                    if (!SendAll(s, &response, sizeof(response)) || !SendAll(s, names.data(), names.size()))
+                        break;
+                    continue;
+                }
+
+                if (request.type == ScoringRequestType::Stop)
+                {
+                    SendAll(s, &response, sizeof(response));
+                    Stop();
+                    break;
+                }
+
+                // the rows of a bad request can't be skipped safely, so the connection is closed after saying why. The size is
+                // checked before anything is allocated for the rows, and so is the column count, so a request can't make the
+                // server allocate more than the rows it could score.
+                uint64_t requestBytes = uint64_t(request.rowCount) * uint64_t(request.columnCount) * sizeof(double);
+                if (request.type != ScoringRequestType::Score || request.rowCount > c_maxRequestRows || requestBytes > c_maxRequestBytes)
+                {
+                    response.status = ScoringStatus::BadRequest;
+                    SendAll(s, &response, sizeof(response));
+                    break;
+                }
+                if (request.columnCount != CurrentModel()->columns.size())
+                {
+                    response.status = ScoringStatus::WrongColumnCount;
+                    response.columnCount = request.columnCount;
+                    SendAll(s, &response, sizeof(response));
+                    break;
+                }
+
+                rows.resize(size_t(request.rowCount) * size_t(request.columnCount));
+                if (!ReceiveAll(s, rows.data(), rows.size() * sizeof(double)))
+                    break;
+                predictions.resize(request.rowCount);
+
+                // hand it to the batching thread, and wait for it to be scored
+                PendingRequest pending;
+                pending.rows = rows.data();
+                pending.rowCount = request.rowCount;
+                pending.columnCount = request.columnCount;
+                pending.predictions = predictions.data();
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (stop)
+                        break;
+                    queue.push_back(&pending);
+                    queueCondition.notify_one();
+                    doneCondition.wait(lock, [&]() { return pending.done; });
+                }
+
+                response.status = pending.status;
+                response.rowCount = (pending.status == ScoringStatus::Ok) ? request.rowCount : 0;
+                response.columnCount = request.columnCount;
+                if (!SendAll(s, &response, sizeof(response)) || !SendAll(s, predictions.data(), response.rowCount * sizeof(double)))
+                    break;
+            }
+
+            // notified under the lock, since the server can be gone as soon as the lock is let go of
+            std::lock_guard<std::mutex> lock(mutex);
+            connections.erase(std::find(connections.begin(), connections.end(), s));
+            CloseSocket(s);
+            finishedThreads.push_back(std::this_thread::get_id());
+            doneCondition.notify_all();
+        }
+
+        // Joins the threads of the connections that are done. Call with the mutex locked. They don't take the lock again once
+        // they're done, so this doesn't wait on anything.
+        void JoinFinishedThreads()
+        {
+            for (std::thread::id id : finishedThreads)
+            {
+                auto it = std::find_if(connectionThreads.begin(), connectionThreads.end(), [id](const std::thread& thread) { return thread.get_id() == id; });
+                it->join();
+                connectionThreads.erase(it);
+            }
+            finishedThreads.clear();
+        }
+    };
+}
+
+int RunScoringServer(const std::string& modelFileName, const std::string& socketPath)
+{
+    ScoringServer server;
+    server.modelFileName = modelFileName;
+    server.model = LoadScoringModel(modelFileName);
+    if (!server.model)
+        return 1;
+
+    sockaddr_un address;
+    if (!MakeAddress(socketPath, address) || !StartSockets())
+        return 1;
+
+    // a socket file left behind by a server that didn't shut down cleanly would make bind() fail
+    remove(socketPath.c_str());
+    server.listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listenSocket == c_invalidSocket || bind(server.listenSocket, (const sockaddr*)&address, sizeof(address)) != 0 || listen(server.listenSocket, SOMAXCONN) != 0)
+    {
+        printf("could not listen on %s\n", socketPath.c_str());
+        if (server.listenSocket != c_invalidSocket)
+            CloseSocket(server.listenSocket);
+        StopSockets();
+        return 1;
+    }
+
+    printf("Serving %s (%zu columns) on %s\n", modelFileName.c_str(), server.model->columns.size(), socketPath.c_str());
+    fflush(stdout);
+
+    std::thread batchThread([&server]() { server.BatchThread(); });
+    while (true)
+    {
+        Socket s = accept(server.listenSocket, nullptr, nullptr);
+        std::lock_guard<std::mutex> lock(server.mutex);
+        if (server.stop)
+        {
+            if (s != c_invalidSocket)
+                CloseSocket(s);
+            break;
+        }
+        if (s == c_invalidSocket)
+        {
+            printf("could not accept a connection on %s\n", socketPath.c_str());
+            break;
+        }
+
+        // each connection has a thread of its own, which removes it from the list when it's done, and is joined after that
+        server.JoinFinishedThreads();
+        server.connections.push_back(s);
+        server.connectionThreads.push_back(std::thread([&server, s]() { server.ConnectionThread(s); }));
+    }
+
+    // wait for the connections to finish, and the batching thread to score what they sent
+    server.Stop();
+    {
+        std::unique_lock<std::mutex> lock(server.mutex);
+        server.doneCondition.wait(lock, [&server]() { return server.connections.empty(); });
+        server.JoinFinishedThreads();
+    }
+    batchThread.join();
+    if (server.listenSocket != c_invalidSocket)
+        CloseSocket(server.listenSocket);
+    remove(socketPath.c_str());
+    StopSockets();
+
+    printf("Served %zu requests, %zu rows in %zu batches (%0.1f rows per batch). Reloaded the model %zu times.\n",
+        server.requestCount, server.rowCount, server.batchCount, server.batchCount > 0 ? double(server.rowCount) / double(server.batchCount) : 0.0f, server.reloadCount);
+    return 0;
+}
+
+int RunLoadGenerator(const std::string& socketPath, size_t connectionCount, size_t requestCount, size_t rowsPerRequest, bool stopServer)
+{
+    if (!StartSockets())
+        return 1;
+
+    // ask the server which columns the model reads
+    Socket control = Connect(socketPath);
+    if (control == c_invalidSocket)
+    {
+        printf("could not connect to %s\n", socketPath.c_str());
+        StopSockets();
+        return 1;
+    }
+    ScoringRequestHeader describe;
+    describe.type = ScoringRequestType::Describe;
+    ScoringResponseHeader description;
+    std::string names;
+    bool described = SendAll(control, &describe, sizeof(describe)) && ReceiveAll(control, &description, sizeof(description));
+    if (described)
+    {
+        names.resize(description.rowCount);
+        described = ReceiveAll(control, &names[0], names.size());
+    }
+    if (!described)
+    {
+        printf("could not get the model's columns from %s\n", socketPath.c_str());
+        CloseSocket(control);
+        StopSockets();
+        return 1;
+    }
+
+    // the requests are rows of the test data, in the model's columns
+    CSV test;
+    if (!LoadCSV("data/test.csv", test) || test.data.empty())
+    {
+        printf("could not load data/test.csv");
+        CloseSocket(control);
+        StopSockets();
+        return 1;
+    }
+    std::vector<int> columns;
+    size_t begin = 0;
+    while (description.columnCount > 0 && begin <= names.size())
+    {
+        size_t end = std::min(names.find('\n', begin), names.size());
+        std::string name = names.substr(begin, end - begin);
+        int index = test.GetHeaderIndex(name.c_str());
+        if (index == -1)
+        {
+            printf("Couldn't find %s column.\n", name.c_str());
+            CloseSocket(control);
+            StopSockets();
+            return 1;
+        }
+        columns.push_back(index);
+        begin = end + 1;
+    }
+    int salesIndex = test.GetHeaderIndex("Item_Outlet_Sales");
+
+    // connect everything before starting the clock
+    std::vector<Socket> connections;
+    for (size_t connectionIndex = 0; connectionIndex < connectionCount; ++connectionIndex)
+    {
+        Socket s = Connect(socketPath);
+        if (s == c_invalidSocket)
+            break;
+        connections.push_back(s);
+    }
+    if (connections.size() < connectionCount)
+    {
+        printf("could only make %zu of %zu connections to %s\n", connections.size(), connectionCount, socketPath.c_str());
+        for (Socket s : connections)
+            CloseSocket(s);
+        CloseSocket(control);
+        StopSockets();
+        return 1;
+    }
+
+    // every connection sends its requests one after another, all of the connections at once
+    std::vector<std::vector<double>> latencies(connectionCount);
+    std::vector<double> squaredErrors(connectionCount, 0.0f);
+    std::vector<size_t> failures(connectionCount, 0);
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t connectionIndex = 0; connectionIndex < connectionCount; ++connectionIndex)
+    {
+        threads.emplace_back(
+            [&, connectionIndex]()
+            {
+                Socket s = connections[connectionIndex];
+                ScoringRequestHeader request;
+                request.rowCount = uint32_t(rowsPerRequest);
+                request.columnCount = uint32_t(columns.size());
+                std::vector<double> rows(rowsPerRequest * columns.size());
+                std::vector<double> predictions(rowsPerRequest);
+                std::vector<size_t> rowIndices(rowsPerRequest);
+                for (size_t requestIndex = 0; requestIndex < requestCount; ++requestIndex)
+                {
+                    // the next rows of the test data, picking up where the last request left off
+                    for (size_t row = 0; row < rowsPerRequest; ++row)
+                    {
+                        rowIndices[row] = ((connectionIndex * requestCount + requestIndex) * rowsPerRequest + row) % test.data.size();
+                        for (size_t column = 0; column < columns.size(); ++column)
+                            rows[row * columns.size() + column] = test.data[rowIndices[row]][columns[column]];
+                    }
+
+                    std::chrono::high_resolution_clock::time_point sent = std::chrono::high_resolution_clock::now();
+                    ScoringResponseHeader response;
+                    bool ok = SendAll(s, &request, sizeof(request)) && SendAll(s, rows.data(), rows.size() * sizeof(double)) &&
+                        ReceiveAll(s, &response, sizeof(response)) && response.status == ScoringStatus::Ok && response.rowCount == request.rowCount &&
+                        ReceiveAll(s, predictions.data(), predictions.size() * sizeof(double));
+                    if (!ok)
+                    {
+                        failures[connectionIndex] += requestCount - requestIndex;
+                        break;
+                    }
+                    latencies[connectionIndex].push_back(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - sent).count());
+
+                    if (salesIndex != -1)
+                    {
+                        for (size_t row = 0; row < rowsPerRequest; ++row)
+                            squaredErrors[connectionIndex] += sqr(predictions[row] - test.data[rowIndices[row]][salesIndex]);
+                    }
+                }
+            }
+        );
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    for (Socket s : connections)
+        CloseSocket(s);
+
+    // gather up the results
+    std::vector<double> allLatencies;
+    double squaredError = 0.0f;
+    size_t failureCount = 0;
+    for (size_t connectionIndex = 0; connectionIndex < connectionCount; ++connectionIndex)
+    {
+        allLatencies.insert(allLatencies.end(), latencies[connectionIndex].begin(), latencies[connectionIndex].end());
+        squaredError += squaredErrors[connectionIndex];
+        failureCount += failures[connectionIndex];
+    }
+    std::sort(allLatencies.begin(), allLatencies.end());
+    auto percentile = [&](double fraction)
+    {
+        if (allLatencies.empty())
+            return 0.0;
+        return allLatencies[std::min(size_t(fraction * double(allLatencies.size())), allLatencies.size() - 1)];
+    };
+
+    if (connectionCount > 0)
+    {
+        printf("%zu connections x %zu requests of %zu rows in %0.3f seconds, %zu failed\n", connectionCount, requestCount, rowsPerRequest, seconds, failureCount);
+        printf("  throughput: %0.0f requests/s, %0.0f rows/s\n", double(allLatencies.size()) / seconds, double(allLatencies.size() * rowsPerRequest) / seconds);
+        printf("  latency: p50 %0.3f ms, p99 %0.3f ms, max %0.3f ms\n", percentile(0.5f) * 1000.0f, percentile(0.99f) * 1000.0f, percentile(1.0f) * 1000.0f);
+        if (salesIndex != -1 && !allLatencies.empty())
+            printf("  RMSE of the predictions against the sales: %0.2f\n", sqrt(squaredError / double(allLatencies.size() * rowsPerRequest)));
+    }
+
+    if (stopServer)
+    {
+        ScoringRequestHeader stopRequest;
+        stopRequest.type = ScoringRequestType::Stop;
+        ScoringResponseHeader response;
+        if (!SendAll(control, &stopRequest, sizeof(stopRequest)) || !ReceiveAll(control, &response, sizeof(response)))
+            printf("could not stop the server\n");
+    }
+    CloseSocket(control);
+    StopSockets();
+    return (failureCount > 0) ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+/*
+
+A scoring server, which scores rows with a scoring model for other processes over a Unix domain socket, and a load generator
+to measure it.
+
+Each request on a connection is a header and then its rows, row major. The response is a header and then one prediction per
+row. A request that is too big, or doesn't have the model's number of columns, gets a response saying so, and the
+connection is closed without reading its rows. Every connection has a thread that reads its requests, and hands their rows to a single batching thread:
+
+* Batching - the batching thread takes every request that's waiting at once, so when many clients are sending, one pass of
+  the scoring kernel does all of them. The rows are transposed to column major for the kernel, and the predictions are handed
+  back to each connection's thread to send.
+* Hot reload - the batching thread checks the model file between batches. When it changes, the new file is mapped and
+  swapped in. A batch holds a reference to the model it started with, so nothing in flight is dropped or sees half of a swap,
+  and the old mapping goes away when the last batch using it is done. A file that fails to load leaves the old model in place.
+
+The load generator opens some connections, sends requests of test rows on all of them at once, and reports the throughput and
+the latency percentiles. It also checks the predictions against the sales in the test data.
+
+*/
+
+static const uint32_t c_scoringProtocolMagic = 0x50534752; // "RGSP"
+
+enum class ScoringRequestType : uint32_t
+{
+    // score rowCount rows of columnCount values each
+    Score,
+
+    // get the model's column names. The response's rowCount is the size of the names, which follow it, separated by newlines.
+    Describe,
+
+    // stop the server
+    Stop
+};
+
+enum class ScoringStatus : uint32_t
+{
+    Ok,
+    WrongColumnCount,
+    BadRequest
+};
+
+struct ScoringRequestHeader
+{
+    uint32_t magic = c_scoringProtocolMagic;
+    ScoringRequestType type = ScoringRequestType::Score;
+    uint32_t rowCount = 0;
+    uint32_t columnCount = 0;
+};
+
+struct ScoringResponseHeader
+{
+    uint32_t magic = c_scoringProtocolMagic;
+    ScoringStatus status = ScoringStatus::Ok;
+    uint32_t rowCount = 0;
+    uint32_t columnCount = 0;
+};
+
+// Serves the scoring model until a client asks it to stop. Returns the process exit code.
+int RunScoringServer(const std::string& modelFileName, const std::string& socketPath);
+
+// Sends requestCount requests of rowsPerRequest test rows on each of connectionCount connections at once, and reports how it
+// went. Asks the server to stop afterwards if stopServer is true. Returns the process exit code.
+int RunLoadGenerator(const std::string& socketPath, size_t connectionCount, size_t requestCount, size_t rowsPerRequest, bool stopServer);
@@ -0,0 +1,336 @@
+#include "trees.h"
+#include "scheduler.h"
+#include <algorithm>
+
+// roughly how many row bins each task reads when building histograms, so small nodes don't get split into tiny tasks
+static const size_t c_histogramGrainSize = 16384;
+
+namespace
+{
+    struct HistogramBin
+    {
+        double sum = 0.0f;
+        size_t count = 0;
+    };
+
+    // A node that is being built. It owns the rows [begin, end) of the row index array, and has a histogram per feature.
+    struct BuildNode
+    {
+        int nodeIndex = -1;
+        size_t begin = 0;
+        size_t end = 0;
+        double sum = 0.0f;
+        std::vector<HistogramBin> histogram;
+
+        size_t Count() const
+        {
+            return end - begin;
+        }
+    };
+
+    struct Split
+    {
+        bool valid = false;
+        size_t feature = 0;
+        size_t bin = 0;
+        double gain = 0.0f;
+        BuildNode left;
+        BuildNode right;
+    };
+
+    // Everything that stays the same over all the trees
+    struct TreeBuilder
+    {
+        const BinMapper* mapper = nullptr;
+        const BinnedData* binned = nullptr;
+        const TreeSettings* settings = nullptr;
+
+        // where each feature's bins start in a histogram
+        std::vector<size_t> featureOffsets;
+        size_t histogramSize = 0;
+
+        // the residuals being fit, and the order of the rows, which gets partitioned as nodes split
+        std::vector<double> residuals;
+        std::vector<size_t> rows;
+
+        void BuildHistogram(BuildNode& node) const
+        {
+            node.histogram.assign(histogramSize, HistogramBin());
+
+            size_t featureCount = featureOffsets.size();
+            size_t grainSize = std::max<size_t>(1, c_histogramGrainSize / std::max<size_t>(1, node.Count()));
+            ParallelFor(0, featureCount, grainSize,
+                [&](size_t feature)
+                {
+                    const uint8_t* bins = binned->FeatureBins(feature);
+                    HistogramBin* histogram = &node.histogram[featureOffsets[feature]];
+                    for (size_t index = node.begin; index < node.end; ++index)
+                    {
+                        size_t row = rows[index];
+                        HistogramBin& bin = histogram[bins[row]];
+                        bin.sum += residuals[row];
+                        bin.count++;
+                    }
+                }
+            );
+        }
+
+        double Score(double sum, size_t count) const
+        {
+            return sum * sum / (double(count) + settings->L2RegAlpha);
+        }
+
+        // sweeps the histogram of every feature for the split with the most gain
+        void FindSplit(const BuildNode& node, Split& split) const
+        {
+            double parentScore = Score(node.sum, node.Count());
+            for (size_t feature = 0; feature < featureOffsets.size(); ++feature)
+            {
+                const HistogramBin* histogram = &node.histogram[featureOffsets[feature]];
+                size_t binCount = mapper->edges[feature].size();
+
+                double leftSum = 0.0f;
+                size_t leftCount = 0;
+                for (size_t bin = 0; bin + 1 < binCount; ++bin)
+                {
+                    leftSum += histogram[bin].sum;
+                    leftCount += histogram[bin].count;
+                    size_t rightCount = node.Count() - leftCount;
+                    if (leftCount < settings->minLeafSamples)
+                        continue;
+                    if (rightCount < settings->minLeafSamples)
+                        break;
+
+                    double gain = Score(leftSum, leftCount) + Score(node.sum - leftSum, rightCount) - parentScore;
+                    if (gain > split.gain)
+                    {
+                        split.valid = true;
+                        split.feature = feature;
+                        split.bin = bin;
+                        split.gain = gain;
+                    }
+                }
+            }
+        }
+
+        // splits the rows of the node, and makes the histograms of the children
+        void SplitNode(const BuildNode& node, Split& split)
+        {
+            const uint8_t* bins = binned->FeatureBins(split.feature);
+            uint8_t splitBin = uint8_t(split.bin);
+            size_t* middle = std::partition(&rows[node.begin], &rows[0] + node.end, [&](size_t row) { return bins[row] <= splitBin; });
+
+            split.left.begin = node.begin;
+            split.left.end = size_t(middle - &rows[0]);
+            split.right.begin = split.left.end;
+            split.right.end = node.end;
+
+            // build the histograms of the smaller child from its rows, and get the larger child's by subtracting from the parent
+            BuildNode& smaller = (split.left.Count() <= split.right.Count()) ? split.left : split.right;
+            BuildNode& larger = (split.left.Count() <= split.right.Count()) ? split.right : split.left;
+            BuildHistogram(smaller);
+
+            larger.histogram.resize(histogramSize);
+            for (size_t index = 0; index < histogramSize; ++index)
+            {
+                larger.histogram[index].sum = node.histogram[index].sum - smaller.histogram[index].sum;
+                larger.histogram[index].count = node.histogram[index].count - smaller.histogram[index].count;
+            }
+
+            // the sums of the children, from the histogram of the split feature
+            const HistogramBin* histogram = &split.left.histogram[featureOffsets[split.feature]];
+            split.left.sum = 0.0f;
+            for (size_t bin = 0; bin < mapper->edges[split.feature].size(); ++bin)
+                split.left.sum += histogram[bin].sum;
+            split.right.sum = node.sum - split.left.sum;
+        }
+
+        // Builds a tree fitting the residuals, and adds the tree's leaf values to the predictions of the rows
+        void BuildTree(RegressionTree& tree, std::vector<double>& predictions, std::vector<double>& featureGain)
+        {
+            tree.nodes.clear();
+            tree.nodes.push_back(TreeNode());
+
+            std::vector<BuildNode> level(1);
+            level[0].nodeIndex = 0;
+            level[0].begin = 0;
+            level[0].end = rows.size();
+            for (size_t row : rows)
+                level[0].sum += residuals[row];
+            BuildHistogram(level[0]);
+
+            for (int depth = 0; !level.empty(); ++depth)
+            {
+                // split the nodes of this level in parallel
+                std::vector<Split> splits(level.size());
+                ParallelFor(0, level.size(), 1,
+                    [&](size_t levelIndex)
+                    {
+                        if (depth >= settings->maxDepth)
+                            return;
+                        FindSplit(level[levelIndex], splits[levelIndex]);
+                        if (splits[levelIndex].valid)
+                            SplitNode(level[levelIndex], splits[levelIndex]);
+                    }
+                );
+
+                // make the tree nodes in level order, so the tree is the same no matter what order the splits finished in
+                std::vector<BuildNode> nextLevel;
+                for (size_t levelIndex = 0; levelIndex < level.size(); ++levelIndex)
+                {
+                    BuildNode& node = level[levelIndex];
+                    Split& split = splits[levelIndex];
+                    TreeNode& treeNode = tree.nodes[node.nodeIndex];
+                    if (!split.valid)
+                    {
+                        // a leaf. Its value is the regularized mean of its residuals, scaled by the learning rate.
+                        treeNode.value = settings->learningRate * node.sum / (double(node.Count()) + settings->L2RegAlpha);
+                        for (size_t index = node.begin; index < node.end; ++index)
+                            predictions[rows[index]] += treeNode.value;
+                        continue;
+                    }
+
+                    treeNode.column = mapper->columns[split.feature];
+                    treeNode.threshold = mapper->edges[split.feature][split.bin];
+                    treeNode.left = int(tree.nodes.size());
+                    treeNode.right = int(tree.nodes.size() + 1);
+                    featureGain[split.feature] += split.gain;
+
+                    split.left.nodeIndex = treeNode.left;
+                    split.right.nodeIndex = treeNode.right;
+                    tree.nodes.push_back(TreeNode());
+                    tree.nodes.push_back(TreeNode());
+                    nextLevel.push_back(std::move(split.left));
+                    nextLevel.push_back(std::move(split.right));
+                }
+                level = std::move(nextLevel);
+            }
+        }
+    };
+}
+
+uint8_t BinMapper::Bin(size_t feature, double value) const
+{
+    const std::vector<double>& featureEdges = edges[feature];
+    size_t bin = size_t(std::lower_bound(featureEdges.begin(), featureEdges.end(), value) - featureEdges.begin());
+    return uint8_t((bin < featureEdges.size()) ? bin : featureEdges.size() - 1);
+}
+
+double RegressionTree::Predict(const std::vector<double>& row) const
+{
+    int nodeIndex = 0;
+    while (nodes[nodeIndex].column >= 0)
+    {
+        const TreeNode& node = nodes[nodeIndex];
+        nodeIndex = (row[node.column] <= node.threshold) ? node.left : node.right;
+    }
+    return nodes[nodeIndex].value;
+}
+
+double BoostedTrees::Predict(const std::vector<double>& row) const
+{
+    double ret = baseValue;
+    for (const RegressionTree& tree : trees)
+        ret += tree.Predict(row);
+    return ret;
+}
+
+void CalculateBins(const CSV& data, const std::vector<int>& columns, int maxBins, BinMapper& mapper)
+{
+    if (maxBins > 256)
+        maxBins = 256;
+    if (maxBins < 2)
+        maxBins = 2;
+
+    mapper.columns = columns;
+    mapper.edges.resize(columns.size());
+    ParallelFor(0, columns.size(), 1,
+        [&](size_t feature)
+        {
+            std::vector<double> values(data.data.size());
+            for (size_t row = 0; row < data.data.size(); ++row)
+                values[row] = data.data[row][columns[feature]];
+            std::sort(values.begin(), values.end());
+
+            std::vector<double> unique = values;
+            unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+            // a bin per value if there are few enough of them, otherwise bins at quantiles
+            std::vector<double>& edges = mapper.edges[feature];
+            if (unique.size() <= size_t(maxBins))
+            {
+                edges = unique;
+            }
+            else
+            {
+                edges.clear();
+                for (int bin = 1; bin <= maxBins; ++bin)
+                {
+                    double edge = values[(size_t(bin) * values.size()) / size_t(maxBins) - 1];
+                    if (edges.empty() || edge > edges.back())
+                        edges.push_back(edge);
+                }
+            }
+
+            if (edges.empty())
+                edges.push_back(0.0f);
+        }
+    );
+}
+
+void ApplyBins(const CSV& data, const BinMapper& mapper, BinnedData& binned)
+{
+    binned.rowCount = data.data.size();
+    binned.bins.resize(mapper.columns.size() * binned.rowCount);
+    ParallelFor(0, mapper.columns.size(), 1,
+        [&](size_t feature)
+        {
+            uint8_t* bins = &binned.bins[feature * binned.rowCount];
+            for (size_t row = 0; row < binned.rowCount; ++row)
+                bins[row] = mapper.Bin(feature, data.data[row][mapper.columns[feature]]);
+        }
+    );
+}
+
+void TrainBoostedTrees(const CSV& data, const std::vector<int>& columns, int valueIndex, const TreeSettings& settings, BoostedTrees& model)
+{
+    // bin the features once, up front
+    BinMapper mapper;
+    CalculateBins(data, columns, settings.maxBins, mapper);
+    BinnedData binned;
+    ApplyBins(data, mapper, binned);
+
+    TreeBuilder builder;
+    builder.mapper = &mapper;
+    builder.binned = &binned;
+    builder.settings = &settings;
+    for (const std::vector<double>& edges : mapper.edges)
+    {
+        builder.featureOffsets.push_back(builder.histogramSize);
+        builder.histogramSize += edges.size();
+    }
+
+    // start by predicting the mean
+    size_t rowCount = data.data.size();
+    Average mean;
+    for (const auto& row : data.data)
+        mean.AddSample(row[valueIndex]);
+    model.baseValue = mean.average;
+    model.trees.resize(settings.treeCount);
+    model.featureGain.assign(columns.size(), 0.0f);
+
+    std::vector<double> predictions(rowCount, model.baseValue);
+    builder.residuals.resize(rowCount);
+    builder.rows.resize(rowCount);
+    for (RegressionTree& tree : model.trees)
+    {
+        // each tree fits what the trees before it got wrong
+        for (size_t row = 0; row < rowCount; ++row)
+        {
+            builder.residuals[row] = data.data[row][valueIndex] - predictions[row];
+            builder.rows[row] = row;
+        }
+
+        builder.BuildTree(tree, predictions, model.featureGain);
+    }
+}
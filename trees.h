@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "utils.h"
+
+/*
+
+Histogram based regression trees and gradient boosting.
+
+* Binning - every feature column is turned into small integers (bins) once, up front. Columns with few distinct values,
+  like the one hot columns, get a bin per value. Continuous columns like Item_MRP get bins at quantiles of the training data.
+  The bins are stored a column at a time as bytes, so a pass over one feature of a node's rows is a pass over a byte array.
+* Splits - a node makes a histogram per feature of the sum of residuals and the count of rows in each bin. The best split of a
+  feature is found by sweeping its histogram, so it costs the number of bins instead of a sort of the rows.
+* Histogram subtraction - when a node splits, only the smaller child builds its histograms from rows. The larger child's
+  histograms are the parent's minus the smaller child's.
+* Parallelism - the nodes of each level of a tree are split in parallel, and each node builds the histograms of its features
+  in parallel, all on the task scheduler.
+* Boosting - each tree fits the residuals of the trees before it, scaled by a learning rate. One tree with a learning rate of 1
+  is a plain regression tree.
+
+*/
+
+struct TreeSettings
+{
+    size_t treeCount = 100;
+    double learningRate = 0.1f;
+    int maxDepth = 6;
+    size_t minLeafSamples = 20;
+
+    // L2 regularization of the leaf values. Leaf value = sum of residuals / (count + L2RegAlpha)
+    double L2RegAlpha = 1.0f;
+
+    // at most 256, so bins fit in a byte
+    int maxBins = 64;
+};
+
+// How to turn the values of the feature columns into bins
+struct BinMapper
+{
+    // the data column of each feature
+    std::vector<int> columns;
+
+    // per feature, the largest value in each bin. A value goes in the first bin whose edge is >= the value.
+    std::vector<std::vector<double>> edges;
+
+    uint8_t Bin(size_t feature, double value) const;
+};
+
+// The bins of every feature of every row. Stored a feature at a time: bins[feature * rowCount + row]
+struct BinnedData
+{
+    size_t rowCount = 0;
+    std::vector<uint8_t> bins;
+
+    const uint8_t* FeatureBins(size_t feature) const
+    {
+        return &bins[feature * rowCount];
+    }
+};
+
+struct TreeNode
+{
+    // the data column and threshold the node splits on. Rows with value <= threshold go left. -1 for leaves.
+    int column = -1;
+    double threshold = 0.0f;
+    int left = -1;
+    int right = -1;
+
+    // what a leaf adds to the prediction
+    double value = 0.0f;
+};
+
+struct RegressionTree
+{
+    std::vector<TreeNode> nodes;
+
+    double Predict(const std::vector<double>& row) const;
+};
+
+struct BoostedTrees
+{
+    double baseValue = 0.0f;
+    std::vector<RegressionTree> trees;
+
+    // total split gain of each feature over all the trees, for seeing which features matter
+    std::vector<double> featureGain;
+
+    double Predict(const std::vector<double>& row) const;
+};
+
+// Calculates bin edges for the feature columns from the training data
+void CalculateBins(const CSV& data, const std::vector<int>& columns, int maxBins, BinMapper& mapper);
+
+void ApplyBins(const CSV& data, const BinMapper& mapper, BinnedData& binned);
+
+// Trains boosted trees to predict the value column of the data from the feature columns
+void TrainBoostedTrees(const CSV& data, const std::vector<int>& columns, int valueIndex, const TreeSettings& settings, BoostedTrees& model);
@@ -1,4 +1,72 @@
 #include "utils.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// how many bits the distinct count estimate of each column hashes its values into
+static const size_t c_distinctCountBits = 1 << 16;
+
+namespace
+{
+    // Accumulates the statistics of a column a value at a time
+    struct ColumnStatsBuilder
+    {
+        Average mean;
+        Average meanSquared;
+        double min = DBL_MAX;
+        double max = -DBL_MAX;
+        bool binary = true;
+        std::vector<uint64_t> seen;
+
+        void AddSample(double value)
+        {
+            mean.AddSample(value);
+            meanSquared.AddSample(value * value);
+            min = std::min(min, value);
+            max = std::max(max, value);
+            binary = binary && (value == 0.0f || value == 1.0f);
+
+            // the splitmix64 finalizer of the bits of the value picks the bit it sets
+            uint64_t hash = 0;
+            memcpy(&hash, &value, sizeof(hash));
+            hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+            hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+            hash ^= hash >> 31;
+            if (seen.empty())
+                seen.assign(c_distinctCountBits / 64, 0);
+            size_t bit = size_t(hash % c_distinctCountBits);
+            seen[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+
+        ColumnStats Stats() const
+        {
+            ColumnStats ret;
+            if (mean.samples == 0)
+                return ret;
+
+            ret.min = min;
+            ret.max = max;
+            ret.mean = mean.average;
+            ret.variance = std::max(meanSquared.average - mean.average * mean.average, 0.0);
+            ret.binary = binary;
+
+            // linear counting: with n distinct values hashed into m bits, about m * e^(-n/m) of them are still 0
+            size_t zeroCount = c_distinctCountBits;
+            for (uint64_t word : seen)
+            {
+                for (; word != 0; word &= word - 1)
+                    zeroCount--;
+            }
+            double m = double(c_distinctCountBits);
+            ret.distinctCount = floor(m * log(m / double(std::max(zeroCount, size_t(1)))) + 0.5f);
+            return ret;
+        }
+    };
+}
 
 bool GetNextToken(const char*& cursor, std::string& token, bool& EOL)
 {
@@ -33,6 +101,12 @@ bool GetNextToken(const char*& cursor, std::string& token, bool& EOL)
 }
 
 bool LoadCSV(const char* fileName, CSV& csv)
+{
+    std::vector<ColumnStats> stats;
+    return LoadCSV(fileName, csv, stats);
+}
+
+bool LoadCSV(const char* fileName, CSV& csv, std::vector<ColumnStats>& stats)
 {
     // open the file
     FILE* file = nullptr;
@@ -53,6 +127,7 @@ bool LoadCSV(const char* fileName, CSV& csv)
     bool EOL = false;
     bool didHeaders = false;
     bool lastTokenWasEOL = false;
+    std::vector<ColumnStatsBuilder> builders;
     while (*cursor)
     {
         GetNextToken(cursor, nextToken, EOL);
@@ -63,12 +138,19 @@ bool LoadCSV(const char* fileName, CSV& csv)
         {
             csv.headers.push_back(nextToken);
             didHeaders = EOL;
+            if (didHeaders)
+                builders.resize(csv.headers.size());
         }
         else
         {
             float value = 0.0f;
             if (sscanf_s(nextToken.c_str(), "%f", &value) == 1)
-                csv.data.rbegin()->push_back(value);
+            {
+                std::vector<double>& row = *csv.data.rbegin();
+                if (row.size() < builders.size())
+                    builders[row.size()].AddSample(value);
+                row.push_back(value);
+            }
         }
 
         lastTokenWasEOL = EOL;
@@ -83,6 +165,283 @@ bool LoadCSV(const char* fileName, CSV& csv)
             return false;
     }
 
+    stats.resize(builders.size());
+    for (size_t column = 0; column < builders.size(); ++column)
+        stats[column] = builders[column].Stats();
+
     // return success
     return true;
+}
+
+// Reads a line, including its line ending. Returns false if there isn't a complete line.
+static bool ReadLine(FILE* file, std::string& line)
+{
+    line.clear();
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), file))
+    {
+        line += buffer;
+        if (line.back() == '\n')
+            return true;
+    }
+    return false;
+}
+
+bool ReadCSVHeaders(const char* fileName, CSV& csv, size_t& dataOffset)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, "rb");
+    if (!file)
+        return false;
+
+    std::string line;
+    bool readLine = ReadLine(file, line);
+    fclose(file);
+    if (!readLine)
+        return false;
+
+    csv.headers.clear();
+    const char* cursor = line.c_str();
+    std::string nextToken;
+    bool EOL = false;
+    while (*cursor && !EOL)
+    {
+        GetNextToken(cursor, nextToken, EOL);
+        csv.headers.push_back(nextToken);
+    }
+
+    dataOffset = line.size();
+    return true;
+}
+
+bool ReadCSVRows(const char* fileName, size_t offset, size_t maxRows, CSV& csv, size_t& endOffset)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, "rb");
+    if (!file)
+        return false;
+
+    // the file can't be shorter than where we start reading, or it isn't the file we read before
+    fseek(file, 0, SEEK_END);
+    size_t fileSize = size_t(ftell(file));
+    if (offset > fileSize)
+    {
+        fclose(file);
+        return false;
+    }
+    fseek(file, long(offset), SEEK_SET);
+
+    endOffset = offset;
+    std::string line;
+    std::string nextToken;
+    size_t rowCount = 0;
+    while (rowCount < maxRows && ReadLine(file, line))
+    {
+        endOffset += line.size();
+
+        std::vector<double> row;
+        const char* cursor = line.c_str();
+        bool EOL = false;
+        while (*cursor && !EOL)
+        {
+            GetNextToken(cursor, nextToken, EOL);
+            float value = 0.0f;
+            if (sscanf_s(nextToken.c_str(), "%f", &value) == 1)
+                row.push_back(value);
+        }
+
+        // skip blank lines, and make sure we have rectangular shaped data
+        if (row.empty())
+            continue;
+        if (row.size() != csv.headers.size())
+        {
+            fclose(file);
+            return false;
+        }
+
+        csv.data.push_back(row);
+        rowCount++;
+    }
+
+    fclose(file);
+    return true;
+}
+
+void CalculateStandardization(const std::vector<ColumnStats>& stats, const std::vector<int>& skipColumns, Standardization& standardization)
+{
+    size_t columnCount = stats.size();
+    standardization.skip.assign(columnCount, false);
+    for (int column : skipColumns)
+        standardization.skip[column] = true;
+
+    // the mean and variance of each column are from when the data was loaded
+    standardization.mean.resize(columnCount);
+    standardization.scale.resize(columnCount);
+    for (size_t column = 0; column < columnCount; ++column)
+    {
+        standardization.mean[column] = stats[column].mean;
+        standardization.scale[column] = (stats[column].variance > 0.0f) ? sqrt(stats[column].variance) : 1.0f;
+    }
+}
+
+void Standardize(const CSV& data, const Standardization& standardization, CSV& standardized)
+{
+    standardized.headers = data.headers;
+    standardized.data = data.data;
+    for (auto& row : standardized.data)
+    {
+        for (size_t column = 0; column < row.size(); ++column)
+            row[column] = (row[column] - standardization.Mean(int(column))) / standardization.Scale(int(column));
+    }
+}
+
+void ExpandFeatures(const CSV& data, const FeatureExpansion& expansion, CSV& expanded)
+{
+    // make the headers
+    expanded.headers.clear();
+    for (int column : expansion.columns)
+    {
+        for (int power = expansion.degree; power > 1; --power)
+            expanded.headers.push_back(data.headers[column] + "^" + std::to_string(power));
+        expanded.headers.push_back(data.headers[column]);
+    }
+    if (expansion.interactions)
+    {
+        for (size_t i = 0; i < expansion.columns.size(); ++i)
+            for (size_t j = i + 1; j < expansion.columns.size(); ++j)
+                expanded.headers.push_back(data.headers[expansion.columns[i]] + "*" + data.headers[expansion.columns[j]]);
+    }
+    expanded.headers.push_back(data.headers[expansion.valueIndex]);
+
+    // make the data
+    expanded.data.resize(data.data.size());
+    for (size_t rowIndex = 0; rowIndex < data.data.size(); ++rowIndex)
+    {
+        const std::vector<double>& row = data.data[rowIndex];
+        std::vector<double>& expandedRow = expanded.data[rowIndex];
+        expandedRow.clear();
+        expandedRow.reserve(expanded.headers.size());
+
+        for (int column : expansion.columns)
+        {
+            double x = row[column];
+            for (int power = expansion.degree; power > 0; --power)
+                expandedRow.push_back(pow(x, double(power)));
+        }
+
+        if (expansion.interactions)
+        {
+            for (size_t i = 0; i < expansion.columns.size(); ++i)
+                for (size_t j = i + 1; j < expansion.columns.size(); ++j)
+                    expandedRow.push_back(row[expansion.columns[i]] * row[expansion.columns[j]]);
+        }
+
+        expandedRow.push_back(row[expansion.valueIndex]);
+    }
+}
+
+void DescribePolynomial(const CSV& data, const FeatureExpansion& expansion, const Standardization& standardization, const double* coefficients, PolynomialForm& polynomial)
+{
+    polynomial.columns.clear();
+    polynomial.mean.clear();
+    polynomial.scale.clear();
+    for (int column : expansion.columns)
+    {
+        polynomial.columns.push_back(data.headers[column]);
+        polynomial.mean.push_back(standardization.Mean(column));
+        polynomial.scale.push_back(standardization.Scale(column));
+    }
+    polynomial.degree = expansion.degree;
+    polynomial.interactions = expansion.interactions;
+    polynomial.coefficients.assign(coefficients, coefficients + expansion.ColumnCount() + 1);
+}
+
+void UnstandardizeExpandedCoefficients(double* coefficients, const FeatureExpansion& expansion, const Standardization& standardization)
+{
+    // Coefficients learned on expanded standardized data are for powers and products of z = (x - mean) / scale.
+    // Expanding those out with the binomial theorem gives the coefficients that work on the expanded original data.
+    // The bias is the last coefficient, after the expanded columns.
+    size_t count = expansion.ColumnCount();
+    std::vector<double> result(count + 1, 0.0f);
+    result[count] = coefficients[count];
+
+    // the index of the coefficient for x^power of the column at columnIndex. power 0 is the bias.
+    auto PowerIndex = [&](size_t columnIndex, int power)
+    {
+        return (power == 0) ? count : columnIndex * size_t(expansion.degree) + size_t(expansion.degree - power);
+    };
+
+    for (size_t columnIndex = 0; columnIndex < expansion.columns.size(); ++columnIndex)
+    {
+        double mean = standardization.Mean(expansion.columns[columnIndex]);
+        double scale = standardization.Scale(expansion.columns[columnIndex]);
+
+        // a * ((x - mean) / scale)^p = a / scale^p * sum over k of (p choose k) * x^k * (-mean)^(p-k)
+        for (int power = 1; power <= expansion.degree; ++power)
+        {
+            double a = coefficients[PowerIndex(columnIndex, power)] / pow(scale, double(power));
+            double binomial = 1.0f;
+            for (int k = power; k >= 0; --k)
+            {
+                result[PowerIndex(columnIndex, k)] += a * binomial * pow(-mean, double(power - k));
+                binomial = binomial * double(k) / double(power - k + 1);
+            }
+        }
+    }
+
+    if (expansion.interactions)
+    {
+        // a * (x - meanX) / scaleX * (y - meanY) / scaleY = a / (scaleX * scaleY) * (xy - meanY x - meanX y + meanX meanY)
+        size_t index = expansion.columns.size() * size_t(expansion.degree);
+        for (size_t i = 0; i < expansion.columns.size(); ++i)
+        {
+            for (size_t j = i + 1; j < expansion.columns.size(); ++j)
+            {
+                double meanX = standardization.Mean(expansion.columns[i]);
+                double meanY = standardization.Mean(expansion.columns[j]);
+                double a = coefficients[index] / (standardization.Scale(expansion.columns[i]) * standardization.Scale(expansion.columns[j]));
+
+                result[index] += a;
+                result[PowerIndex(i, 1)] -= a * meanY;
+                result[PowerIndex(j, 1)] -= a * meanX;
+                result[count] += a * meanX * meanY;
+                index++;
+            }
+        }
+    }
+
+    for (size_t index = 0; index <= count; ++index)
+        coefficients[index] = result[index];
+}
+
+static void AppendFormatted(std::string& text, const char* format, va_list args)
+{
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = vsnprintf(nullptr, 0, format, argsCopy);
+    va_end(argsCopy);
+    if (length <= 0)
+        return;
+
+    size_t start = text.size();
+    text.resize(start + size_t(length) + 1);
+    vsnprintf(&text[start], size_t(length) + 1, format, args);
+    text.resize(start + size_t(length));
+}
+
+void ModelReport::Printf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    AppendFormatted(text, format, args);
+    va_end(args);
+}
+
+void ModelReport::Fail(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    AppendFormatted(text, format, args);
+    va_end(args);
+    succeeded = false;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -14,10 +15,20 @@ inline double sqr(double x)
     return x * x;
 }
 
-struct CSV
+template <size_t N>
+double Dot(const std::array<double, N>& A, const std::array<double, N>& B)
+{
+    double ret = 0.0f;
+    for (size_t i = 0; i < N; ++i)
+        ret += A[i] * B[i];
+    return ret;
+}
+
+template <typename T>
+struct CSVT
 {
     std::vector<std::string> headers;
-    std::vector<std::vector<double>> data;
+    std::vector<std::vector<T>> data;
 
     int GetHeaderIndex(const char* h) const
     {
@@ -30,8 +41,102 @@ struct CSV
         }
         return -1;
     }
+
+    size_t DataBytes() const
+    {
+        return data.size() * headers.size() * sizeof(T);
+    }
+};
+
+typedef CSVT<double> CSV;
+
+// Some of the rows of a CSVT, without copying them. Either a range of rows or a list of row indices, so a train/validation
+// split, a cross validation fold or a bootstrap sample only costs an index array, not a copy of the data.
+// The fit, loss and metric functions all take views.
+template <typename T>
+struct DataView
+{
+    const CSVT<T>* csv = nullptr;
+
+    // if useIndices is true, the rows are csv->data[indices[i]]. Otherwise they are the range [begin, end).
+    bool useIndices = false;
+    std::vector<size_t> indices;
+    size_t begin = 0;
+    size_t end = 0;
+
+    size_t Size() const
+    {
+        return useIndices ? indices.size() : end - begin;
+    }
+
+    // the index of the i'th row of the view, in the csv
+    size_t RowIndex(size_t i) const
+    {
+        return useIndices ? indices[i] : begin + i;
+    }
+
+    const std::vector<T>& Row(size_t i) const
+    {
+        return csv->data[RowIndex(i)];
+    }
 };
 
+template <typename T>
+DataView<T> RowRange(const CSVT<T>& csv, size_t begin, size_t end)
+{
+    DataView<T> view;
+    view.csv = &csv;
+    view.begin = begin;
+    view.end = end;
+    return view;
+}
+
+template <typename T>
+DataView<T> AllRows(const CSVT<T>& csv)
+{
+    return RowRange(csv, 0, csv.data.size());
+}
+
+template <typename T>
+DataView<T> SelectRows(const CSVT<T>& csv, std::vector<size_t> indices)
+{
+    DataView<T> view;
+    view.csv = &csv;
+    view.useIndices = true;
+    view.indices = std::move(indices);
+    return view;
+}
+
+// Rows of a view, like a fold of a split. The indices are rows of the view, not the csv.
+template <typename T>
+DataView<T> SelectRows(const DataView<T>& view, const std::vector<size_t>& indices)
+{
+    std::vector<size_t> csvIndices(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+        csvIndices[i] = view.RowIndex(indices[i]);
+    return SelectRows(*view.csv, std::move(csvIndices));
+}
+
+// The scalar type the models store their training data as.
+// The CSV values are parsed as float, so float storage halves the memory and bandwidth of every loss pass while
+// losing very little. Losses and gradients are still accumulated in double.
+typedef float TrainingScalar;
+
+template <typename T>
+const char* ScalarTypeName()
+{
+    return sizeof(T) == sizeof(float) ? "float32" : "float64";
+}
+
+template <typename TO, typename FROM>
+void ConvertCSV(const CSVT<FROM>& from, CSVT<TO>& to)
+{
+    to.headers = from.headers;
+    to.data.resize(from.data.size());
+    for (size_t rowIndex = 0; rowIndex < from.data.size(); ++rowIndex)
+        to.data[rowIndex].assign(from.data[rowIndex].begin(), from.data[rowIndex].end());
+}
+
 struct Average
 {
     int samples = 0;
@@ -44,14 +149,198 @@ struct Average
     }
 };
 
+// Statistics of a column of a CSV, calculated while it's parsed, so nothing that needs them has to go over the rows again
+struct ColumnStats
+{
+    double min = 0.0f;
+    double max = 0.0f;
+    double mean = 0.0f;
+
+    // the population variance, E[x^2] - E[x]^2
+    double variance = 0.0f;
+
+    // an estimate of how many different values the column has, from linear counting of hashed values. It's close to exact
+    // for the small counts of categorical columns, within a few percent into the tens of thousands, and a lower bound past that.
+    double distinctCount = 0.0f;
+
+    // if every value is 0 or 1, like the one hot columns
+    bool binary = false;
+};
+
+// Per column mean and scale, used to standardize data so every column has a mean of 0 and a standard deviation of 1.
+// Gradient based fitting is much better conditioned on standardized data.
+struct Standardization
+{
+    // the mean and standard deviation of every column, calculated from the training data
+    std::vector<double> mean;
+    std::vector<double> scale;
+
+    // columns which are left as is when standardizing, like the value being predicted
+    std::vector<bool> skip;
+
+    double Mean(int column) const
+    {
+        return skip[column] ? 0.0f : mean[column];
+    }
+
+    double Scale(int column) const
+    {
+        return skip[column] ? 1.0f : scale[column];
+    }
+};
+
+// Describes extra columns made out of data columns: the powers of each column, and optionally the products of each pair of columns.
+// Polynomial fits become linear fits over the expanded columns, so evaluating them is a dot product per row
+// instead of recalculating x*x and x*x*x every time.
+struct FeatureExpansion
+{
+    // the data columns to expand
+    std::vector<int> columns;
+
+    // each column becomes the columns x^degree, ..., x^2, x
+    int degree = 1;
+
+    // if true, the product of each pair of columns (like xy) is added after the powers
+    bool interactions = false;
+
+    // the column being predicted. It's copied to the end of the expanded data.
+    int valueIndex = -1;
+
+    // how many columns the expansion makes, not counting the value column
+    size_t ColumnCount() const
+    {
+        size_t count = columns.size() * size_t(degree);
+        if (interactions)
+            count += columns.size() * (columns.size() - 1) / 2;
+        return count;
+    }
+};
+
+// A model that's a polynomial of a few data columns, described completely enough to score rows without the program, like
+// in generated code. The columns are standardized, expanded like a FeatureExpansion, and dotted with the coefficients.
+struct PolynomialForm
+{
+    std::vector<std::string> columns;
+
+    // the standardization of each column
+    std::vector<double> mean;
+    std::vector<double> scale;
+
+    int degree = 1;
+    bool interactions = false;
+
+    // the coefficients of the expanded standardized columns, then the constant
+    std::vector<double> coefficients;
+};
+
+// The data the models work on. Loaded and preprocessed once, and shared by all the models.
+struct Dataset
+{
+    CSV train;
+    CSV test;
+
+    // the statistics of every column of train and test, from when they were loaded
+    std::vector<ColumnStats> trainStats;
+    std::vector<ColumnStats> testStats;
+
+    // train and test standardized using the mean and scale of the training data. Models train on these
+    // and map their coefficients back to the original units for reporting and scoring.
+    Standardization standardization;
+    CSV trainStandardized;
+    CSV testStandardized;
+};
+
+// Hyperparameters for a model run, by name, like "population" or "L2". These come from the command line or a config file.
+// Models fall back to their own defaults for anything that isn't set.
+struct ModelSettings
+{
+    std::unordered_map<std::string, double> values;
+
+    // where a model that supports it saves checkpoints, so an interrupted run can resume. Empty to not checkpoint.
+    std::string checkpointFileName;
+
+    // where a model that supports it writes the loss of every optimizer step. Empty to not trace.
+    std::string traceFileName;
+
+    // where the runner saves generated C++ code that scores rows with the fitted model, if the model is a polynomial of the
+    // data columns. Empty to not generate it.
+    std::string scoringHeaderFileName;
+
+    // where the runner saves the fitted model for the scoring server, if the model is linear in the data columns. Empty to
+    // not save it.
+    std::string scoringModelFileName;
+
+    // the columns a model that fits several targets at once predicts. Empty for the model's own choice.
+    std::vector<std::string> targets;
+
+    double Get(const char* name, double defaultValue) const
+    {
+        auto it = values.find(name);
+        return (it == values.end()) ? defaultValue : it->second;
+    }
+};
+
+// What a model run reports. Runs happen concurrently, so models write their human readable text here instead of
+// to stdout, and the runner prints it all at once when the run is done. The values and coefficients are written out as
+// structured results.
+struct ModelReport
+{
+    std::string text;
+    std::vector<std::pair<std::string, double>> values;
+    std::vector<double> coefficients;
+    bool succeeded = true;
+
+    // for models that are linear in the data columns, the column of each coefficient, in the units of the original data.
+    // The last coefficient is the constant. Runs that set these can be saved as scoring models.
+    std::vector<std::string> coefficientColumns;
+
+    // for models that are polynomials of a few data columns, the polynomial in the standardized units it was learned in.
+    // Empty columns if the model isn't one.
+    PolynomialForm polynomial;
+
+    void Printf(const char* format, ...);
+
+    // Like Printf, but also marks the run as failed
+    void Fail(const char* format, ...);
+
+    void Value(const char* name, double value)
+    {
+        values.push_back(std::make_pair(std::string(name), value));
+    }
+};
+
 bool LoadCSV(const char* fileName, CSV& csv);
 
-void Model1(const CSV& train, const CSV& test);
-void Model2(const CSV& train, const CSV& test);
-void Model3(const CSV& train, const CSV& test);
-void Model4(const CSV& train, const CSV& test);
-void Model5(const CSV& train, const CSV& test);
-void Model6(const CSV& train, const CSV& test);
-void Model7(const CSV& train, const CSV& test);
-void Model8(const CSV& train, const CSV& test);
-void Model9(const CSV& train, const CSV& test);
+// Loads a CSV file, calculating the statistics of every column in the same pass as the parsing
+bool LoadCSV(const char* fileName, CSV& csv, std::vector<ColumnStats>& stats);
+
+// For reading a CSV file a piece at a time, like only the rows appended since it was last read. Offsets are in bytes.
+// Reads the headers, and gives the offset of the first row.
+bool ReadCSVHeaders(const char* fileName, CSV& csv, size_t& dataOffset);
+
+// Reads up to maxRows complete rows starting at offset, appending them to csv.data, and gives the offset after the last one.
+// A last line without a line ending isn't read, since it might still be being written.
+bool ReadCSVRows(const char* fileName, size_t offset, size_t maxRows, CSV& csv, size_t& endOffset);
+
+void CalculateStandardization(const std::vector<ColumnStats>& stats, const std::vector<int>& skipColumns, Standardization& standardization);
+void Standardize(const CSV& data, const Standardization& standardization, CSV& standardized);
+
+void ExpandFeatures(const CSV& data, const FeatureExpansion& expansion, CSV& expanded);
+// Describes a fit over standardized expanded columns as a PolynomialForm. coefficients are in standardized units, with the
+// constant last. A linear fit is an expansion with a degree of 1.
+void DescribePolynomial(const CSV& data, const FeatureExpansion& expansion, const Standardization& standardization, const double* coefficients, PolynomialForm& polynomial);
+
+void UnstandardizeExpandedCoefficients(double* coefficients, const FeatureExpansion& expansion, const Standardization& standardization);
+
+void Model1(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model2(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model3(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model4(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model5(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model6(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model7(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model8(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model9(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model10(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model11(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);
+void Model12(const Dataset& dataset, const ModelSettings& settings, ModelReport& report);